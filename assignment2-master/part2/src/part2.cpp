@@ -17,18 +17,37 @@
 #include <iostream>
 #include <cstdlib>
 #include <algorithm>
+#include <list>
+#include <deque>
+#include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 // The attribute locations we will use in the vertex shader
 enum AttributeLocation {
     POSITION = 0,
-    NORMAL = 1
+    NORMAL = 1,
+    INSTANCE_MODEL = 2  // four locations, one per matrix column
 };
 
-// Struct for representing an indexed triangle mesh
+// Struct for representing an indexed triangle mesh. Meshes loaded from
+// a mesh cache keep the cache file mapped instead of filling the vectors.
 struct Mesh {
     std::vector<glm::vec3> vertices;
     std::vector<glm::vec3> normals;
     std::vector<uint32_t> indices;
+    MeshCache cache;
+};
+
+// Vertex layout options of a MeshVAO
+enum MeshVAOFlags {
+    MESH_VAO_QUANTIZED = 1,  // vertices in the QuantizedMesh format
+    MESH_VAO_INTERLEAVED = 2,  // all vertex attributes in vertexVBO
+    MESH_VAO_TEXCOORDS = 4,  // UV texture coordinates (interleaved only)
+    MESH_VAO_LODS = 8,  // chain of levels of detail in indexVBO
+    MESH_VAO_MESHLETS = 16,  // meshlets of every level, for culling
+    MESH_VAO_BVH = 32  // BVH of the full-resolution triangles, for picking
 };
 
 // Struct for representing a vertex array object (VAO) created from a
@@ -36,10 +55,83 @@ struct Mesh {
 struct MeshVAO {
     GLuint vao;
     GLuint vertexVBO;
-    GLuint normalVBO;
+    GLuint normalVBO;  // 0 for interleaved vertices
     GLuint indexVBO;
     int numVertices;
     int numIndices;
+    GLenum indexType;  // GL_UNSIGNED_INT or GL_UNSIGNED_SHORT
+    int flags;  // MeshVAOFlags
+    GLsizei stride;  // bytes per interleaved vertex
+    glm::vec3 positionOffset;
+    glm::vec3 positionScale;
+    MeshLODChain lods;  // levels of detail (without the indices)
+    std::vector<Meshlet> meshlets;
+    std::vector<std::size_t> lodFirstMeshlet;  // first meshlet of each level, and the total
+    MeshBVH bvh;  // triangles in the order of the index buffer
+    glm::vec3 boundsMin;  // bounding box of the vertices
+    glm::vec3 boundsMax;
+    GLuint instanceVBO;  // 0 for a single mesh
+    std::vector<glm::mat4> instances;  // model matrices, applied before the trackball
+    SceneBounds instanceBounds;  // bounding boxes of the instances
+    std::vector<glm::vec3> occluderVertices;  // level of detail for occlusion culling
+    std::vector<std::uint32_t> occluderIndices;
+    float occluderError;  // error of the occluder level, in model units
+};
+
+// Contents of the buffers of a MeshVAO prepared on the CPU, with the
+// information required by draw calls, ready to be uploaded
+struct PreparedMesh {
+    MeshVAO meshVAO;  // without GL objects
+    std::vector<std::uint8_t> vertexData;
+    std::vector<std::uint8_t> normalData;  // empty for interleaved vertices
+    std::vector<std::uint8_t> indexData;
+};
+
+// Cache of mesh VAOs by filename, which keeps the most recently used
+// meshes resident up to a budget of GPU memory. The least recently used
+// meshes are evicted first.
+struct MeshVAOCache {
+    struct Entry {
+        std::string filename;
+        MeshVAO meshVAO;
+        std::size_t bytes;  // GPU memory of the buffers
+    };
+    std::list<Entry> entries;  // most recently used first
+    std::unordered_map<std::string, std::list<Entry>::iterator> lookup;
+    std::size_t budget = 64 * 1024 * 1024;  // bytes
+    std::size_t bytes = 0;  // total of the entries
+};
+
+// Stages of loading a mesh in the background
+enum MeshLoadStage {
+    MESH_LOAD_IDLE = 0,
+    MESH_LOAD_PARSING,  // reading the OBJ file or mesh cache
+    MESH_LOAD_PREPARING  // building the vertex data (levels of detail, meshlets, BVH)
+};
+
+// Loader of meshes on a worker thread. The worker reads the meshes and
+// prepares their buffer contents, and queues them for the main thread,
+// which uploads them (GL calls must be made on the thread of the
+// context).
+struct MeshLoader {
+    struct Request {
+        std::string filename;
+        int flags;  // MeshVAOFlags
+    };
+    struct Result {
+        std::string filename;
+        bool loaded;
+        PreparedMesh prepared;
+    };
+    std::thread thread;
+    std::mutex mutex;  // guards all other members
+    std::condition_variable condition;
+    std::deque<Request> requests;
+    std::deque<Result> results;  // upload queue
+    std::string loading;  // file loaded by the worker
+    MeshLoadStage stage = MESH_LOAD_IDLE;
+    double loadStart = 0.0;  // time when the worker started the file
+    bool quit = false;
 };
 
 // Struct for resources and state
@@ -49,11 +141,49 @@ struct Context {
     GLFWwindow *window;
     GLuint program;
     Trackball trackball;
-    Mesh mesh;
-    MeshVAO meshVAO;
+    MeshVAOCache meshCache;
+    MeshVAO *meshVAO;  // current mesh (owned by meshCache)
+    std::vector<std::string> models;  // OBJ files in the model directory
+    int currentModel;
+    int meshFlags;  // vertex layout of the meshes (see MeshVAOFlags)
+    MeshLoader meshLoader;
+    std::string pendingModel;  // model that replaces the current mesh once loaded
+    double pendingStart;  // time when the model was selected
     GLuint defaultVAO;
+    int meshLOD;  // level of detail drawn in the last frame
+    int numTrianglesDrawn;  // in the last frame
+    int numTrianglesCulled;  // in the last frame
+    bool meshletCulling;
+    glm::mat4 model;  // matrices of the last frame, for picking
+    glm::mat4 mvp;
+    MeshVAO gridVAO;  // instances of a mesh on a grid, for stress tests
+    int gridSize;  // instances per side of the grid (0 to draw the current mesh)
+    bool instancing;  // one instanced draw call instead of one per instance
+    int numDrawCalls;  // in the last frame
+    double frameTime;  // seconds
+    double lastFrame;  // time of the last frame
+    double lastTitle;  // time of the last window title update
+    bool sceneCulling;  // frustum and occlusion culling of instances
+    OcclusionBuffer occlusionBuffer;
+    int numInstancesDrawn;  // in the last frame
+    int numFrustumCulled;  // in the last frame
+    int numOcclusionCulled;  // in the last frame
 };
 
+// Computes the bounding box of vertices
+void computeBounds(const glm::vec3 *vertices, std::size_t numVertices, glm::vec3 *boundsMin,
+                   glm::vec3 *boundsMax)
+{
+    *boundsMin = *boundsMax = glm::vec3(0.0f);
+    if (numVertices > 0) {
+        *boundsMin = *boundsMax = vertices[0];
+        for (std::size_t i = 1; i < numVertices; ++i) {
+            *boundsMin = glm::min(*boundsMin, vertices[i]);
+            *boundsMax = glm::max(*boundsMax, vertices[i]);
+        }
+    }
+}
+
 // Returns the value of an environment variable
 std::string getEnvVar(const std::string &name)
 {
@@ -88,50 +218,583 @@ std::string modelDir(void)
     return rootDir + "/part2/3d_models/";
 }
 
+// Loads a mesh from its mesh cache if that is up to date, and otherwise
+// from the OBJ file, optimizes its vertex order for rendering, and
+// writes the mesh cache
 void loadMesh(const std::string &filename, Mesh *mesh)
 {
+    meshCacheClose(&mesh->cache);
+    if (meshCacheOpen(&mesh->cache, filename)) {
+        mesh->vertices.clear();
+        mesh->normals.clear();
+        mesh->indices.clear();
+        return;
+    }
+
+    // A mesh that fails to load is left empty, and not cached
     OBJMesh obj_mesh;
-    objMeshLoad(obj_mesh, filename);
+    if (objMeshLoad(obj_mesh, filename)) {
+        optimizeMeshVertexOrder(obj_mesh);
+        meshCacheWrite(obj_mesh, filename);
+    }
+    else {
+        obj_mesh = OBJMesh();
+    }
     mesh->vertices = obj_mesh.vertices;
     mesh->normals = obj_mesh.normals;
     mesh->indices = obj_mesh.indices;
 }
 
-void createMeshVAO(Context &ctx, const Mesh &mesh, MeshVAO *meshVAO)
+// Creates a vertex array object (VAO) for drawing a mesh from the
+// vertex, normal, and index VBOs of meshVAO. Quantized vertices are
+// passed as normalized integers and decoded by the vertex shader.
+// Interleaved vertices store the position and normal of a vertex one
+// after the other in vertexVBO.
+void createMeshVertexArray(Context &ctx, MeshVAO *meshVAO)
+{
+    bool quantized = (meshVAO->flags & MESH_VAO_QUANTIZED) != 0;
+    bool interleaved = (meshVAO->flags & MESH_VAO_INTERLEAVED) != 0;
+    std::size_t positionSize = quantized ? 4 * sizeof(std::uint16_t) : sizeof(glm::vec3);
+    GLsizei stride = interleaved ? meshVAO->stride : 0;
+    const GLvoid *normalOffset = reinterpret_cast<const GLvoid *>(interleaved ? positionSize : 0);
+
+    glGenVertexArrays(1, &(meshVAO->vao));
+    glBindVertexArray(meshVAO->vao);
+    glBindBuffer(GL_ARRAY_BUFFER, meshVAO->vertexVBO);
+    glEnableVertexAttribArray(POSITION);
+    if (quantized) {
+        glVertexAttribPointer(POSITION, 4, GL_UNSIGNED_SHORT, GL_TRUE, stride, nullptr);
+    }
+    else {
+        glVertexAttribPointer(POSITION, 3, GL_FLOAT, GL_FALSE, stride, nullptr);
+    }
+    if (!interleaved) {
+        glBindBuffer(GL_ARRAY_BUFFER, meshVAO->normalVBO);
+    }
+    glEnableVertexAttribArray(NORMAL);
+    if (quantized) {
+        glVertexAttribPointer(NORMAL, 2, GL_SHORT, GL_TRUE, stride, normalOffset);
+    }
+    else {
+        glVertexAttribPointer(NORMAL, 3, GL_FLOAT, GL_FALSE, stride, normalOffset);
+    }
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, meshVAO->indexVBO);
+    glBindVertexArray(ctx.defaultVAO); // unbinds the VAO
+}
+
+// Prepares the buffer contents and draw information of a VAO from arrays
+// of vertices, normals, and indices, with the vertex layout given by
+// flags (MeshVAOFlags). Makes no GL calls, so it can run on any thread.
+void prepareMeshVAO(const glm::vec3 *vertices, const glm::vec3 *normals,
+                    std::size_t numVertices, const uint32_t *indices,
+                    std::size_t numIndices, int flags, PreparedMesh *prepared)
 {
+    flags &= ~MESH_VAO_TEXCOORDS;
+    MeshVAO *meshVAO = &(prepared->meshVAO);
+
+    // The levels of detail are stored one after the other in the index
+    // buffer, starting with the full-resolution mesh
+    meshVAO->lods = MeshLODChain();
+    std::size_t numFullIndices = numIndices;
+    if ((flags & MESH_VAO_LODS) != 0) {
+        buildMeshLODChain(vertices, numVertices, indices, numIndices, 5, &(meshVAO->lods));
+        indices = meshVAO->lods.indices.data();
+        numIndices = meshVAO->lods.indices.size();
+    }
+
+    // Meshlets of every level of detail, for culling. The triangles of
+    // each level are reordered into the meshlets.
+    meshVAO->meshlets.clear();
+    meshVAO->lodFirstMeshlet.clear();
+    std::vector<std::uint32_t> meshletIndices;
+    if ((flags & MESH_VAO_MESHLETS) != 0) {
+        meshletIndices.assign(indices, indices + numIndices);
+        std::vector<std::size_t> levels = meshVAO->lods.offsets;
+        if (levels.empty()) {
+            levels = { 0, numIndices };
+        }
+        for (std::size_t l = 0; l + 1 < levels.size(); ++l) {
+            meshVAO->lodFirstMeshlet.push_back(meshVAO->meshlets.size());
+            buildMeshlets(vertices, numVertices, meshletIndices.data(), levels[l],
+                          levels[l + 1] - levels[l], &(meshVAO->meshlets));
+        }
+        meshVAO->lodFirstMeshlet.push_back(meshVAO->meshlets.size());
+        indices = meshletIndices.data();
+    }
+
+    // BVH of the full-resolution level, for picking
+    meshVAO->bvh = MeshBVH();
+    if ((flags & MESH_VAO_BVH) != 0) {
+        buildMeshBVH(vertices, indices, numFullIndices, &(meshVAO->bvh));
+    }
+
+    // Copy of the coarsest level of detail within OCCLUDER_MAX_ERROR of
+    // the full mesh (with only the vertices it uses), rasterized on the
+    // CPU as an occluder. A simplified mesh is not contained in the full
+    // mesh, so cullInstances shrinks the occluders by the error of the level
+    meshVAO->occluderVertices.clear();
+    meshVAO->occluderIndices.clear();
+    meshVAO->occluderError = 0.0f;
+    if (!meshVAO->lods.errors.empty()) {
+        const float OCCLUDER_MAX_ERROR = 0.01f;  // relative to the radius
+        std::size_t level = 0;
+        while (level + 1 < meshVAO->lods.errors.size() &&
+               meshVAO->lods.errors[level + 1] <= OCCLUDER_MAX_ERROR) {
+            level++;
+        }
+        meshVAO->occluderError = meshVAO->lods.errors[level] * meshVAO->lods.radius;
+        std::vector<std::uint32_t> remap(numVertices, UINT32_MAX);
+        for (std::size_t i = meshVAO->lods.offsets[level]; i < meshVAO->lods.offsets[level + 1]; ++i) {
+            if (remap[indices[i]] == UINT32_MAX) {
+                remap[indices[i]] = std::uint32_t(meshVAO->occluderVertices.size());
+                meshVAO->occluderVertices.push_back(vertices[indices[i]]);
+            }
+            meshVAO->occluderIndices.push_back(remap[indices[i]]);
+        }
+    }
+
+    bool quantized = (flags & MESH_VAO_QUANTIZED) != 0;
+    std::size_t positionSize = quantized ? 4 * sizeof(std::uint16_t) : sizeof(glm::vec3);
+    std::size_t normalSize = quantized ? 2 * sizeof(std::int16_t) : sizeof(glm::vec3);
+    const void *vertexData = vertices;
+    const void *normalData = normals;
+    const void *indexData = indices;
+    auto verticesNBytes = numVertices * positionSize;
+    auto normalsNBytes = numVertices * normalSize;
+    auto indicesNBytes = numIndices * sizeof(indices[0]);
+    meshVAO->indexType = GL_UNSIGNED_INT;
+    meshVAO->flags = flags;
+    meshVAO->stride = 0;
+    meshVAO->positionOffset = glm::vec3(0.0f);
+    meshVAO->positionScale = glm::vec3(1.0f);
+    QuantizedMesh compact;
+    if (quantized) {
+        quantizeMesh(vertices, normals, numVertices, indices, numIndices, &compact);
+        vertexData = compact.positions.data();
+        normalData = compact.normals.data();
+        if (!compact.indices16.empty()) {
+            indexData = compact.indices16.data();
+            indicesNBytes = compact.indices16.size() * sizeof(compact.indices16[0]);
+            meshVAO->indexType = GL_UNSIGNED_SHORT;
+        }
+        meshVAO->positionOffset = compact.positionOffset;
+        meshVAO->positionScale = compact.positionScale;
+    }
+    if ((flags & MESH_VAO_INTERLEAVED) != 0) {
+        std::vector<VertexAttributeArray> attributes = {
+            { vertexData, positionSize }, { normalData, normalSize } };
+        meshVAO->stride = interleaveVertexAttributes(attributes, numVertices, 4, &(prepared->vertexData));
+        prepared->normalData.clear();
+    }
+    else {
+        auto vertexBytes = static_cast<const std::uint8_t *>(vertexData);
+        auto normalBytes = static_cast<const std::uint8_t *>(normalData);
+        prepared->vertexData.assign(vertexBytes, vertexBytes + verticesNBytes);
+        prepared->normalData.assign(normalBytes, normalBytes + normalsNBytes);
+    }
+    auto indexBytes = static_cast<const std::uint8_t *>(indexData);
+    prepared->indexData.assign(indexBytes, indexBytes + indicesNBytes);
+
+    // Additional information required by draw calls
+    meshVAO->numVertices = numVertices;
+    meshVAO->numIndices = numFullIndices;
+    meshVAO->lods.indices = std::vector<std::uint32_t>();
+    computeBounds(vertices, numVertices, &(meshVAO->boundsMin), &(meshVAO->boundsMax));
+    meshVAO->vao = 0;
+    meshVAO->vertexVBO = 0;
+    meshVAO->normalVBO = 0;
+    meshVAO->indexVBO = 0;
+    meshVAO->instanceVBO = 0;
+    meshVAO->instances.clear();
+}
+
+// Uploads a prepared mesh into new VBOs and creates its VAO. The
+// prepared vertex data is released.
+void uploadMeshVAO(Context &ctx, PreparedMesh *prepared, MeshVAO *meshVAO)
+{
+    *meshVAO = std::move(prepared->meshVAO);
+
     // Generates and populates a VBO for the vertices
     glGenBuffers(1, &(meshVAO->vertexVBO));
     glBindBuffer(GL_ARRAY_BUFFER, meshVAO->vertexVBO);
-    auto verticesNBytes = mesh.vertices.size() * sizeof(mesh.vertices[0]);
-    glBufferData(GL_ARRAY_BUFFER, verticesNBytes, mesh.vertices.data(), GL_STATIC_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, prepared->vertexData.size(), prepared->vertexData.data(), GL_STATIC_DRAW);
 
     // Generates and populates a VBO for the vertex normals
-    glGenBuffers(1, &(meshVAO->normalVBO));
-    glBindBuffer(GL_ARRAY_BUFFER, meshVAO->normalVBO);
-    auto normalsNBytes = mesh.normals.size() * sizeof(mesh.normals[0]);
-    glBufferData(GL_ARRAY_BUFFER, normalsNBytes, mesh.normals.data(), GL_STATIC_DRAW);
+    meshVAO->normalVBO = 0;
+    if ((meshVAO->flags & MESH_VAO_INTERLEAVED) == 0) {
+        glGenBuffers(1, &(meshVAO->normalVBO));
+        glBindBuffer(GL_ARRAY_BUFFER, meshVAO->normalVBO);
+        glBufferData(GL_ARRAY_BUFFER, prepared->normalData.size(), prepared->normalData.data(), GL_STATIC_DRAW);
+    }
 
     // Generates and populates a VBO for the element indices
     glGenBuffers(1, &(meshVAO->indexVBO));
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, meshVAO->indexVBO);
-    auto indicesNBytes = mesh.indices.size() * sizeof(mesh.indices[0]);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indicesNBytes, mesh.indices.data(), GL_STATIC_DRAW);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, prepared->indexData.size(), prepared->indexData.data(), GL_STATIC_DRAW);
 
-    // Creates a vertex array object (VAO) for drawing the mesh
-    glGenVertexArrays(1, &(meshVAO->vao));
+    createMeshVertexArray(ctx, meshVAO);
+    *prepared = PreparedMesh();
+}
+
+// Creates a VAO from arrays of vertices, normals, and indices, with the
+// vertex layout given by flags (MeshVAOFlags)
+void createMeshVAO(Context &ctx, const glm::vec3 *vertices, const glm::vec3 *normals,
+                   std::size_t numVertices, const uint32_t *indices,
+                   std::size_t numIndices, MeshVAO *meshVAO, int flags)
+{
+    PreparedMesh prepared;
+    prepareMeshVAO(vertices, normals, numVertices, indices, numIndices, flags, &prepared);
+    uploadMeshVAO(ctx, &prepared, meshVAO);
+}
+
+void createMeshVAO(Context &ctx, const Mesh &mesh, MeshVAO *meshVAO, int flags = 0)
+{
+    // Meshes loaded from a mesh cache are uploaded straight from the
+    // mapped cache file
+    bool cached = (mesh.cache.vertices != nullptr);
+    std::size_t numVertices = cached ? mesh.cache.numVertices : mesh.vertices.size();
+    std::size_t numIndices = cached ? mesh.cache.numIndices : mesh.indices.size();
+    const glm::vec3 *vertices = cached ? mesh.cache.vertices : mesh.vertices.data();
+    const glm::vec3 *normals = cached ? mesh.cache.normals : mesh.normals.data();
+    const uint32_t *indices = cached ? mesh.cache.indices : mesh.indices.data();
+    createMeshVAO(ctx, vertices, normals, numVertices, indices, numIndices, meshVAO, flags);
+}
+
+// Loads a mesh (from its mesh cache if that is up to date, see
+// loadMesh) and creates its VAO with the vertex layout given by flags
+// (see MeshVAOFlags). The layouts, levels of detail, meshlets, and BVH
+// are built on the CPU, from the mapped cache file or a CPU copy of the
+// mesh that is released after the upload.
+void loadMeshVAO(Context &ctx, const std::string &filename, MeshVAO *meshVAO, int flags = 0)
+{
+    Mesh mesh;
+    loadMesh(filename, &mesh);
+    createMeshVAO(ctx, mesh, meshVAO, flags);
+    meshCacheClose(&mesh.cache);
+}
+
+void deleteMeshVAO(MeshVAO *meshVAO)
+{
+    glDeleteVertexArrays(1, &(meshVAO->vao));
+    glDeleteBuffers(1, &(meshVAO->vertexVBO));
+    glDeleteBuffers(1, &(meshVAO->normalVBO));
+    glDeleteBuffers(1, &(meshVAO->indexVBO));
+    glDeleteBuffers(1, &(meshVAO->instanceVBO));
+    *meshVAO = MeshVAO();
+}
+
+// Sets the model matrices of the instances of a mesh (none for a single
+// mesh), and uploads them into an instance VBO that is added to the VAO
+// as a per-instance attribute
+void setMeshInstances(Context &ctx, MeshVAO *meshVAO, const std::vector<glm::mat4> &instances)
+{
+    meshVAO->instances = instances;
+    meshVAO->instanceBounds = SceneBounds();
+    for (const glm::mat4 &instance : instances) {
+        glm::vec3 boundsMin, boundsMax;
+        transformBounds(instance, meshVAO->boundsMin, meshVAO->boundsMax, &boundsMin, &boundsMax);
+        sceneBoundsAdd(&(meshVAO->instanceBounds), boundsMin, boundsMax);
+    }
     glBindVertexArray(meshVAO->vao);
-    glBindBuffer(GL_ARRAY_BUFFER, meshVAO->vertexVBO);
-    glEnableVertexAttribArray(POSITION);
-    glVertexAttribPointer(POSITION, 3, GL_FLOAT, GL_FALSE, 0, nullptr);
-    glBindBuffer(GL_ARRAY_BUFFER, meshVAO->normalVBO);
-    glEnableVertexAttribArray(NORMAL);
-    glVertexAttribPointer(NORMAL, 3, GL_FLOAT, GL_FALSE, 0, nullptr);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, meshVAO->indexVBO);
-    glBindVertexArray(ctx.defaultVAO); // unbinds the VAO
+    if (instances.empty()) {
+        for (int column = 0; column < 4; ++column) {
+            glDisableVertexAttribArray(INSTANCE_MODEL + column);
+        }
+        glDeleteBuffers(1, &(meshVAO->instanceVBO));
+        meshVAO->instanceVBO = 0;
+        glBindVertexArray(ctx.defaultVAO);
+        return;
+    }
 
-    // Additional information required by draw calls
-    meshVAO->numVertices = mesh.vertices.size();
-    meshVAO->numIndices = mesh.indices.size();
+    if (meshVAO->instanceVBO == 0) {
+        glGenBuffers(1, &(meshVAO->instanceVBO));
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, meshVAO->instanceVBO);
+    glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(glm::mat4), instances.data(), GL_DYNAMIC_DRAW);
+    for (int column = 0; column < 4; ++column) {
+        glEnableVertexAttribArray(INSTANCE_MODEL + column);
+        glVertexAttribPointer(INSTANCE_MODEL + column, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4),
+                              reinterpret_cast<const GLvoid *>(column * sizeof(glm::vec4)));
+        glVertexAttribDivisor(INSTANCE_MODEL + column, 1);
+    }
+    glBindVertexArray(ctx.defaultVAO);
+}
+
+// Returns the model matrices of gridSize x gridSize instances of a mesh
+// on a grid in the xy plane, within [-1, 1]^2, each scaled to fit its
+// cell (so that the instances do not overlap)
+std::vector<glm::mat4> gridInstances(const MeshVAO &meshVAO, int gridSize)
+{
+    std::vector<glm::mat4> instances;
+    glm::vec3 center = 0.5f * (meshVAO.boundsMin + meshVAO.boundsMax);
+    float diameter = glm::length(meshVAO.boundsMax - meshVAO.boundsMin);
+    float cellSize = 2.0f / std::max(gridSize, 1);
+    float scale = 0.9f * cellSize / std::max(diameter, 1e-6f);
+    for (int y = 0; y < gridSize; ++y) {
+        for (int x = 0; x < gridSize; ++x) {
+            glm::vec3 cellCenter(-1.0f + (x + 0.5f) * cellSize, -1.0f + (y + 0.5f) * cellSize, 0.0f);
+            glm::mat4 instance = glm::translate(glm::mat4(1.0f), cellCenter);
+            instance = glm::scale(instance, glm::vec3(scale));
+            instances.push_back(glm::translate(instance, -center));
+        }
+    }
+    return instances;
+}
+
+// Places gridSize x gridSize instances of a mesh on a grid (see
+// gridInstances). The teapot is loaded the first time. A grid size of 0
+// removes the instances.
+void setGridSize(Context &ctx, int gridSize)
+{
+    if (ctx.gridVAO.vao == 0) {
+        int flags = MESH_VAO_QUANTIZED | MESH_VAO_LODS;
+        loadMeshVAO(ctx, (modelDir() + "teapot.obj"), &ctx.gridVAO, flags);
+    }
+    setMeshInstances(ctx, &ctx.gridVAO, gridInstances(ctx.gridVAO, gridSize));
+    ctx.gridSize = gridSize;
+}
+
+// Returns the GPU memory used by the buffers of a mesh VAO
+std::size_t meshVAOBytes(const MeshVAO &meshVAO)
+{
+    std::size_t bytes = 0;
+    for (GLuint buffer : { meshVAO.vertexVBO, meshVAO.normalVBO, meshVAO.indexVBO, meshVAO.instanceVBO }) {
+        if (buffer != 0) {
+            GLint size = 0;
+            glBindBuffer(GL_ARRAY_BUFFER, buffer);
+            glGetBufferParameteriv(GL_ARRAY_BUFFER, GL_BUFFER_SIZE, &size);
+            bytes += size;
+        }
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    return bytes;
+}
+
+// Returns the VAO of a cached mesh and marks it as most recently used,
+// or returns nullptr if the mesh is not cached
+MeshVAO *meshVAOCacheFind(MeshVAOCache *cache, const std::string &filename)
+{
+    auto it = cache->lookup.find(filename);
+    if (it == cache->lookup.end()) {
+        return nullptr;
+    }
+    // Move the entry to the front of the LRU list
+    cache->entries.splice(cache->entries.begin(), cache->entries, it->second);
+    return &(it->second->meshVAO);
+}
+
+// Inserts a mesh VAO into the cache (which takes ownership) and returns
+// the cached VAO. Then evicts the least recently used other meshes,
+// except keep (e.g., the mesh that is being drawn), until the cache is
+// within its budget.
+MeshVAO *meshVAOCacheInsert(MeshVAOCache *cache, const std::string &filename, MeshVAO &&meshVAO,
+                            const MeshVAO *keep)
+{
+    MeshVAO *cached = meshVAOCacheFind(cache, filename);
+    if (cached != nullptr) {
+        deleteMeshVAO(&meshVAO);
+        return cached;
+    }
+
+    MeshVAOCache::Entry entry;
+    entry.filename = filename;
+    entry.meshVAO = std::move(meshVAO);
+    entry.bytes = meshVAOBytes(entry.meshVAO);
+    cache->entries.push_front(std::move(entry));
+    cache->lookup[filename] = cache->entries.begin();
+    cache->bytes += cache->entries.front().bytes;
+
+    auto it = cache->entries.end();
+    while (cache->bytes > cache->budget && --it != cache->entries.begin()) {
+        if (&(it->meshVAO) == keep) {
+            continue;
+        }
+        std::cout << "Evicted " << it->filename << " (" << it->bytes / 1024
+                  << " KB) from the mesh cache" << std::endl;
+        cache->bytes -= it->bytes;
+        deleteMeshVAO(&(it->meshVAO));
+        cache->lookup.erase(it->filename);
+        it = cache->entries.erase(it);
+    }
+    return &(cache->entries.front().meshVAO);
+}
+
+// Worker thread of a mesh loader
+void meshLoaderRun(MeshLoader *loader)
+{
+    std::unique_lock<std::mutex> lock(loader->mutex);
+    while (true) {
+        loader->condition.wait(lock, [&] { return loader->quit || !loader->requests.empty(); });
+        if (loader->quit) {
+            return;
+        }
+        MeshLoader::Request request = loader->requests.front();
+        loader->requests.pop_front();
+        loader->loading = request.filename;
+        loader->stage = MESH_LOAD_PARSING;
+        loader->loadStart = glfwGetTime();
+        lock.unlock();
+
+        // Meshes loaded from a mesh cache are prepared straight from the
+        // mapped cache file
+        MeshLoader::Result result;
+        result.filename = request.filename;
+        Mesh mesh;
+        loadMesh(request.filename, &mesh);
+        bool cached = (mesh.cache.vertices != nullptr);
+        std::size_t numIndices = cached ? mesh.cache.numIndices : mesh.indices.size();
+        result.loaded = (numIndices > 0);
+        if (result.loaded) {
+            lock.lock();
+            loader->stage = MESH_LOAD_PREPARING;
+            lock.unlock();
+            prepareMeshVAO(cached ? mesh.cache.vertices : mesh.vertices.data(),
+                           cached ? mesh.cache.normals : mesh.normals.data(),
+                           cached ? mesh.cache.numVertices : mesh.vertices.size(),
+                           cached ? mesh.cache.indices : mesh.indices.data(), numIndices,
+                           request.flags, &result.prepared);
+        }
+        meshCacheClose(&mesh.cache);
+
+        lock.lock();
+        loader->results.push_back(std::move(result));
+        loader->loading.clear();
+        loader->stage = MESH_LOAD_IDLE;
+    }
+}
+
+void meshLoaderStart(MeshLoader *loader)
+{
+    loader->quit = false;
+    loader->thread = std::thread(meshLoaderRun, loader);
+}
+
+// Stops the worker thread after the mesh it is loading (if any)
+void meshLoaderStop(MeshLoader *loader)
+{
+    {
+        std::lock_guard<std::mutex> lock(loader->mutex);
+        loader->quit = true;
+    }
+    loader->condition.notify_one();
+    if (loader->thread.joinable()) {
+        loader->thread.join();
+    }
+}
+
+// Queues a mesh for loading, unless it is already queued or loading
+void meshLoaderRequest(MeshLoader *loader, const std::string &filename, int flags)
+{
+    {
+        std::lock_guard<std::mutex> lock(loader->mutex);
+        if (loader->loading == filename) {
+            return;
+        }
+        for (const MeshLoader::Request &request : loader->requests) {
+            if (request.filename == filename) {
+                return;
+            }
+        }
+        loader->requests.push_back({ filename, flags });
+    }
+    loader->condition.notify_one();
+}
+
+// Takes the next loaded mesh from the upload queue. Returns false if no
+// mesh is ready.
+bool meshLoaderPoll(MeshLoader *loader, MeshLoader::Result *result)
+{
+    std::lock_guard<std::mutex> lock(loader->mutex);
+    if (loader->results.empty()) {
+        return false;
+    }
+    *result = std::move(loader->results.front());
+    loader->results.pop_front();
+    return true;
+}
+
+// Returns a description of the mesh being loaded (with its stage and
+// the elapsed time), or an empty string if the loader is idle
+std::string meshLoaderStatus(MeshLoader *loader)
+{
+    std::lock_guard<std::mutex> lock(loader->mutex);
+    if (loader->stage == MESH_LOAD_IDLE) {
+        if (loader->requests.empty()) {
+            return std::string();
+        }
+        return "queued " + std::filesystem::path(loader->requests.front().filename).filename().string();
+    }
+    std::string name = std::filesystem::path(loader->loading).filename().string();
+    const char *stages[] = { "", "parsing", "preparing" };
+    char seconds[32];
+    std::snprintf(seconds, sizeof(seconds), "%.1f s", glfwGetTime() - loader->loadStart);
+    return "loading " + name + ": " + stages[loader->stage] + ", " + seconds;
+}
+
+// Finds the OBJ files in a directory, sorted by name
+void findModels(const std::string &dir, std::vector<std::string> *models)
+{
+    models->clear();
+    std::error_code error;
+    for (const auto &file : std::filesystem::directory_iterator(dir, error)) {
+        if (file.path().extension() == ".obj") {
+            models->push_back(file.path().filename().string());
+        }
+    }
+    std::sort(models->begin(), models->end());
+}
+
+// Makes a model of ctx.models the current mesh. Cached models are
+// switched to immediately; other models are loaded in the background,
+// while the current mesh is still drawn.
+void selectModel(Context &ctx, int index)
+{
+    if (index < 0 || index >= int(ctx.models.size())) {
+        return;
+    }
+    std::string filename = modelDir() + ctx.models[index];
+    ctx.currentModel = index;
+    ctx.pendingStart = glfwGetTime();
+    MeshVAO *cached = meshVAOCacheFind(&ctx.meshCache, filename);
+    if (cached != nullptr) {
+        ctx.meshVAO = cached;
+        ctx.pendingModel.clear();
+        std::cout << "Switched to " << ctx.models[index] << " (cached, " << ctx.meshCache.bytes / 1024
+                  << " KB in the mesh cache)" << std::endl;
+        return;
+    }
+    ctx.pendingModel = filename;
+    meshLoaderRequest(&ctx.meshLoader, filename, ctx.meshFlags);
+}
+
+// Uploads the meshes that the loader has finished into the mesh cache
+// (at most one per frame, to bound the stall), and swaps in the pending
+// model when it is ready. The previous mesh stays in the cache.
+void updateMeshLoading(Context &ctx)
+{
+    MeshLoader::Result result;
+    if (!meshLoaderPoll(&ctx.meshLoader, &result)) {
+        return;
+    }
+    if (!result.loaded) {
+        std::cerr << "Error: Could not load " << result.filename << std::endl;
+        if (result.filename == ctx.pendingModel) {
+            ctx.pendingModel.clear();
+        }
+        return;
+    }
+    MeshVAO meshVAO;
+    uploadMeshVAO(ctx, &result.prepared, &meshVAO);
+    MeshVAO *cached = meshVAOCacheInsert(&ctx.meshCache, result.filename, std::move(meshVAO), ctx.meshVAO);
+    if (result.filename == ctx.pendingModel) {
+        ctx.meshVAO = cached;
+        ctx.pendingModel.clear();
+
+        // Display log message
+        std::cout << "Switched to " << std::filesystem::path(result.filename).filename().string()
+                  << " after " << glfwGetTime() - ctx.pendingStart << " s (loaded, "
+                  << ctx.meshCache.bytes / 1024 << " KB in the mesh cache)" << std::endl;
+    }
 }
 
 void initializeTrackball(Context &ctx)
@@ -147,18 +810,130 @@ void init(Context &ctx)
     ctx.program = loadShaderProgram(shaderDir() + "mesh.vert",
                                     shaderDir() + "mesh.frag");
 
-    // Uncomment to load other 3D models
-	loadMesh((modelDir() + "armadillo.obj"), &ctx.mesh);
-	//loadMesh((modelDir() + "bunny.obj"), &ctx.mesh);
-	//loadMesh((modelDir() + "teapot.obj"), &ctx.mesh);
+    // Vertex layout of the meshes, with levels of detail, meshlets, and
+    // a BVH for picking
+    ctx.meshFlags = MESH_VAO_QUANTIZED | MESH_VAO_LODS | MESH_VAO_MESHLETS | MESH_VAO_BVH;
+
+    // Other 3D models are selected at runtime (with N or 1-9). Models are
+    // loaded in the background, so nothing is drawn until the first one
+    // is ready.
+    ctx.meshVAO = nullptr;
+    ctx.pendingStart = 0.0;
+    meshLoaderStart(&ctx.meshLoader);
+    findModels(modelDir(), &ctx.models);
+    auto armadillo = std::find(ctx.models.begin(), ctx.models.end(), "armadillo.obj");
+    selectModel(ctx, int(armadillo - ctx.models.begin()) % std::max(int(ctx.models.size()), 1));
 
-    createMeshVAO(ctx, ctx.mesh, &ctx.meshVAO);
+    ctx.meshLOD = 0;
+    ctx.numTrianglesDrawn = 0;
+    ctx.numTrianglesCulled = 0;
+    ctx.meshletCulling = true;
+    ctx.model = glm::mat4(1.0f);
+    ctx.mvp = glm::mat4(1.0f);
+    ctx.gridVAO = MeshVAO();
+    ctx.gridSize = 0;
+    ctx.instancing = true;
+    ctx.numDrawCalls = 0;
+    ctx.frameTime = 0.0;
+    ctx.lastFrame = glfwGetTime();
+    ctx.lastTitle = 0.0;
+    ctx.sceneCulling = true;
+    ctx.numInstancesDrawn = 0;
+    ctx.numFrustumCulled = 0;
+    ctx.numOcclusionCulled = 0;
 
     initializeTrackball(ctx);
 }
 
+// Culls the instances of a mesh that are outside the view frustum, or
+// hidden behind the nearest instances (rasterized at a simplified level of
+// detail into a quarter-resolution occlusion buffer), and returns the
+// model matrices of the remaining instances. The occlusion buffer is
+// eroded by the projected error of the occluder level, plus one texel for
+// sampling at texel centers, and the tested boxes are grown by the same
+// error, so culling is conservative as long as the error estimate of the
+// level (from its quadrics) holds.
+void cullInstances(Context &ctx, const MeshVAO &meshVAO, const glm::mat4 &mvp, const glm::mat4 &mv,
+                   std::vector<glm::mat4> *visibleInstances)
+{
+    const int MAX_OCCLUDERS = 32;
+    const int MAX_OCCLUDER_ERODE = 4;  // texels, farther occluders are skipped
+    const SceneBounds &bounds = meshVAO.instanceBounds;
+
+    glm::vec4 planes[6];
+    frustumPlanes(mvp, planes);
+    std::vector<std::uint8_t> visible;
+    std::size_t numVisible = cullSceneFrustum(bounds, planes, &visible);
+    ctx.numFrustumCulled = int(meshVAO.instances.size() - numVisible);
+
+    if (!meshVAO.occluderIndices.empty() && numVisible > 0) {
+        // Occluders are the visible instances nearest to the eye
+        std::vector<std::pair<float, std::size_t>> nearest;
+        for (std::size_t i = 0; i < visible.size(); ++i) {
+            if (visible[i]) {
+                glm::vec4 center = mv * meshVAO.instances[i][3];
+                nearest.push_back({ glm::length(glm::vec3(center.x, center.y, center.z)), i });
+            }
+        }
+        std::size_t numOccluders = std::min(nearest.size(), std::size_t(MAX_OCCLUDERS));
+        std::partial_sort(nearest.begin(), nearest.begin() + numOccluders, nearest.end());
+        OcclusionBuffer &buffer = ctx.occlusionBuffer;
+        occlusionBufferClear(&buffer, std::max(ctx.width / 4, 1), std::max(ctx.height / 4, 1));
+
+        // Pixels per unit at unit distance from the eye, to project the
+        // error of the occluder level into the buffer
+        glm::mat4 projection = mvp * glm::inverse(mv);
+        float focal = 0.5f * buffer.sizes[0].y * projection[1][1];
+        int erode = 0;
+        float maxError = 0.0f;  // in world units
+        for (std::size_t k = 0; k < numOccluders; ++k) {
+            const glm::mat4 &model = meshVAO.instances[nearest[k].second];
+            float scale = glm::length(glm::vec3(model[0].x, model[0].y, model[0].z));
+            float error = meshVAO.occluderError * scale;
+            float extent = (glm::length(meshVAO.lods.center) + meshVAO.lods.radius) * scale;
+            float distance = std::max(nearest[k].first - extent, 0.1f);
+            int radius = int(std::ceil(error * focal / distance)) + 1;
+            if (radius > MAX_OCCLUDER_ERODE) {
+                continue;
+            }
+            occlusionBufferRasterize(&buffer, mvp * model,
+                                     meshVAO.occluderVertices.data(), meshVAO.occluderIndices.data(),
+                                     meshVAO.occluderIndices.size());
+            erode = std::max(erode, radius);
+            maxError = std::max(maxError, error);
+        }
+        occlusionBufferErode(&buffer, erode);
+        occlusionBufferBuildHierarchy(&buffer);
+
+        // Tests the bounding boxes of the visible instances in parallel
+        std::atomic<int> numOccluded(0);
+        meshParallelFor(visible.size(), 1024, [&](std::size_t begin, std::size_t end) {
+            int count = 0;
+            for (std::size_t i = begin; i < end; ++i) {
+                glm::vec3 boundsMin(bounds.minX[i] - maxError, bounds.minY[i] - maxError,
+                                    bounds.minZ[i] - maxError);
+                glm::vec3 boundsMax(bounds.maxX[i] + maxError, bounds.maxY[i] + maxError,
+                                    bounds.maxZ[i] + maxError);
+                if (visible[i] && occlusionBufferTestBounds(buffer, mvp, boundsMin, boundsMax)) {
+                    visible[i] = 0;
+                    count++;
+                }
+            }
+            numOccluded += count;
+        });
+        ctx.numOcclusionCulled = numOccluded;
+    }
+
+    visibleInstances->clear();
+    for (std::size_t i = 0; i < visible.size(); ++i) {
+        if (visible[i]) {
+            visibleInstances->push_back(meshVAO.instances[i]);
+        }
+    }
+}
+
 // MODIFY THIS FUNCTION
-void drawMesh(Context &ctx, GLuint program, const MeshVAO &meshVAO)
+void drawMesh(Context &ctx, GLuint program, const MeshVAO &meshVAO, int numInstances = 1)
 {
     glUseProgram(program);
 
@@ -180,6 +955,8 @@ void drawMesh(Context &ctx, GLuint program, const MeshVAO &meshVAO)
     // variable to the shader program
 
 	glm::mat4 mvp = projection * view * model;
+	ctx.model = model;
+	ctx.mvp = mvp;
 
 	// Light position
 	glm::mat4 mv = view * model;
@@ -189,20 +966,234 @@ void drawMesh(Context &ctx, GLuint program, const MeshVAO &meshVAO)
 
 	glUniformMatrix4fv(glGetUniformLocation(ctx.program, "u_mvp"), 1, GL_FALSE, &mvp[0][0]);
 
+	// Decoding of quantized vertices
+	glUniform3fv(glGetUniformLocation(ctx.program, "u_position_offset"), 1, &meshVAO.positionOffset[0]);
+	glUniform3fv(glGetUniformLocation(ctx.program, "u_position_scale"), 1, &meshVAO.positionScale[0]);
+	glUniform1i(glGetUniformLocation(ctx.program, "u_quantized"), (meshVAO.flags & MESH_VAO_QUANTIZED) != 0);
+
+	// Instances with their own model matrices (in a per-instance attribute)
+	bool instanced = !meshVAO.instances.empty();
+	glUniform1i(glGetUniformLocation(ctx.program, "u_instanced"), instanced && ctx.instancing);
+	const glm::mat4 *instances = meshVAO.instances.data();
+	std::vector<glm::mat4> visibleInstances;
+	if (instanced) {
+		numInstances = int(meshVAO.instances.size());
+		ctx.numFrustumCulled = 0;
+		ctx.numOcclusionCulled = 0;
+		if (ctx.sceneCulling) {
+			cullInstances(ctx, meshVAO, mvp, mv, &visibleInstances);
+			instances = visibleInstances.data();
+			numInstances = int(visibleInstances.size());
+			glBindBuffer(GL_ARRAY_BUFFER, meshVAO.instanceVBO);
+			glBufferSubData(GL_ARRAY_BUFFER, 0, numInstances * sizeof(glm::mat4), instances);
+		}
+		ctx.numInstancesDrawn = numInstances;
+	}
+
+    // Selects the level of detail from the projected radius (in pixels)
+    // of the bounding sphere of the mesh. All instances are drawn at the
+    // level of detail of the largest one on screen.
+    std::size_t firstIndex = 0;
+    std::size_t numIndices = meshVAO.numIndices;
+    if (!meshVAO.lods.errors.empty()) {
+        float projectedRadius = 0.0f;
+        for (int i = 0; i < numInstances; ++i) {
+            glm::mat4 instanceMV = instanced ? mv * instances[i] : mv;
+            glm::vec4 axis = instanced ? instances[i][0] : glm::vec4(1.0f, 0.0f, 0.0f, 0.0f);
+            float radius = glm::length(glm::vec3(axis.x, axis.y, axis.z)) * meshVAO.lods.radius;
+            glm::vec4 center = instanceMV * glm::vec4(meshVAO.lods.center, 1.0f);
+            float distance = std::max(glm::length(glm::vec3(center.x, center.y, center.z)), radius);
+            projectedRadius = std::max(projectedRadius, 0.5f * ctx.height * radius /
+                                       (distance * std::tan(0.5f * glm::radians(45.0f))));
+        }
+        ctx.meshLOD = selectMeshLOD(meshVAO.lods, projectedRadius, ctx.meshLOD);
+        firstIndex = meshVAO.lods.offsets[ctx.meshLOD];
+        numIndices = meshVAO.lods.offsets[ctx.meshLOD + 1] - firstIndex;
+    }
+    std::size_t indexSize = (meshVAO.indexType == GL_UNSIGNED_SHORT) ? 2 : 4;
+    ctx.numTrianglesDrawn = int(numIndices / 3) * numInstances;
+    ctx.numTrianglesCulled = 0;
+    ctx.numDrawCalls = 1;
+
     glBindVertexArray(meshVAO.vao);
-    glDrawElements(GL_TRIANGLES, meshVAO.numIndices, GL_UNSIGNED_INT, 0);
+    if (instanced && !ctx.instancing) {
+        // One draw call per instance, with the model matrix of the
+        // instance in the uniforms (for comparison with instancing)
+        GLint mvLocation = glGetUniformLocation(ctx.program, "u_mv");
+        GLint mvpLocation = glGetUniformLocation(ctx.program, "u_mvp");
+        for (int i = 0; i < numInstances; ++i) {
+            glm::mat4 instanceMV = mv * instances[i];
+            glm::mat4 instanceMVP = mvp * instances[i];
+            glUniformMatrix4fv(mvLocation, 1, GL_FALSE, &instanceMV[0][0]);
+            glUniformMatrix4fv(mvpLocation, 1, GL_FALSE, &instanceMVP[0][0]);
+            glDrawElements(GL_TRIANGLES, numIndices, meshVAO.indexType,
+                           reinterpret_cast<const GLvoid *>(firstIndex * indexSize));
+        }
+        ctx.numDrawCalls = numInstances;
+    }
+    else if (!meshVAO.meshlets.empty() && ctx.meshletCulling && numInstances == 1 && !instanced) {
+        // Culls the meshlets of the level of detail by the view frustum
+        // and their normal cones, and draws the remaining index ranges
+        int lod = meshVAO.lods.errors.empty() ? 0 : ctx.meshLOD;
+        glm::vec4 planes[6];
+        frustumPlanes(mvp, planes);
+        glm::vec4 eye = glm::inverse(mv) * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+        std::vector<std::uint32_t> firstIndices, indexCounts;
+        std::size_t numVisible = cullMeshlets(meshVAO.meshlets, meshVAO.lodFirstMeshlet[lod],
+                                              meshVAO.lodFirstMeshlet[lod + 1], planes,
+                                              glm::vec3(eye.x, eye.y, eye.z), &firstIndices, &indexCounts);
+        ctx.numTrianglesCulled = ctx.numTrianglesDrawn - int(numVisible);
+        ctx.numTrianglesDrawn = int(numVisible);
+        std::vector<GLsizei> counts(indexCounts.begin(), indexCounts.end());
+        std::vector<const GLvoid *> offsets;
+        for (std::uint32_t first : firstIndices) {
+            offsets.push_back(reinterpret_cast<const GLvoid *>(first * indexSize));
+        }
+        glMultiDrawElements(GL_TRIANGLES, counts.data(), meshVAO.indexType, offsets.data(),
+                            GLsizei(counts.size()));
+    }
+    else {
+        glDrawElementsInstanced(GL_TRIANGLES, numIndices, meshVAO.indexType,
+                                reinterpret_cast<const GLvoid *>(firstIndex * indexSize), numInstances);
+    }
     glBindVertexArray(ctx.defaultVAO);
 
     glUseProgram(0);
 }
 
+// Compares the vertex throughput of the vertex layouts (see
+// MeshVAOFlags) on a mesh. The mesh is drawn as a grid of small
+// instances that do not overlap (and are not culled), so that the frame
+// time is dominated by vertex fetching and shading rather than by
+// overdraw. Results are displayed in the console.
+void benchmarkMeshLayouts(Context &ctx, const std::string &filename)
+{
+    const int GRID_SIZE = 8;
+    const int NUM_INSTANCES = GRID_SIZE * GRID_SIZE;
+    const int NUM_FRAMES = 20;
+    const int layouts[] = { 0, MESH_VAO_INTERLEAVED, MESH_VAO_QUANTIZED,
+                            MESH_VAO_QUANTIZED | MESH_VAO_INTERLEAVED };
+    const char *names[] = { "separate", "interleaved", "quantized", "quantized interleaved" };
+
+    Mesh mesh;
+    loadMesh(filename, &mesh);
+    std::cout << "Vertex layout benchmark on " << glGetString(GL_RENDERER) << ", "
+              << NUM_INSTANCES << " instances" << std::endl;
+    bool instancing = ctx.instancing, sceneCulling = ctx.sceneCulling;
+    ctx.instancing = true;
+    ctx.sceneCulling = false;
+    glEnable(GL_DEPTH_TEST);
+    for (int i = 0; i < 4; ++i) {
+        MeshVAO meshVAO;
+        createMeshVAO(ctx, mesh, &meshVAO, layouts[i]);
+        setMeshInstances(ctx, &meshVAO, gridInstances(meshVAO, GRID_SIZE));
+
+        // The first frame also uploads the buffers, so it is not timed
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        drawMesh(ctx, ctx.program, meshVAO);
+        glFinish();
+        double start = glfwGetTime();
+        for (int frame = 0; frame < NUM_FRAMES; ++frame) {
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            drawMesh(ctx, ctx.program, meshVAO);
+        }
+        glFinish();
+        double seconds = (glfwGetTime() - start) / NUM_FRAMES;
+
+        // Display results
+        double numTriangles = double(meshVAO.numIndices / 3) * NUM_INSTANCES;
+        std::cout << "  " << names[i] << ": " << seconds * 1000.0 << " ms per frame, "
+                  << numTriangles / seconds * 1e-6 << " M triangles/s" << std::endl;
+        deleteMeshVAO(&meshVAO);
+    }
+    ctx.instancing = instancing;
+    ctx.sceneCulling = sceneCulling;
+    meshCacheClose(&mesh.cache);
+}
+
+// Compares one instanced draw call with one draw call per instance, on
+// grids of teapots of increasing size. Results are displayed in the
+// console.
+void benchmarkInstancing(Context &ctx)
+{
+    const int NUM_FRAMES = 20;
+    const int gridSizes[] = { 1, 10, 30, 100 };
+
+    int gridSize = ctx.gridSize;
+    bool instancing = ctx.instancing;
+    std::cout << "Instancing benchmark on " << glGetString(GL_RENDERER) << std::endl;
+    glEnable(GL_DEPTH_TEST);
+    for (int size : gridSizes) {
+        setGridSize(ctx, size);
+        for (int mode = 0; mode < 2; ++mode) {
+            ctx.instancing = (mode == 1);
+
+            // The first frame is not timed
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            drawMesh(ctx, ctx.program, ctx.gridVAO);
+            glFinish();
+            double start = glfwGetTime();
+            for (int frame = 0; frame < NUM_FRAMES; ++frame) {
+                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+                drawMesh(ctx, ctx.program, ctx.gridVAO);
+            }
+            glFinish();
+            double seconds = (glfwGetTime() - start) / NUM_FRAMES;
+
+            // Display results
+            std::cout << "  " << size * size << " instances (LOD " << ctx.meshLOD << "), "
+                      << ctx.numDrawCalls << " draws: " << seconds * 1000.0 << " ms per frame"
+                      << std::endl;
+        }
+    }
+    setGridSize(ctx, gridSize);
+    ctx.instancing = instancing;
+}
+
 void display(Context &ctx)
 {
     glClearColor(0.0, 0.0, 0.0, 1.0);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
+    // Swaps in a model loaded in the background, once it is uploaded
+    updateMeshLoading(ctx);
+
     glEnable(GL_DEPTH_TEST); // ensures that polygons overlap correctly
-    drawMesh(ctx, ctx.program, ctx.meshVAO);
+    int numTrianglesDrawn = ctx.numTrianglesDrawn;
+    if (ctx.gridSize > 0 || ctx.meshVAO != nullptr) {
+        drawMesh(ctx, ctx.program, (ctx.gridSize > 0) ? ctx.gridVAO : *ctx.meshVAO);
+    }
+
+    double now = glfwGetTime();
+    ctx.frameTime = now - ctx.lastFrame;
+    ctx.lastFrame = now;
+
+    // Displays the triangles drawn (which change with the level of
+    // detail and the culling) in the window title, and for the grid
+    // also the draw calls, instances, and frame time, and the progress
+    // of a model that is loading (refreshed twice a second)
+    if (ctx.numTrianglesDrawn != numTrianglesDrawn || now - ctx.lastTitle > 0.5) {
+        int numTriangles = ctx.numTrianglesDrawn + ctx.numTrianglesCulled;
+        std::string title = "Model viewer (LOD " + std::to_string(ctx.meshLOD) + ", " +
+                            std::to_string(ctx.numTrianglesDrawn) + " triangles, " +
+                            std::to_string(100 * ctx.numTrianglesCulled / std::max(numTriangles, 1)) +
+                            "% culled";
+        if (ctx.gridSize > 0) {
+            title += ", " + std::to_string(ctx.numDrawCalls) + " draws, " +
+                     std::to_string(ctx.numInstancesDrawn) + " of " +
+                     std::to_string(ctx.gridSize * ctx.gridSize) + " instances (" +
+                     std::to_string(ctx.numFrustumCulled) + " outside, " +
+                     std::to_string(ctx.numOcclusionCulled) + " occluded), " +
+                     std::to_string(int(ctx.frameTime * 1000.0)) + " ms";
+        }
+        std::string status = meshLoaderStatus(&ctx.meshLoader);
+        if (!status.empty()) {
+            title += ", " + status;
+        }
+        title += ")";
+        glfwSetWindowTitle(ctx.window, title.c_str());
+        ctx.lastTitle = now;
+    }
 }
 
 void reloadShaders(Context *ctx)
@@ -212,12 +1203,48 @@ void reloadShaders(Context *ctx)
                                      shaderDir() + "mesh.frag");
 }
 
+// Casts a ray from the cursor position (in window coordinates) through
+// the mesh as drawn in the last frame, using the BVH of the mesh.
+// Returns the closest hit, with its position in world coordinates.
+bool pickMesh(const Context &ctx, const MeshVAO &meshVAO, double x, double y, RayHit *hit)
+{
+    // Unprojects the cursor on the near and far planes into model space
+    glm::vec2 ndc(2.0 * x / ctx.width - 1.0, 1.0 - 2.0 * y / ctx.height);
+    glm::mat4 inverseMVP = glm::inverse(ctx.mvp);
+    glm::vec4 nearPoint = inverseMVP * glm::vec4(ndc.x, ndc.y, -1.0f, 1.0f);
+    glm::vec4 farPoint = inverseMVP * glm::vec4(ndc.x, ndc.y, 1.0f, 1.0f);
+    glm::vec3 origin = glm::vec3(nearPoint.x, nearPoint.y, nearPoint.z) / nearPoint.w;
+    glm::vec3 direction = glm::vec3(farPoint.x, farPoint.y, farPoint.z) / farPoint.w - origin;
+
+    if (!intersectMeshBVH(meshVAO.bvh, origin, direction, hit)) {
+        return false;
+    }
+    glm::vec4 position = ctx.model * glm::vec4(hit->position, 1.0f);
+    hit->position = glm::vec3(position.x, position.y, position.z);
+    return true;
+}
+
 void mouseButtonPressed(Context *ctx, int button, int x, int y)
 {
     if (button == GLFW_MOUSE_BUTTON_LEFT) {
         ctx->trackball.center = glm::vec2(x, y);
         trackballStartTracking(ctx->trackball, glm::vec2(x, y));
     }
+    if (button == GLFW_MOUSE_BUTTON_RIGHT && ctx->gridSize == 0 && ctx->meshVAO != nullptr) {
+        double start = glfwGetTime();
+        RayHit hit;
+        bool picked = pickMesh(*ctx, *ctx->meshVAO, x, y, &hit);
+        double microseconds = (glfwGetTime() - start) * 1e6;
+        if (picked) {
+            std::cout << "Picked triangle " << hit.triangle << " at (" << hit.position.x << ", "
+                      << hit.position.y << ", " << hit.position.z << "), barycentrics ("
+                      << hit.barycentrics.x << ", " << hit.barycentrics.y << ", "
+                      << hit.barycentrics.z << ") in " << microseconds << " us" << std::endl;
+        }
+        else {
+            std::cout << "Picked nothing in " << microseconds << " us" << std::endl;
+        }
+    }
 }
 
 void mouseButtonReleased(Context *ctx, int button, int x, int y)
@@ -245,6 +1272,38 @@ void keyCallback(GLFWwindow* window, int key, int /*scancode*/, int action, int
     if (key == GLFW_KEY_R && action == GLFW_PRESS) {
         reloadShaders(ctx);
     }
+    if (key == GLFW_KEY_C && action == GLFW_PRESS) {
+        ctx->meshletCulling = !ctx->meshletCulling;
+    }
+    if (key == GLFW_KEY_B && action == GLFW_PRESS) {
+        benchmarkMeshLayouts(*ctx, modelDir() + "armadillo.obj");
+    }
+    if (key == GLFW_KEY_G && action == GLFW_PRESS) {
+        // Cycles through the single mesh and grids of 10^2, 30^2, and
+        // 100^2 teapots
+        int next = (ctx->gridSize == 0) ? 10 : (ctx->gridSize == 10) ? 30 : (ctx->gridSize == 30) ? 100 : 0;
+        setGridSize(*ctx, next);
+    }
+    if (key == GLFW_KEY_I && action == GLFW_PRESS) {
+        ctx->instancing = !ctx->instancing;
+    }
+    if (key == GLFW_KEY_T && action == GLFW_PRESS) {
+        benchmarkInstancing(*ctx);
+    }
+    if (key == GLFW_KEY_N && action == GLFW_PRESS && !ctx->models.empty()) {
+        selectModel(*ctx, (ctx->currentModel + 1) % int(ctx->models.size()));
+    }
+    if (key >= GLFW_KEY_1 && key <= GLFW_KEY_9 && action == GLFW_PRESS) {
+        selectModel(*ctx, key - GLFW_KEY_1);
+    }
+    if (key == GLFW_KEY_O && action == GLFW_PRESS) {
+        // Culling overwrites the instance VBO with the visible instances,
+        // so all instances are uploaded again when it is turned off
+        ctx->sceneCulling = !ctx->sceneCulling;
+        if (!ctx->sceneCulling && ctx->gridSize > 0) {
+            setMeshInstances(*ctx, &ctx->gridVAO, ctx->gridVAO.instances);
+        }
+    }
 }
 
 void mouseButtonCallback(GLFWwindow* window, int button, int action, int mods)
@@ -320,6 +1379,7 @@ int main(void)
     }
 
     // Shutdown
+    meshLoaderStop(&ctx.meshLoader);
     glfwDestroyWindow(ctx.window);
     glfwTerminate();
     std::exit(EXIT_SUCCESS);
@@ -4,6 +4,7 @@
 
 layout(location = 0) in vec4 a_position;
 layout(location = 1) in vec3 a_normal;
+layout(location = 2) in mat4 a_instance_model;
 
 out vec3 v_color;
 uniform mat4 u_mvp; // transform variable
@@ -12,16 +13,42 @@ uniform mat4 u_mvp; // transform variable
 uniform mat4 u_mv; // ModelView matrix
 uniform vec3 u_light_position; // The position of your light source
 
+// Decoding of quantized vertices
+uniform vec3 u_position_offset; // Quantized positions are relative to the bounding box
+uniform vec3 u_position_scale;
+uniform int u_quantized;
+
+// Instances have their own model matrix (applied before u_mv)
+uniform int u_instanced;
+
+// Decodes a normal stored as octahedral coordinates
+vec3 octDecode(vec2 e)
+{
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    if (n.z < 0.0) {
+        n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    }
+    return normalize(n);
+}
+
 void main()
 {
-    v_color = 0.5 * a_normal + 0.5; //vec3(0.0, 1.0, 0.0);
-    gl_Position = u_mvp * a_position;
+    vec4 position = vec4(u_position_offset + u_position_scale * a_position.xyz, 1.0);
+    vec3 normal = (u_quantized != 0) ? octDecode(a_normal.xy) : a_normal;
+    if (u_instanced != 0) {
+        // Instances are only translated and uniformly scaled
+        position = a_instance_model * position;
+        normal = mat3(a_instance_model) * normal;
+    }
+
+    v_color = 0.5 * normal + 0.5; //vec3(0.0, 1.0, 0.0);
+    gl_Position = u_mvp * position;
 
 	// Lambertian reflectance model:
 	// Transform the vertex position to view space (eye coordinates)
-	vec3 position_eye = vec3(u_mv * a_position);
+	vec3 position_eye = vec3(u_mv * position);
 	// Calculate the view-space normal
-	vec3 N = normalize(mat3(u_mv) * a_normal);
+	vec3 N = normalize(mat3(u_mv) * normal);
 	// Calculate the view-space light direction
 	vec3 L = normalize(u_light_position - position_eye);
 	// Calculate the diffuse (Lambertian) reflection term
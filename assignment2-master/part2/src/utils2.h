@@ -13,6 +13,27 @@
 #include <cmath>
 #include <cstdint>
 #include <algorithm>
+#include <cstring>
+#include <charconv>
+#include <thread>
+#include <filesystem>
+#include <system_error>
+#include <cstdio>
+#include <atomic>
+#include <functional>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#else
+#include <process.h>
+#endif
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 // Struct for representing a virtual 3D trackball that can be used for
 // object or camera rotation
@@ -41,6 +62,37 @@ struct OBJMesh {
     std::vector<std::uint32_t> indices;
 };
 
+// Destination of objMeshLoadInto, e.g., mapped GL buffer ranges. Once
+// the sizes are known, the loader calls allocate(numVertices,
+// numIndices), which must point vertices, normals, and indices to
+// arrays of that size (or return false). The vertex and index arrays
+// are read back when the normals are computed. numIndices is set to the
+// number of indices written, which is lower for malformed face lines.
+struct OBJMeshTarget {
+    std::function<bool(std::size_t numVertices, std::size_t numIndices)> allocate;
+    glm::vec3 *vertices = nullptr;
+    glm::vec3 *normals = nullptr;
+    std::uint32_t *indices = nullptr;
+    std::size_t numVertices = 0;
+    std::size_t numIndices = 0;
+};
+
+// Weighting of the face normals in the per-vertex normals computed by
+// computeNormals
+enum NormalWeighting {
+    NORMAL_WEIGHTING_AREA,  // by face area (the default)
+    NORMAL_WEIGHTING_ANGLE  // by the angle of the face at the vertex
+};
+
+// Read-only view of the contents of a file. The file is memory-mapped
+// where possible, and otherwise read into a buffer.
+struct FileView {
+    const char *data = nullptr;
+    std::size_t size = 0;
+    void *mapping = nullptr;
+    std::vector<char> buffer;
+};
+
 // Helper functions
 namespace {
 glm::vec3 mapMousePointToUnitSphere(glm::vec2 point, double radius, glm::vec2 center)
@@ -57,31 +109,451 @@ glm::vec3 mapMousePointToUnitSphere(glm::vec2 point, double radius, glm::vec2 ce
     return glm::normalize(glm::vec3(x, y, z));
 }
 
+// Splits [0, n) into one range per hardware thread, of at least
+// minRange items each, and calls func(begin, end) for every range (the
+// first range on the calling thread)
+template <typename Func>
+void meshParallelFor(std::size_t n, std::size_t minRange, Func func)
+{
+    std::size_t numThreads = std::max(1u, std::thread::hardware_concurrency());
+    std::size_t numRanges = std::max<std::size_t>(1, std::min(numThreads, n / std::max<std::size_t>(minRange, 1)));
+    std::vector<std::thread> threads;
+    for (std::size_t i = 1; i < numRanges; ++i) {
+        threads.emplace_back(func, n * i / numRanges, n * (i + 1) / numRanges);
+    }
+    func(std::size_t(0), n / numRanges);
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+}
+
+// Normalizes an array of vectors, four at a time with SSE. Gives the
+// same results as glm::normalize.
+void normalizeVectors(glm::vec3 *v, std::size_t n)
+{
+    std::size_t i = 0;
+#ifdef __SSE2__
+    static_assert(sizeof(glm::vec3) == 3 * sizeof(float), "glm::vec3 must be tightly packed");
+    const __m128 one = _mm_set1_ps(1.0f);
+    for (; i + 4 <= n; i += 4) {
+        // Transpose (x0 y0 z0 x1) (y1 z1 x2 y2) (z2 x3 y3 z3) to x, y, z
+        float *p = &v[i].x;
+        __m128 a = _mm_loadu_ps(p);
+        __m128 b = _mm_loadu_ps(p + 4);
+        __m128 c = _mm_loadu_ps(p + 8);
+        __m128 x = _mm_shuffle_ps(a, _mm_shuffle_ps(b, c, _MM_SHUFFLE(1, 1, 2, 2)), _MM_SHUFFLE(2, 0, 3, 0));
+        __m128 y = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(0, 0, 1, 1)),
+                                  _mm_shuffle_ps(b, c, _MM_SHUFFLE(2, 2, 3, 3)), _MM_SHUFFLE(2, 0, 2, 0));
+        __m128 z = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(1, 1, 2, 2)),
+                                  _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 3, 0, 0)), _MM_SHUFFLE(2, 0, 2, 0));
+
+        // Same operations (and rounding) as glm::normalize
+        __m128 squaredLength = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z));
+        __m128 scale = _mm_div_ps(one, _mm_sqrt_ps(squaredLength));
+        x = _mm_mul_ps(x, scale);
+        y = _mm_mul_ps(y, scale);
+        z = _mm_mul_ps(z, scale);
+
+        // Transpose back
+        a = _mm_shuffle_ps(_mm_shuffle_ps(x, y, _MM_SHUFFLE(0, 0, 0, 0)),
+                           _mm_shuffle_ps(z, x, _MM_SHUFFLE(1, 1, 0, 0)), _MM_SHUFFLE(2, 0, 2, 0));
+        b = _mm_shuffle_ps(_mm_shuffle_ps(y, z, _MM_SHUFFLE(1, 1, 1, 1)),
+                           _mm_shuffle_ps(x, y, _MM_SHUFFLE(2, 2, 2, 2)), _MM_SHUFFLE(2, 0, 2, 0));
+        c = _mm_shuffle_ps(_mm_shuffle_ps(z, x, _MM_SHUFFLE(3, 3, 2, 2)),
+                           _mm_shuffle_ps(y, z, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(2, 0, 2, 0));
+        _mm_storeu_ps(p, a);
+        _mm_storeu_ps(p + 4, b);
+        _mm_storeu_ps(p + 8, c);
+    }
+#endif
+    for (; i < n; ++i) {
+        v[i] = glm::normalize(v[i]);
+    }
+}
+
+// Returns the normal that a triangle corner (an index into indices)
+// contributes to its vertex
+inline glm::vec3 cornerNormal(const glm::vec3 *vertices, const std::uint32_t *indices,
+                              const glm::vec3 &faceNormal, std::size_t corner,
+                              NormalWeighting weighting)
+{
+    if (weighting == NORMAL_WEIGHTING_AREA) {
+        return faceNormal;
+    }
+    std::size_t first = corner - corner % 3;
+    glm::vec3 v = vertices[indices[corner]];
+    glm::vec3 e1 = vertices[indices[first + (corner + 1) % 3]] - v;
+    glm::vec3 e2 = vertices[indices[first + (corner + 2) % 3]] - v;
+    float length1 = glm::length(e1);
+    float length2 = glm::length(e2);
+    float faceLength = glm::length(faceNormal);
+    if (!(length1 * length2 * faceLength > 0.0f)) {
+        return glm::vec3(0.0f);  // degenerate triangle
+    }
+    float cosAngle = glm::dot(e1, e2) / (length1 * length2);
+    float angle = std::acos(std::min(std::max(cosAngle, -1.0f), 1.0f));
+    return faceNormal * (angle / faceLength);
+}
+
+// Computes per-vertex normals as weighted averages of the normals of
+// the adjacent faces. With NORMAL_WEIGHTING_AREA (the unnormalized face
+// normals are summed), the result is bit-identical to summing the face
+// normals into the vertices in face order.
+//
+// The sum is computed in parallel as a gather over a vertex-to-corner
+// adjacency in compressed sparse row (CSR) form, in which the corners
+// of each vertex are sorted, so that they are added in face order. On a
+// single thread, the face normals are scattered instead.
+void computeNormals(const glm::vec3 *vertices, std::size_t numVertices,
+                    const std::uint32_t *indices, std::size_t numIndices,
+                    glm::vec3 *normals, NormalWeighting weighting = NORMAL_WEIGHTING_AREA)
+{
+    const std::size_t MIN_RANGE = 16384;
+    std::size_t numCorners = numIndices - numIndices % 3;
+
+    // Unnormalized face normals (with length twice the face area)
+    std::vector<glm::vec3> faceNormals(numCorners / 3);
+    meshParallelFor(faceNormals.size(), MIN_RANGE, [&](std::size_t begin, std::size_t end) {
+        for (std::size_t i = begin; i < end; ++i) {
+            const glm::vec3 &v0 = vertices[indices[3 * i]];
+            faceNormals[i] = glm::cross(vertices[indices[3 * i + 1]] - v0,
+                                        vertices[indices[3 * i + 2]] - v0);
+        }
+    });
+
+    if (std::thread::hardware_concurrency() <= 1 || numCorners < 2 * MIN_RANGE) {
+        std::fill(normals, normals + numVertices, glm::vec3(0.0f, 0.0f, 0.0f));
+        for (std::size_t c = 0; c < numCorners; ++c) {
+            normals[indices[c]] += cornerNormal(vertices, indices, faceNormals[c / 3], c, weighting);
+        }
+        normalizeVectors(normals, numVertices);
+        return;
+    }
+
+    // Count the corners of each vertex, and turn the counts into CSR
+    // offsets. The counts are then reused as insertion cursors.
+    std::vector<std::atomic<std::uint32_t>> cursors(numVertices);
+    meshParallelFor(numCorners, MIN_RANGE, [&](std::size_t begin, std::size_t end) {
+        for (std::size_t c = begin; c < end; ++c) {
+            cursors[indices[c]].fetch_add(1, std::memory_order_relaxed);
+        }
+    });
+    std::vector<std::uint32_t> offsets(numVertices + 1);
+    offsets[0] = 0;
+    for (std::size_t v = 0; v < numVertices; ++v) {
+        offsets[v + 1] = offsets[v] + cursors[v].load(std::memory_order_relaxed);
+        cursors[v].store(offsets[v], std::memory_order_relaxed);
+    }
+    std::vector<std::uint32_t> adjacency(numCorners);
+    meshParallelFor(numCorners, MIN_RANGE, [&](std::size_t begin, std::size_t end) {
+        for (std::size_t c = begin; c < end; ++c) {
+            adjacency[cursors[indices[c]].fetch_add(1, std::memory_order_relaxed)] = std::uint32_t(c);
+        }
+    });
+
+    // Gather and normalize the vertex normals
+    meshParallelFor(numVertices, MIN_RANGE, [&](std::size_t begin, std::size_t end) {
+        for (std::size_t v = begin; v < end; ++v) {
+            std::uint32_t *first = adjacency.data() + offsets[v];
+            std::uint32_t *last = adjacency.data() + offsets[v + 1];
+            std::sort(first, last);
+            glm::vec3 normal(0.0f, 0.0f, 0.0f);
+            for (std::uint32_t *c = first; c != last; ++c) {
+                normal += cornerNormal(vertices, indices, faceNormals[*c / 3], *c, weighting);
+            }
+            normals[v] = normal;
+        }
+        normalizeVectors(normals + begin, end - begin);
+    });
+}
+
 void computeNormals(const std::vector<glm::vec3> &vertices,
                     const std::vector<std::uint32_t> &indices,
-                    std::vector<glm::vec3> *normals)
+                    std::vector<glm::vec3> *normals,
+                    NormalWeighting weighting = NORMAL_WEIGHTING_AREA)
 {
-    normals->resize(vertices.size(), glm::vec3(0.0f, 0.0f, 0.0f));
+    normals->resize(vertices.size());
+    computeNormals(vertices.data(), vertices.size(), indices.data(), indices.size(),
+                   normals->data(), weighting);
+}
 
-    // Compute per-vertex normals by averaging the unnormalized face normals
-    std::uint32_t vertexIndex0, vertexIndex1, vertexIndex2;
-    glm::vec3 normal;
-    int numIndices = indices.size();
-    for (int i = 0; i < numIndices; i += 3) {
-        vertexIndex0 = indices[i];
-        vertexIndex1 = indices[i + 1];
-        vertexIndex2 = indices[i + 2];
-        normal = glm::cross(vertices[vertexIndex1] - vertices[vertexIndex0],
-                            vertices[vertexIndex2] - vertices[vertexIndex0]);
-        (*normals)[vertexIndex0] += normal;
-        (*normals)[vertexIndex1] += normal;
-        (*normals)[vertexIndex2] += normal;
+bool fileViewOpen(FileView *view, const std::string &filename)
+{
+#ifndef _WIN32
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        void *mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping != MAP_FAILED) {
+            close(fd);
+            view->mapping = mapping;
+            view->data = static_cast<const char *>(mapping);
+            view->size = st.st_size;
+            return true;
+        }
+    }
+    close(fd);
+#endif
+    std::ifstream f(filename.c_str(), std::ios::binary);
+    if (!f.is_open()) {
+        return false;
     }
+    f.seekg(0, std::ios::end);
+    view->buffer.resize(std::size_t(f.tellg()));
+    f.seekg(0);
+    f.read(view->buffer.data(), view->buffer.size());
+    view->data = view->buffer.data();
+    view->size = view->buffer.size();
+    return true;
+}
+
+void fileViewClose(FileView *view)
+{
+#ifndef _WIN32
+    if (view->mapping != nullptr) {
+        munmap(view->mapping, view->size);
+    }
+#endif
+    *view = FileView();
+}
 
-    int numNormals = normals->size();
-    for (int i = 0; i < numNormals; i++) {
-        (*normals)[i] = glm::normalize((*normals)[i]);
+// Pointer-based tokenizer helpers for parsing OBJ files. Each returns a
+// pointer past the parsed token (or the input pointer on failure), and
+// never reads past end.
+inline const char *objSkipSpaces(const char *p, const char *end)
+{
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) {
+        ++p;
     }
+    return p;
+}
+
+inline const char *objSkipToken(const char *p, const char *end)
+{
+    while (p < end && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n') {
+        ++p;
+    }
+    return p;
+}
+
+inline const char *objParseFloat(const char *p, const char *end, float *value)
+{
+    static const float POWERS_OF_10[] = { 1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f,
+                                          1e6f, 1e7f, 1e8f, 1e9f, 1e10f };
+    p = objSkipSpaces(p, end);
+    if (p < end && *p == '+') {
+        ++p;  // not accepted by from_chars
+    }
+
+    // Fast path for plain decimals with a short mantissa. The mantissa
+    // and the power of ten are then exact floats, so a single division
+    // gives the correctly rounded result, same as from_chars.
+    const char *q = p;
+    bool negative = (q < end && *q == '-');
+    q += negative ? 1 : 0;
+    std::uint32_t mantissa = 0;
+    int numDigits = 0;
+    int numDecimals = 0;
+    while (q < end && unsigned(*q - '0') < 10 && numDigits < 9) {
+        mantissa = 10 * mantissa + (*q++ - '0');
+        numDigits++;
+    }
+    if (q < end && *q == '.') {
+        ++q;
+        while (q < end && unsigned(*q - '0') < 10 && numDigits < 9) {
+            mantissa = 10 * mantissa + (*q++ - '0');
+            numDigits++;
+            numDecimals++;
+        }
+    }
+    bool done = (q == end || (unsigned(*q - '0') >= 10 && *q != 'e' && *q != 'E' && *q != '.'));
+    if (numDigits > 0 && done && mantissa < (1u << 24) && numDecimals <= 10) {
+        float result = float(mantissa) / POWERS_OF_10[numDecimals];
+        *value = negative ? -result : result;
+        return q;
+    }
+    return std::from_chars(p, end, *value).ptr;
+}
+
+inline const char *objParseInt(const char *p, const char *end, long *value)
+{
+    p = objSkipSpaces(p, end);
+    const char *q = p;
+    bool negative = (q < end && *q == '-');
+    q += negative ? 1 : 0;
+    long result = 0;
+    const char *digits = q;
+    while (q < end && unsigned(*q - '0') < 10) {
+        result = 10 * result + (*q - '0');
+        ++q;
+    }
+    if (q == digits) {
+        return p;
+    }
+    *value = negative ? -result : result;
+    return q;
+}
+
+// Returns true if the line at p starts with the given keyword followed
+// by whitespace
+inline bool objLineIs(const char *p, const char *lineEnd, const char *keyword, int length)
+{
+    return lineEnd - p > length && std::memcmp(p, keyword, length) == 0 &&
+           (p[length] == ' ' || p[length] == '\t');
+}
+// Parses a face vertex (v, v/vt, v//vn, or v/vt/vn) into its OBJ-indices,
+// with zero for missing indices. Returns a pointer past the face vertex,
+// or the input pointer if there is no face vertex at p.
+inline const char *objParseFaceVertex(const char *p, const char *end, long index[3])
+{
+    index[0] = index[1] = index[2] = 0;
+    const char *start = objSkipSpaces(p, end);
+    const char *q = objParseInt(start, end, &index[0]);
+    if (q == start) {
+        return p;
+    }
+    if (q < end && *q == '/') {
+        q = objParseInt(q + 1, end, &index[1]);
+        if (q < end && *q == '/') {
+            q = objParseInt(q + 1, end, &index[2]);
+        }
+    }
+    return objSkipToken(q, end);
+}
+
+// Returns the number of whitespace-separated tokens in [p, lineEnd)
+inline int objCountTokens(const char *p, const char *lineEnd)
+{
+    int n = 0;
+    for (p = objSkipSpaces(p, lineEnd); p < lineEnd; p = objSkipSpaces(p, lineEnd)) {
+        p = objSkipToken(p, lineEnd);
+        n++;
+    }
+    return n;
+}
+
+// Range of lines of an OBJ file that is parsed by one thread. The counts
+// are filled in by the first (counting) pass, and the offsets (into the
+// mesh arrays) are their prefix sums over the preceding chunks.
+struct OBJChunk {
+    const char *begin = nullptr;
+    const char *end = nullptr;
+    std::size_t numVertices = 0;
+    std::size_t numTexcoords = 0;
+    std::size_t numNormals = 0;
+    std::size_t numIndices = 0;  // three per triangle, after fan triangulation
+    std::size_t numWritten = 0;  // indices actually parsed in the second pass
+    std::size_t vertexOffset = 0;
+    std::size_t texcoordOffset = 0;
+    std::size_t normalOffset = 0;
+    std::size_t indexOffset = 0;
+};
+
+// Splits the file contents into one chunk per thread at line boundaries.
+// Small files are not split, since starting threads would cost more than
+// parsing them.
+std::vector<OBJChunk> objSplitChunks(const char *begin, const char *end)
+{
+    const std::size_t MIN_CHUNK_SIZE = 256 * 1024;
+    std::size_t numThreads = std::max(1u, std::thread::hardware_concurrency());
+    std::size_t numChunks = std::max<std::size_t>(1, std::min<std::size_t>(numThreads,
+                                                  (end - begin) / MIN_CHUNK_SIZE));
+    std::size_t chunkSize = (end - begin) / numChunks;
+
+    std::vector<OBJChunk> chunks;
+    const char *p = begin;
+    for (std::size_t i = 0; i < numChunks && p < end; ++i) {
+        const char *q = (i + 1 < numChunks) ? std::max(p, begin + (i + 1) * chunkSize) : end;
+        if (q < end) {
+            q = static_cast<const char *>(std::memchr(q, '\n', end - q));
+            q = (q != nullptr) ? q + 1 : end;
+        }
+        OBJChunk chunk;
+        chunk.begin = p;
+        chunk.end = q;
+        chunks.push_back(chunk);
+        p = q;
+    }
+    return chunks;
+}
+
+// Calls func(i) for every chunk i, each chunk on its own thread (the
+// first chunk runs on the calling thread)
+template <typename Func>
+void objForEachChunk(std::vector<OBJChunk> &chunks, Func func)
+{
+    std::vector<std::thread> threads;
+    for (std::size_t i = 1; i < chunks.size(); ++i) {
+        threads.emplace_back(func, i);
+    }
+    if (!chunks.empty()) {
+        func(std::size_t(0));
+    }
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+}
+
+// Counts the vertex, texcoord, normal, and face lines of a chunk. Faces
+// with n vertices give 3 * (n - 2) indices.
+void objCountChunk(OBJChunk *chunk)
+{
+    for (const char *p = chunk->begin; p < chunk->end; ) {
+        const char *lineEnd = static_cast<const char *>(std::memchr(p, '\n', chunk->end - p));
+        lineEnd = (lineEnd != nullptr) ? lineEnd : chunk->end;
+        if (objLineIs(p, lineEnd, "v", 1)) {
+            chunk->numVertices++;
+        }
+        else if (objLineIs(p, lineEnd, "vt", 2)) {
+            chunk->numTexcoords++;
+        }
+        else if (objLineIs(p, lineEnd, "vn", 2)) {
+            chunk->numNormals++;
+        }
+        else if (objLineIs(p, lineEnd, "f", 1)) {
+            int n = objCountTokens(p + 2, lineEnd);
+            chunk->numIndices += (n >= 3) ? 3 * (n - 2) : 0;
+        }
+        p = lineEnd + 1;
+    }
+}
+
+// Computes the chunk offsets as prefix sums of the counts, and returns
+// the total counts
+OBJChunk objChunkOffsets(std::vector<OBJChunk> &chunks)
+{
+    OBJChunk total;
+    for (OBJChunk &chunk : chunks) {
+        chunk.vertexOffset = total.numVertices;
+        chunk.texcoordOffset = total.numTexcoords;
+        chunk.normalOffset = total.numNormals;
+        chunk.indexOffset = total.numIndices;
+        total.numVertices += chunk.numVertices;
+        total.numTexcoords += chunk.numTexcoords;
+        total.numNormals += chunk.numNormals;
+        total.numIndices += chunk.numIndices;
+    }
+    return total;
+}
+
+// Moves the parsed indices of all chunks together, in case a chunk
+// contained malformed face lines that gave fewer indices than counted.
+// Returns the total number of parsed indices.
+template <typename T>
+std::size_t objCompactChunks(const std::vector<OBJChunk> &chunks, T *indices)
+{
+    std::size_t size = 0;
+    for (const OBJChunk &chunk : chunks) {
+        if (size != chunk.indexOffset) {
+            std::copy(indices + chunk.indexOffset, indices + chunk.indexOffset + chunk.numWritten,
+                      indices + size);
+        }
+        size += chunk.numWritten;
+    }
+    return size;
 }
 } // namespace
 
@@ -125,56 +597,1768 @@ glm::mat4 trackballGetRotationMatrix(Trackball &trackball)
     return glm::mat4_cast(trackball.qCurrent);
 }
 
-// Read an OBJMesh from an .obj file
-bool objMeshLoad(OBJMesh &mesh, const std::string &filename)
+// Read a mesh from an .obj file into the arrays of an OBJMeshTarget.
+// The file is memory-mapped and parsed in place, in parallel chunks of
+// lines. Faces with more than three vertices are triangulated as fans,
+// and only the position index of each face vertex (v, v/vt, v//vn, or
+// v/vt/vn) is used.
+bool objMeshLoadInto(OBJMeshTarget &target, const std::string &filename)
 {
-    const std::string VERTEX_LINE("v ");
-    const std::string FACE_LINE("f ");
-
     // Open OBJ file
-    std::ifstream f(filename.c_str());
-    if (!f.is_open()) {
+    FileView file;
+    if (!fileViewOpen(&file, filename)) {
         std::cerr << "Could not open " << filename << std::endl;
         return false;
     }
 
-    // Extract vertices and indices
-    std::string line;
-    glm::vec3 vertex;
-    std::uint32_t vertexIndex0, vertexIndex1, vertexIndex2;
-    while (!f.eof()) {
-        std::getline(f, line);
-        if (line.substr(0, 2) == VERTEX_LINE) {
-            std::istringstream vertexLine(line.substr(2));
-            vertexLine >> vertex.x;
-            vertexLine >> vertex.y;
-            vertexLine >> vertex.z;
-            mesh.vertices.push_back(vertex);
-        }
-        else if (line.substr(0, 2) == FACE_LINE) {
-            std::istringstream faceLine(line.substr(2));
-            faceLine >> vertexIndex0;
-            faceLine >> vertexIndex1;
-            faceLine >> vertexIndex2;
-            mesh.indices.push_back(vertexIndex0 - 1);
-            mesh.indices.push_back(vertexIndex1 - 1);
-            mesh.indices.push_back(vertexIndex2 - 1);
-        }
-        else {
-            // Ignore line
-        }
+    // First pass: count vertices and indices per chunk, so that the mesh
+    // data can be allocated with the exact size and every chunk can
+    // write its part of it independently
+    std::vector<OBJChunk> chunks = objSplitChunks(file.data, file.data + file.size);
+    objForEachChunk(chunks, [&](std::size_t i) { objCountChunk(&chunks[i]); });
+    OBJChunk total = objChunkOffsets(chunks);
+    if (!target.allocate(total.numVertices, total.numIndices)) {
+        std::cerr << "Could not allocate mesh data for " << filename << std::endl;
+        fileViewClose(&file);
+        return false;
     }
+    target.numVertices = total.numVertices;
+
+    // Second pass: extract vertices and indices. Note: OBJ-indices
+    // start at one (negative indices are relative to the last vertex).
+    // Indices outside of the vertices are flagged, and fail the load.
+    std::atomic<bool> invalid(false);
+    objForEachChunk(chunks, [&](std::size_t i) {
+        OBJChunk &chunk = chunks[i];
+        glm::vec3 *vertex = target.vertices + chunk.vertexOffset;
+        std::uint32_t *index = target.indices + chunk.indexOffset;
+        long numVertices = long(chunk.vertexOffset);
+        for (const char *p = chunk.begin; p < chunk.end; ) {
+            const char *lineEnd = static_cast<const char *>(std::memchr(p, '\n', chunk.end - p));
+            lineEnd = (lineEnd != nullptr) ? lineEnd : chunk.end;
+            if (objLineIs(p, lineEnd, "v", 1)) {
+                glm::vec3 v(0.0f);
+                const char *q = objParseFloat(p + 2, lineEnd, &v.x);
+                q = objParseFloat(q, lineEnd, &v.y);
+                objParseFloat(q, lineEnd, &v.z);
+                *vertex++ = v;
+                numVertices++;
+            }
+            else if (objLineIs(p, lineEnd, "f", 1)) {
+                std::uint32_t first = 0, previous = 0;
+                int n = 0;
+                long faceIndex[3];
+                const char *q = p + 2;
+                while (true) {
+                    const char *next = objParseFaceVertex(q, lineEnd, faceIndex);
+                    if (next == q) {
+                        break;
+                    }
+                    q = next;
+                    long resolved = (faceIndex[0] < 0) ? numVertices + faceIndex[0] : faceIndex[0] - 1;
+                    if (resolved < 0 || resolved >= long(total.numVertices)) {
+                        invalid = true;
+                        resolved = 0;
+                    }
+                    std::uint32_t vertexIndex = std::uint32_t(resolved);
+                    if (n == 0) {
+                        first = vertexIndex;
+                    }
+                    else if (n >= 2) {
+                        *index++ = first;
+                        *index++ = previous;
+                        *index++ = vertexIndex;
+                    }
+                    previous = vertexIndex;
+                    n++;
+                }
+            }
+            else {
+                // Ignore line
+            }
+            p = lineEnd + 1;
+        }
+        chunk.numWritten = index - (target.indices + chunk.indexOffset);
+    });
+    target.numIndices = objCompactChunks(chunks, target.indices);
 
     // Close OBJ file
-    f.close();
+    fileViewClose(&file);
+    if (invalid) {
+        std::cerr << "Invalid face index in " << filename << std::endl;
+        return false;
+    }
 
     // Compute normals
-    computeNormals(mesh.vertices, mesh.indices, &mesh.normals);
+    computeNormals(target.vertices, target.numVertices, target.indices, target.numIndices,
+                   target.normals);
 
     // Display log message
     std::cout << "Loaded OBJ file " << filename << std::endl;
-    int numTriangles = mesh.indices.size() / 3;
+    int numTriangles = target.numIndices / 3;
     std::cout << "Number of triangles: " << numTriangles << std::endl;
 
     return true;
 }
+
+// Read an OBJMesh from an .obj file (see objMeshLoadInto)
+bool objMeshLoad(OBJMesh &mesh, const std::string &filename)
+{
+    OBJMeshTarget target;
+    target.allocate = [&](std::size_t numVertices, std::size_t numIndices) {
+        mesh.vertices.resize(numVertices);
+        mesh.normals.resize(numVertices);
+        mesh.indices.resize(numIndices);
+        target.vertices = mesh.vertices.data();
+        target.normals = mesh.normals.data();
+        target.indices = mesh.indices.data();
+        return true;
+    };
+    if (!objMeshLoadInto(target, filename)) {
+        return false;
+    }
+    mesh.indices.resize(target.numIndices);
+    return true;
+}
+
+// Memory-mapped binary cache of a mesh loaded from an OBJ file. The
+// cache file is stored next to the OBJ file (with the extension
+// .meshcache appended) and starts with a MeshCacheHeader, followed by
+// the positions, normals, and indices. It is only used if the size,
+// modification time, and content hash of the OBJ file match the header.
+struct MeshCacheHeader {
+    char magic[8];
+    std::uint64_t sourceSize;
+    std::int64_t sourceTime;
+    std::uint64_t sourceHash;
+    std::uint32_t numVertices;
+    std::uint32_t numIndices;
+    float boundsMin[3];
+    float boundsMax[3];
+};
+
+struct MeshCache {
+    FileView file;
+    const glm::vec3 *vertices = nullptr;
+    const glm::vec3 *normals = nullptr;
+    const std::uint32_t *indices = nullptr;
+    std::size_t numVertices = 0;
+    std::size_t numIndices = 0;
+    glm::vec3 boundsMin = glm::vec3(0.0f);
+    glm::vec3 boundsMax = glm::vec3(0.0f);
+};
+
+namespace {
+const char MESH_CACHE_MAGIC[8] = { 'C', 'G', 'M', 'E', 'S', 'H', '0', '2' };
+
+// Fills in the source fields of a cache header from an OBJ file. The
+// content hash (FNV-1a over eight-byte words) is much cheaper to
+// compute than parsing the file.
+bool meshCacheSource(MeshCacheHeader *header, const std::string &objFilename)
+{
+    std::error_code error;
+    std::uintmax_t size = std::filesystem::file_size(objFilename, error);
+    auto time = std::filesystem::last_write_time(objFilename, error);
+    FileView file;
+    if (error || !fileViewOpen(&file, objFilename)) {
+        return false;
+    }
+    std::uint64_t hash = 0xCBF29CE484222325ull ^ file.size;
+    std::size_t i = 0;
+    for (; i + 8 <= file.size; i += 8) {
+        std::uint64_t word;
+        std::memcpy(&word, file.data + i, 8);
+        hash = (hash ^ word) * 0x100000001B3ull;
+        hash ^= hash >> 32;
+    }
+    for (; i < file.size; ++i) {
+        hash = (hash ^ std::uint8_t(file.data[i])) * 0x100000001B3ull;
+    }
+    fileViewClose(&file);
+
+    header->sourceSize = size;
+    header->sourceTime = std::int64_t(time.time_since_epoch().count());
+    header->sourceHash = hash;
+    return true;
+}
+} // namespace
+
+// Opens the mesh cache of an OBJ file. Returns true if the cache exists
+// and is up to date, false otherwise.
+bool meshCacheOpen(MeshCache *cache, const std::string &objFilename)
+{
+    MeshCacheHeader source;
+    FileView file;
+    if (!meshCacheSource(&source, objFilename) ||
+        !fileViewOpen(&file, objFilename + ".meshcache")) {
+        return false;
+    }
+    MeshCacheHeader header;
+    bool valid = file.size >= sizeof(header);
+    if (valid) {
+        std::memcpy(&header, file.data, sizeof(header));
+        std::size_t expectedSize = sizeof(header) + 2 * sizeof(glm::vec3) * header.numVertices +
+                                   sizeof(std::uint32_t) * header.numIndices;
+        valid = std::memcmp(header.magic, MESH_CACHE_MAGIC, sizeof(header.magic)) == 0 &&
+                header.sourceSize == source.sourceSize && header.sourceTime == source.sourceTime &&
+                header.sourceHash == source.sourceHash && file.size == expectedSize;
+    }
+    if (!valid) {
+        fileViewClose(&file);
+        return false;
+    }
+
+    const char *data = file.data + sizeof(header);
+    cache->vertices = reinterpret_cast<const glm::vec3 *>(data);
+    cache->normals = cache->vertices + header.numVertices;
+    cache->indices = reinterpret_cast<const std::uint32_t *>(cache->normals + header.numVertices);
+    cache->numVertices = header.numVertices;
+    cache->numIndices = header.numIndices;
+    cache->boundsMin = glm::vec3(header.boundsMin[0], header.boundsMin[1], header.boundsMin[2]);
+    cache->boundsMax = glm::vec3(header.boundsMax[0], header.boundsMax[1], header.boundsMax[2]);
+    cache->file = std::move(file);
+
+    // Display log message
+    std::cout << "Loaded mesh cache " << objFilename << ".meshcache" << std::endl;
+    std::cout << "Number of triangles: " << cache->numIndices / 3 << std::endl;
+
+    return true;
+}
+
+void meshCacheClose(MeshCache *cache)
+{
+    fileViewClose(&cache->file);
+    *cache = MeshCache();
+}
+
+// Writes the mesh cache of an OBJ file. Returns true on success, false
+// otherwise (e.g., if the directory is not writable).
+bool meshCacheWrite(const glm::vec3 *vertices, const glm::vec3 *normals, std::size_t numVertices,
+                    const std::uint32_t *indices, std::size_t numIndices,
+                    const std::string &objFilename)
+{
+    MeshCacheHeader header;
+    if (!meshCacheSource(&header, objFilename)) {
+        return false;
+    }
+    std::memcpy(header.magic, MESH_CACHE_MAGIC, sizeof(header.magic));
+    header.numVertices = std::uint32_t(numVertices);
+    header.numIndices = std::uint32_t(numIndices);
+    glm::vec3 boundsMin(0.0f), boundsMax(0.0f);
+    if (numVertices > 0) {
+        boundsMin = boundsMax = vertices[0];
+        for (std::size_t i = 1; i < numVertices; ++i) {
+            boundsMin = glm::min(boundsMin, vertices[i]);
+            boundsMax = glm::max(boundsMax, vertices[i]);
+        }
+    }
+    for (int i = 0; i < 3; ++i) {
+        header.boundsMin[i] = boundsMin[i];
+        header.boundsMax[i] = boundsMax[i];
+    }
+
+    // Write to a temporary file first, so that other processes never
+    // map a partially written cache. The temporary file is unique to the
+    // process and the call, since threads (e.g., a background loader and
+    // the main thread) may write the cache of the same file at once.
+    static std::atomic<unsigned> numWrites(0);
+#ifndef _WIN32
+    long process = long(getpid());
+#else
+    long process = long(_getpid());
+#endif
+    std::string filename = objFilename + ".meshcache";
+    std::string tmpFilename = filename + "." + std::to_string(process) + "." +
+                              std::to_string(numWrites++) + ".tmp";
+    std::ofstream f(tmpFilename.c_str(), std::ios::binary);
+    f.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    f.write(reinterpret_cast<const char *>(vertices), numVertices * sizeof(glm::vec3));
+    f.write(reinterpret_cast<const char *>(normals), numVertices * sizeof(glm::vec3));
+    f.write(reinterpret_cast<const char *>(indices), numIndices * sizeof(std::uint32_t));
+    f.close();
+    std::error_code error;
+    if (f) {
+        std::filesystem::rename(tmpFilename, filename, error);
+    }
+    if (!f || error) {
+        std::remove(tmpFilename.c_str());
+        std::cerr << "Could not write mesh cache " << filename << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool meshCacheWrite(const OBJMesh &mesh, const std::string &objFilename)
+{
+    return meshCacheWrite(mesh.vertices.data(), mesh.normals.data(), mesh.vertices.size(),
+                          mesh.indices.data(), mesh.indices.size(), objFilename);
+}
+
+// Post-transform vertex cache statistics of an index buffer: the
+// average cache miss ratio (ACMR, transformed vertices per triangle)
+// and the average transform to vertex ratio (ATVR, transformed vertices
+// per mesh vertex; 1 is optimal)
+struct VertexCacheStats {
+    float acmr = 0.0f;
+    float atvr = 0.0f;
+};
+
+// Simulates a FIFO post-transform vertex cache with cacheSize entries
+VertexCacheStats vertexCacheStats(const std::uint32_t *indices, std::size_t numIndices,
+                                  std::size_t numVertices, int cacheSize = 16)
+{
+    std::vector<std::size_t> insertedAt(numVertices, 0);  // miss number at insertion (0 = never)
+    std::size_t misses = 0;
+    for (std::size_t i = 0; i < numIndices; ++i) {
+        std::size_t &t = insertedAt[indices[i]];
+        if (t == 0 || misses - t >= std::size_t(cacheSize)) {
+            t = ++misses;
+        }
+    }
+    VertexCacheStats stats;
+    stats.acmr = numIndices > 0 ? float(misses) / float(numIndices / 3) : 0.0f;
+    stats.atvr = numVertices > 0 ? float(misses) / float(numVertices) : 0.0f;
+    return stats;
+}
+
+// Reorders the triangles of an index buffer for the post-transform
+// vertex cache, with the Tipsify algorithm (Sander et al., "Fast
+// Triangle Reordering for Vertex Locality and Reduced Overdraw", 2007):
+// triangles are emitted in fans around vertices, and the next fanning
+// vertex is a recently used one that still has triangles left and will
+// probably still be in a cache of cacheSize entries.
+void optimizeVertexCache(std::uint32_t *indices, std::size_t numIndices, std::size_t numVertices,
+                         int cacheSize = 16)
+{
+    std::size_t numTriangles = numIndices / 3;
+    if (numTriangles == 0) {
+        return;
+    }
+
+    // Vertex-to-triangle adjacency (CSR), and live triangle counts
+    std::vector<std::uint32_t> live(numVertices, 0);
+    for (std::size_t i = 0; i < 3 * numTriangles; ++i) {
+        live[indices[i]]++;
+    }
+    std::vector<std::uint32_t> offsets(numVertices + 1, 0);
+    for (std::size_t v = 0; v < numVertices; ++v) {
+        offsets[v + 1] = offsets[v] + live[v];
+    }
+    std::vector<std::uint32_t> adjacency(3 * numTriangles);
+    std::vector<std::uint32_t> cursor(offsets.begin(), offsets.end() - 1);
+    for (std::size_t i = 0; i < 3 * numTriangles; ++i) {
+        adjacency[cursor[indices[i]]++] = std::uint32_t(i / 3);
+    }
+
+    std::vector<std::uint32_t> output;
+    output.reserve(3 * numTriangles);
+    std::vector<std::uint8_t> emitted(numTriangles, 0);
+    std::vector<long> cacheTime(numVertices, 0);
+    std::vector<std::uint32_t> deadEnd;
+    std::vector<std::uint32_t> candidates;
+    long time = cacheSize + 1;
+    std::size_t scan = 0;  // next vertex to consider when out of candidates
+    long fanning = 0;
+    while (fanning >= 0) {
+        // Emit the remaining triangles around the fanning vertex
+        candidates.clear();
+        for (std::uint32_t k = offsets[fanning]; k < offsets[fanning + 1]; ++k) {
+            std::uint32_t t = adjacency[k];
+            if (emitted[t]) {
+                continue;
+            }
+            emitted[t] = 1;
+            for (int c = 0; c < 3; ++c) {
+                std::uint32_t v = indices[3 * t + c];
+                output.push_back(v);
+                deadEnd.push_back(v);
+                candidates.push_back(v);
+                live[v]--;
+                if (time - cacheTime[v] > cacheSize) {
+                    cacheTime[v] = time++;
+                }
+            }
+        }
+
+        // Pick the candidate that stays longest in the cache after its
+        // remaining triangles are emitted
+        fanning = -1;
+        long bestPriority = -1;
+        for (std::uint32_t v : candidates) {
+            if (live[v] == 0) {
+                continue;
+            }
+            long priority = 0;
+            if (time - cacheTime[v] + 2 * long(live[v]) <= cacheSize) {
+                priority = time - cacheTime[v];
+            }
+            if (priority > bestPriority) {
+                bestPriority = priority;
+                fanning = v;
+            }
+        }
+
+        // Otherwise continue from a recently used vertex, or from the
+        // next vertex in input order that has triangles left
+        while (fanning < 0 && !deadEnd.empty()) {
+            std::uint32_t v = deadEnd.back();
+            deadEnd.pop_back();
+            if (live[v] > 0) {
+                fanning = v;
+            }
+        }
+        while (fanning < 0 && scan < numVertices) {
+            if (live[scan] > 0) {
+                fanning = long(scan);
+            }
+            scan++;
+        }
+    }
+    std::copy(output.begin(), output.end(), indices);
+}
+
+// Reorders the vertices (and normals) in order of first use by the
+// index buffer, so that vertex fetches access memory sequentially.
+// Unreferenced vertices are moved to the end.
+void optimizeVertexFetch(glm::vec3 *vertices, glm::vec3 *normals, std::size_t numVertices,
+                         std::uint32_t *indices, std::size_t numIndices)
+{
+    const std::uint32_t UNUSED = 0xFFFFFFFFu;
+    std::vector<std::uint32_t> remap(numVertices, UNUSED);
+    std::uint32_t next = 0;
+    for (std::size_t i = 0; i < numIndices; ++i) {
+        if (remap[indices[i]] == UNUSED) {
+            remap[indices[i]] = next++;
+        }
+        indices[i] = remap[indices[i]];
+    }
+    for (std::size_t v = 0; v < numVertices; ++v) {
+        if (remap[v] == UNUSED) {
+            remap[v] = next++;
+        }
+    }
+    std::vector<glm::vec3> tmp(vertices, vertices + numVertices);
+    for (std::size_t v = 0; v < numVertices; ++v) {
+        vertices[remap[v]] = tmp[v];
+    }
+    tmp.assign(normals, normals + numVertices);
+    for (std::size_t v = 0; v < numVertices; ++v) {
+        normals[remap[v]] = tmp[v];
+    }
+}
+
+// Optimizes the vertex cache and vertex fetch order of a loaded mesh,
+// and displays the vertex cache statistics before and after
+void optimizeMeshVertexOrder(glm::vec3 *vertices, glm::vec3 *normals, std::size_t numVertices,
+                             std::uint32_t *indices, std::size_t numIndices)
+{
+    VertexCacheStats before = vertexCacheStats(indices, numIndices, numVertices);
+    optimizeVertexCache(indices, numIndices, numVertices);
+    optimizeVertexFetch(vertices, normals, numVertices, indices, numIndices);
+    VertexCacheStats after = vertexCacheStats(indices, numIndices, numVertices);
+
+    // Display log message
+    std::cout << "Vertex cache ACMR " << before.acmr << " -> " << after.acmr
+              << ", ATVR " << before.atvr << " -> " << after.atvr << std::endl;
+}
+
+void optimizeMeshVertexOrder(OBJMesh &mesh)
+{
+    optimizeMeshVertexOrder(mesh.vertices.data(), mesh.normals.data(), mesh.vertices.size(),
+                            mesh.indices.data(), mesh.indices.size());
+}
+
+// Compact vertex format for rendering. Positions are 16-bit unsigned
+// normalized integers relative to the bounding box of the mesh (four
+// per vertex, the fourth being padding that keeps vertices 4-byte
+// aligned), and are reconstructed as positionOffset + positionScale * q.
+// Normals are octahedral coordinates stored as two 16-bit signed
+// normalized integers. Meshes with at most 65536 vertices get 16-bit
+// indices. A vertex takes 12 bytes instead of 24.
+struct QuantizedMesh {
+    std::vector<std::uint16_t> positions;
+    std::vector<std::int16_t> normals;
+    std::vector<std::uint16_t> indices16;  // empty if 32-bit indices are needed
+    glm::vec3 positionOffset = glm::vec3(0.0f);
+    glm::vec3 positionScale = glm::vec3(1.0f);
+};
+
+namespace {
+// Maps a unit vector to the [-1, 1]^2 square by projecting it onto the
+// octahedron |x| + |y| + |z| = 1 and folding the lower half outwards.
+// Zero-length (or NaN) vectors map to (0, 0), i.e., to +z.
+glm::vec2 octEncode(const glm::vec3 &n)
+{
+    float l1 = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+    if (!(l1 > 0.0f)) {
+        return glm::vec2(0.0f);
+    }
+    glm::vec2 p = glm::vec2(n.x, n.y) / l1;
+    if (n.z < 0.0f) {
+        p = glm::vec2((1.0f - std::abs(p.y)) * (p.x >= 0.0f ? 1.0f : -1.0f),
+                      (1.0f - std::abs(p.x)) * (p.y >= 0.0f ? 1.0f : -1.0f));
+    }
+    return p;
+}
+} // namespace
+
+// Quantizes the vertices, normals, and indices of a mesh into the
+// compact vertex format
+void quantizeMesh(const glm::vec3 *vertices, const glm::vec3 *normals, std::size_t numVertices,
+                  const std::uint32_t *indices, std::size_t numIndices, QuantizedMesh *quantized)
+{
+    const std::size_t MIN_RANGE = 64 * 1024;
+
+    glm::vec3 boundsMin(0.0f), boundsMax(0.0f);
+    if (numVertices > 0) {
+        boundsMin = boundsMax = vertices[0];
+        for (std::size_t i = 1; i < numVertices; ++i) {
+            boundsMin = glm::min(boundsMin, vertices[i]);
+            boundsMax = glm::max(boundsMax, vertices[i]);
+        }
+    }
+    glm::vec3 extent = boundsMax - boundsMin;
+    glm::vec3 invExtent;
+    for (int k = 0; k < 3; ++k) {
+        invExtent[k] = (extent[k] > 0.0f) ? 65535.0f / extent[k] : 0.0f;
+    }
+    quantized->positionOffset = boundsMin;
+    quantized->positionScale = extent;
+
+    quantized->positions.resize(4 * numVertices);
+    quantized->normals.resize(2 * numVertices);
+    meshParallelFor(numVertices, MIN_RANGE, [&](std::size_t begin, std::size_t end) {
+        for (std::size_t i = begin; i < end; ++i) {
+            glm::vec3 q = glm::clamp((vertices[i] - boundsMin) * invExtent + 0.5f, 0.0f, 65535.0f);
+            quantized->positions[4 * i + 0] = std::uint16_t(q.x);
+            quantized->positions[4 * i + 1] = std::uint16_t(q.y);
+            quantized->positions[4 * i + 2] = std::uint16_t(q.z);
+            quantized->positions[4 * i + 3] = 0;
+            glm::vec2 e = octEncode(normals[i]) * 32767.0f;
+            quantized->normals[2 * i + 0] = std::int16_t(std::lround(e.x));
+            quantized->normals[2 * i + 1] = std::int16_t(std::lround(e.y));
+        }
+    });
+
+    quantized->indices16.clear();
+    if (numVertices <= 65536) {
+        quantized->indices16.assign(indices, indices + numIndices);
+    }
+
+    // Display log message
+    std::size_t indexSize = quantized->indices16.empty() ? 4 : 2;
+    std::cout << "Quantized mesh from " << (24 * numVertices + 4 * numIndices) / 1024
+              << " KB to " << (12 * numVertices + indexSize * numIndices) / 1024 << " KB" << std::endl;
+}
+
+// Per-vertex attribute array to interleave: numVertices elements of
+// size bytes each, tightly packed
+struct VertexAttributeArray {
+    const void *data;
+    std::size_t size;
+};
+
+// Interleaves per-vertex attribute arrays into one array of vertices,
+// with the attributes of each vertex in the given order and padded to a
+// multiple of alignment bytes. Returns the stride of the vertices, and
+// stores the offset of each attribute in offsets (if not null).
+std::size_t interleaveVertexAttributes(const std::vector<VertexAttributeArray> &attributes,
+                                       std::size_t numVertices, std::size_t alignment,
+                                       std::vector<std::uint8_t> *interleaved,
+                                       std::vector<std::size_t> *offsets = nullptr)
+{
+    std::vector<std::size_t> attributeOffsets;
+    std::size_t stride = 0;
+    for (const VertexAttributeArray &attribute : attributes) {
+        attributeOffsets.push_back(stride);
+        stride += attribute.size;
+    }
+    stride = (stride + alignment - 1) / alignment * alignment;
+
+    interleaved->assign(numVertices * stride, 0);
+    meshParallelFor(numVertices, 64 * 1024, [&](std::size_t begin, std::size_t end) {
+        for (std::size_t a = 0; a < attributes.size(); ++a) {
+            const std::uint8_t *src = static_cast<const std::uint8_t *>(attributes[a].data);
+            std::size_t size = attributes[a].size;
+            std::uint8_t *dst = interleaved->data() + attributeOffsets[a];
+            for (std::size_t i = begin; i < end; ++i) {
+                std::memcpy(dst + i * stride, src + i * size, size);
+            }
+        }
+    });
+
+    if (offsets != nullptr) {
+        *offsets = attributeOffsets;
+    }
+    return stride;
+}
+
+// Chain of levels of detail (LODs) of a mesh. Every level has about
+// half the triangles of the previous one, and indexes the vertices of
+// the full-resolution mesh (level 0), so that all levels can share one
+// vertex buffer.
+struct MeshLODChain {
+    std::vector<std::uint32_t> indices;  // all levels, one after the other
+    std::vector<std::size_t> offsets;  // first index of each level, and the total
+    std::vector<float> errors;  // error of each level, relative to the radius
+    glm::vec3 center = glm::vec3(0.0f);  // bounding sphere
+    float radius = 0.0f;
+};
+
+namespace {
+// Quadric error metric: the (area-weighted) sum of squared distances
+// of a point to a set of planes, p^T A p + 2 b^T p + c, with the total
+// weight w
+struct Quadric {
+    double a00, a01, a02, a11, a12, a22;
+    double b0, b1, b2;
+    double c;
+    double w;
+};
+
+Quadric quadricFromTriangle(const glm::vec3 &v0, const glm::vec3 &v1, const glm::vec3 &v2)
+{
+    Quadric q = {};
+    glm::vec3 normal = glm::cross(v1 - v0, v2 - v0);
+    double length = glm::length(normal);
+    if (!(length > 0.0)) {
+        return q;
+    }
+    double nx = normal.x / length, ny = normal.y / length, nz = normal.z / length;
+    double d = -(nx * v0.x + ny * v0.y + nz * v0.z);
+    double w = 0.5 * length;
+    q.a00 = w * nx * nx; q.a01 = w * nx * ny; q.a02 = w * nx * nz;
+    q.a11 = w * ny * ny; q.a12 = w * ny * nz; q.a22 = w * nz * nz;
+    q.b0 = w * d * nx; q.b1 = w * d * ny; q.b2 = w * d * nz;
+    q.c = w * d * d;
+    q.w = w;
+    return q;
+}
+
+void quadricAdd(Quadric *q, const Quadric &r)
+{
+    q->a00 += r.a00; q->a01 += r.a01; q->a02 += r.a02;
+    q->a11 += r.a11; q->a12 += r.a12; q->a22 += r.a22;
+    q->b0 += r.b0; q->b1 += r.b1; q->b2 += r.b2;
+    q->c += r.c;
+    q->w += r.w;
+}
+
+// Returns the weighted sum of squared distances of p to the planes of
+// the sum of two quadrics
+double quadricError(const Quadric &q, const Quadric &r, const glm::vec3 &p)
+{
+    double x = p.x, y = p.y, z = p.z;
+    double e = (q.a00 + r.a00) * x * x + (q.a11 + r.a11) * y * y + (q.a22 + r.a22) * z * z +
+               2.0 * ((q.a01 + r.a01) * x * y + (q.a02 + r.a02) * x * z + (q.a12 + r.a12) * y * z) +
+               2.0 * ((q.b0 + r.b0) * x + (q.b1 + r.b1) * y + (q.b2 + r.b2) * z) + (q.c + r.c);
+    return std::max(e, 0.0);
+}
+
+// Candidate edge collapse, which moves vertex from onto vertex to
+struct EdgeCollapse {
+    std::uint32_t from;
+    std::uint32_t to;
+    double error;
+};
+
+// Returns false if moving vertex from to the position of vertex to
+// would flip (or degenerate) any triangle around from that does not
+// contain to. triangles holds the adjacent triangles of from.
+bool collapseKeepsOrientation(const glm::vec3 *vertices, const std::uint32_t *indices,
+                              const std::uint32_t *triangles, std::size_t numTriangles,
+                              std::uint32_t from, std::uint32_t to)
+{
+    for (std::size_t t = 0; t < numTriangles; ++t) {
+        const std::uint32_t *tri = &indices[3 * triangles[t]];
+        if (tri[0] == to || tri[1] == to || tri[2] == to) {
+            continue;  // removed by the collapse
+        }
+        glm::vec3 p[3], q[3];
+        for (int k = 0; k < 3; ++k) {
+            p[k] = vertices[tri[k]];
+            q[k] = (tri[k] == from) ? vertices[to] : p[k];
+        }
+        glm::vec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+        glm::vec3 after = glm::cross(q[1] - q[0], q[2] - q[0]);
+        if (glm::dot(before, after) <= 0.0f) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Simplifies an indexed mesh in place with edge collapses in order of
+// increasing quadric error (Garland and Heckbert), until at most
+// targetIndexCount indices remain or no edge can be collapsed. Each
+// pass collapses the cheapest independent edges (no two collapses
+// touch the same triangles), after which the indices are rewritten.
+// The edge errors are computed in parallel. Returns the largest error
+// (the RMS distance to the original planes) of the collapses.
+double simplifyIndices(const glm::vec3 *vertices, std::vector<Quadric> &quadrics,
+                       const std::vector<std::uint8_t> &locked,
+                       std::vector<std::uint32_t> &indices, std::size_t targetIndexCount)
+{
+    const std::size_t MIN_RANGE = 16 * 1024;
+    std::size_t numVertices = quadrics.size();
+    double maxError = 0.0;
+    while (indices.size() > targetIndexCount) {
+        std::size_t numTriangles = indices.size() / 3;
+
+        // Vertex to triangle adjacency, in compressed rows
+        std::vector<std::uint32_t> first(numVertices + 1, 0);
+        for (std::uint32_t index : indices) {
+            first[index + 1]++;
+        }
+        for (std::size_t v = 0; v < numVertices; ++v) {
+            first[v + 1] += first[v];
+        }
+        std::vector<std::uint32_t> adjacency(indices.size());
+        std::vector<std::uint32_t> fill(first.begin(), first.end() - 1);
+        for (std::size_t c = 0; c < indices.size(); ++c) {
+            adjacency[fill[indices[c]]++] = std::uint32_t(c / 3);
+        }
+
+        // Unique edges, with the cheaper of their two collapse directions
+        std::vector<std::uint64_t> edges(indices.size());
+        for (std::size_t c = 0; c < indices.size(); ++c) {
+            std::uint32_t a = indices[c];
+            std::uint32_t b = indices[c - c % 3 + (c + 1) % 3];
+            edges[c] = (std::uint64_t(std::min(a, b)) << 32) | std::max(a, b);
+        }
+        std::sort(edges.begin(), edges.end());
+        edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+        std::vector<EdgeCollapse> collapses(edges.size());
+        meshParallelFor(edges.size(), MIN_RANGE, [&](std::size_t begin, std::size_t end) {
+            for (std::size_t e = begin; e < end; ++e) {
+                std::uint32_t a = std::uint32_t(edges[e] >> 32);
+                std::uint32_t b = std::uint32_t(edges[e]);
+                double ab = locked[a] ? HUGE_VAL : quadricError(quadrics[a], quadrics[b], vertices[b]);
+                double ba = locked[b] ? HUGE_VAL : quadricError(quadrics[a], quadrics[b], vertices[a]);
+                collapses[e] = (ab <= ba) ? EdgeCollapse{ a, b, ab } : EdgeCollapse{ b, a, ba };
+            }
+        });
+        collapses.erase(std::remove_if(collapses.begin(), collapses.end(),
+                                       [](const EdgeCollapse &e) { return e.error == HUGE_VAL; }),
+                        collapses.end());
+        std::sort(collapses.begin(), collapses.end(),
+                  [](const EdgeCollapse &x, const EdgeCollapse &y) { return x.error < y.error; });
+
+        // Collapses the cheapest edges. A collapse removes about two
+        // triangles, and locks the vertices of the triangles around it.
+        std::size_t maxCollapses = (indices.size() - targetIndexCount) / 6 + 1;
+        std::vector<std::uint32_t> remap(numVertices);
+        for (std::size_t v = 0; v < numVertices; ++v) {
+            remap[v] = std::uint32_t(v);
+        }
+        std::vector<std::uint8_t> touched(numVertices, 0);
+        std::size_t numCollapses = 0;
+        for (const EdgeCollapse &e : collapses) {
+            if (numCollapses >= maxCollapses) {
+                break;
+            }
+            if (touched[e.from] || touched[e.to]) {
+                continue;
+            }
+            const std::uint32_t *triangles = &adjacency[first[e.from]];
+            std::size_t count = first[e.from + 1] - first[e.from];
+            if (!collapseKeepsOrientation(vertices, indices.data(), triangles, count, e.from, e.to)) {
+                continue;
+            }
+            for (std::size_t t = 0; t < count; ++t) {
+                for (int k = 0; k < 3; ++k) {
+                    touched[indices[3 * triangles[t] + k]] = 1;
+                }
+            }
+            remap[e.from] = e.to;
+            quadricAdd(&quadrics[e.to], quadrics[e.from]);
+            const Quadric &q = quadrics[e.to];
+            maxError = std::max(maxError, std::sqrt(e.error / std::max(q.w, 1e-30)));
+            numCollapses++;
+        }
+        if (numCollapses == 0) {
+            break;
+        }
+
+        // Rewrites the indices, without the degenerate triangles
+        std::size_t n = 0;
+        for (std::size_t t = 0; t < numTriangles; ++t) {
+            std::uint32_t a = remap[indices[3 * t]];
+            std::uint32_t b = remap[indices[3 * t + 1]];
+            std::uint32_t c = remap[indices[3 * t + 2]];
+            if (a != b && b != c && c != a) {
+                indices[n++] = a;
+                indices[n++] = b;
+                indices[n++] = c;
+            }
+        }
+        indices.resize(n);
+    }
+    return maxError;
+}
+} // namespace
+
+// Builds a chain of numLODs levels of detail for a mesh, where level 0
+// is the mesh itself and every following level is simplified from the
+// previous one to half its triangles, with quadric error metric edge
+// collapses. Vertices on open boundaries are kept in place. The chain
+// stops early if a level cannot be simplified further.
+void buildMeshLODChain(const glm::vec3 *vertices, std::size_t numVertices,
+                       const std::uint32_t *indices, std::size_t numIndices, int numLODs,
+                       MeshLODChain *chain)
+{
+    const std::size_t MIN_RANGE = 16 * 1024;
+    std::size_t numTriangles = numIndices / 3;
+
+    // Bounding sphere (around the center of the bounding box)
+    glm::vec3 boundsMin(0.0f), boundsMax(0.0f);
+    if (numVertices > 0) {
+        boundsMin = boundsMax = vertices[0];
+        for (std::size_t i = 1; i < numVertices; ++i) {
+            boundsMin = glm::min(boundsMin, vertices[i]);
+            boundsMax = glm::max(boundsMax, vertices[i]);
+        }
+    }
+    chain->center = 0.5f * (boundsMin + boundsMax);
+    chain->radius = 0.0f;
+    for (std::size_t i = 0; i < numVertices; ++i) {
+        chain->radius = std::max(chain->radius, glm::length(vertices[i] - chain->center));
+    }
+
+    // Vertex quadrics, from the face quadrics computed in parallel
+    std::vector<Quadric> faceQuadrics(numTriangles);
+    meshParallelFor(numTriangles, MIN_RANGE, [&](std::size_t begin, std::size_t end) {
+        for (std::size_t t = begin; t < end; ++t) {
+            faceQuadrics[t] = quadricFromTriangle(vertices[indices[3 * t]], vertices[indices[3 * t + 1]],
+                                                  vertices[indices[3 * t + 2]]);
+        }
+    });
+    std::vector<Quadric> quadrics(numVertices, Quadric());
+    for (std::size_t c = 0; c < 3 * numTriangles; ++c) {
+        quadricAdd(&quadrics[indices[c]], faceQuadrics[c / 3]);
+    }
+
+    // Vertices on open boundaries (edges without an opposite edge) are locked
+    std::vector<std::uint64_t> halfEdges(3 * numTriangles);
+    for (std::size_t c = 0; c < halfEdges.size(); ++c) {
+        halfEdges[c] = (std::uint64_t(indices[c]) << 32) | indices[c - c % 3 + (c + 1) % 3];
+    }
+    std::sort(halfEdges.begin(), halfEdges.end());
+    std::vector<std::uint8_t> locked(numVertices, 0);
+    for (std::uint64_t edge : halfEdges) {
+        std::uint64_t opposite = (edge << 32) | (edge >> 32);
+        if (!std::binary_search(halfEdges.begin(), halfEdges.end(), opposite)) {
+            locked[edge >> 32] = 1;
+            locked[edge & 0xffffffffu] = 1;
+        }
+    }
+
+    std::vector<std::uint32_t> level(indices, indices + 3 * numTriangles);
+    chain->indices = level;
+    chain->offsets.assign(1, 0);
+    chain->offsets.push_back(level.size());
+    chain->errors.assign(1, 0.0f);
+    double error = 0.0;
+    for (int l = 1; l < numLODs; ++l) {
+        std::size_t target = level.size() / 6 * 3;
+        error = std::max(error, simplifyIndices(vertices, quadrics, locked, level, target));
+        if (level.size() == chain->offsets[l] - chain->offsets[l - 1] || level.empty()) {
+            break;
+        }
+        chain->indices.insert(chain->indices.end(), level.begin(), level.end());
+        chain->offsets.push_back(chain->indices.size());
+        chain->errors.push_back(chain->radius > 0.0f ? float(error / chain->radius) : 0.0f);
+    }
+
+    // Display log message
+    std::cout << "Built " << chain->errors.size() << " levels of detail:";
+    for (std::size_t l = 0; l < chain->errors.size(); ++l) {
+        std::cout << " " << (chain->offsets[l + 1] - chain->offsets[l]) / 3;
+    }
+    std::cout << " triangles" << std::endl;
+}
+
+// Selects the level of detail to draw for a mesh whose bounding sphere
+// has a projected radius of projectedRadius pixels: the coarsest level
+// with an error of at most maxPixelError pixels on screen. To avoid
+// popping back and forth at a threshold, a level coarser than
+// currentLOD is only selected once its error is below hysteresis times
+// the threshold.
+int selectMeshLOD(const MeshLODChain &chain, float projectedRadius, int currentLOD,
+                  float maxPixelError = 1.0f, float hysteresis = 0.75f)
+{
+    int lod = 0;
+    for (int l = 1; l < int(chain.errors.size()); ++l) {
+        float pixelError = chain.errors[l] * projectedRadius;
+        float threshold = (l > currentLOD) ? hysteresis * maxPixelError : maxPixelError;
+        if (pixelError > threshold) {
+            break;
+        }
+        lod = l;
+    }
+    return lod;
+}
+
+// Cluster of at most 64 vertices and 124 triangles of a mesh, given as
+// a range of its index array, with bounds for culling. A cluster can
+// be skipped if its bounding sphere is outside the view frustum, or if
+// dot(normalize(coneApex - eye), coneAxis) >= coneCutoff, in which case
+// all of its triangles face away from the eye.
+struct Meshlet {
+    std::uint32_t firstIndex;
+    std::uint32_t numIndices;
+    glm::vec3 center;  // bounding sphere
+    float radius;
+    glm::vec3 coneApex;  // normal cone
+    glm::vec3 coneAxis;
+    float coneCutoff;  // 1 if the cluster can never be backfacing
+};
+
+namespace {
+// Computes the bounding sphere and normal cone of a meshlet
+void meshletBounds(const glm::vec3 *vertices, const std::uint32_t *indices, Meshlet *meshlet)
+{
+    const std::uint32_t *tri = indices + meshlet->firstIndex;
+    std::size_t numTriangles = meshlet->numIndices / 3;
+
+    glm::vec3 boundsMin = vertices[tri[0]], boundsMax = vertices[tri[0]];
+    for (std::size_t c = 0; c < meshlet->numIndices; ++c) {
+        boundsMin = glm::min(boundsMin, vertices[tri[c]]);
+        boundsMax = glm::max(boundsMax, vertices[tri[c]]);
+    }
+    meshlet->center = 0.5f * (boundsMin + boundsMax);
+    meshlet->radius = 0.0f;
+    for (std::size_t c = 0; c < meshlet->numIndices; ++c) {
+        meshlet->radius = std::max(meshlet->radius, glm::length(vertices[tri[c]] - meshlet->center));
+    }
+
+    // The cone axis is the average of the triangle normals, and the
+    // cone contains all of them. The apex is placed behind the planes
+    // of all triangles, so that the test holds for any eye position.
+    std::vector<glm::vec3> normals(numTriangles, glm::vec3(0.0f));
+    glm::vec3 axis(0.0f);
+    for (std::size_t t = 0; t < numTriangles; ++t) {
+        const glm::vec3 &p0 = vertices[tri[3 * t]];
+        glm::vec3 n = glm::cross(vertices[tri[3 * t + 1]] - p0, vertices[tri[3 * t + 2]] - p0);
+        float length = glm::length(n);
+        if (length > 0.0f) {
+            normals[t] = n / length;
+            axis += normals[t];
+        }
+    }
+    meshlet->coneApex = meshlet->center;
+    meshlet->coneAxis = glm::vec3(0.0f, 0.0f, 1.0f);
+    meshlet->coneCutoff = 1.0f;
+    float axisLength = glm::length(axis);
+    if (!(axisLength > 0.0f)) {
+        return;
+    }
+    axis /= axisLength;
+    float minDot = 1.0f;
+    for (const glm::vec3 &n : normals) {
+        if (n != glm::vec3(0.0f)) {
+            minDot = std::min(minDot, glm::dot(axis, n));
+        }
+    }
+    if (minDot <= 0.1f) {
+        return;  // the cone is too wide to ever be backfacing
+    }
+    float maxT = 0.0f;
+    for (std::size_t t = 0; t < numTriangles; ++t) {
+        if (normals[t] != glm::vec3(0.0f)) {
+            float distance = glm::dot(meshlet->center - vertices[tri[3 * t]], normals[t]);
+            maxT = std::max(maxT, distance / glm::dot(axis, normals[t]));
+        }
+    }
+    meshlet->coneApex = meshlet->center - axis * maxT;
+    meshlet->coneAxis = axis;
+    meshlet->coneCutoff = std::sqrt(1.0f - minDot * minDot);
+}
+} // namespace
+
+// Splits the triangles [firstIndex, firstIndex + numIndices) of a mesh
+// into meshlets of at most maxVertices vertices and maxTriangles
+// triangles, which are appended to meshlets. The triangles of the range
+// are reordered so that every meshlet is a contiguous range of the
+// index array. A meshlet grows from a seed triangle by adding the
+// neighbouring triangle that adds the fewest new vertices, and then the
+// one closest to the average normal of the meshlet, which keeps the
+// normal cones narrow.
+void buildMeshlets(const glm::vec3 *vertices, std::size_t numVertices, std::uint32_t *indices,
+                   std::size_t firstIndex, std::size_t numIndices, std::vector<Meshlet> *meshlets,
+                   std::size_t maxVertices = 64, std::size_t maxTriangles = 124)
+{
+    const std::uint32_t *tris = indices + firstIndex;
+    std::size_t numTriangles = numIndices / 3;
+
+    // Triangle normals, and vertex to triangle adjacency in compressed rows
+    std::vector<glm::vec3> normals(numTriangles);
+    std::vector<std::uint32_t> first(numVertices + 1, 0);
+    for (std::size_t t = 0; t < numTriangles; ++t) {
+        const glm::vec3 &p0 = vertices[tris[3 * t]];
+        glm::vec3 n = glm::cross(vertices[tris[3 * t + 1]] - p0, vertices[tris[3 * t + 2]] - p0);
+        float length = glm::length(n);
+        normals[t] = (length > 0.0f) ? n / length : glm::vec3(0.0f);
+        for (int k = 0; k < 3; ++k) {
+            first[tris[3 * t + k] + 1]++;
+        }
+    }
+    for (std::size_t v = 0; v < numVertices; ++v) {
+        first[v + 1] += first[v];
+    }
+    std::vector<std::uint32_t> adjacency(3 * numTriangles);
+    std::vector<std::uint32_t> fill(first.begin(), first.end() - 1);
+    for (std::size_t c = 0; c < 3 * numTriangles; ++c) {
+        adjacency[fill[tris[c]]++] = std::uint32_t(c / 3);
+    }
+
+    std::vector<std::uint8_t> used(numTriangles, 0);
+    std::vector<std::uint32_t> vertexStamp(numVertices, 0);  // meshlet (plus one) of each vertex
+    std::vector<std::uint32_t> candidateStamp(numTriangles, 0);
+    std::vector<std::uint32_t> order;  // triangles in meshlet order
+    order.reserve(numTriangles);
+    std::vector<std::uint32_t> candidates;
+    std::uint32_t id = 0;
+    std::size_t seed = 0;
+    while (order.size() < numTriangles) {
+        id++;
+        while (used[seed]) {
+            seed++;
+        }
+        std::size_t meshletBegin = order.size();
+        std::size_t numMeshletVertices = 0;
+        glm::vec3 axis(0.0f);
+        candidates.assign(1, std::uint32_t(seed));
+        candidateStamp[seed] = id;
+        while (!candidates.empty() && order.size() - meshletBegin < maxTriangles) {
+            // Picks the best candidate that still fits
+            std::size_t best = candidates.size();
+            float bestScore = HUGE_VALF;
+            for (std::size_t i = 0; i < candidates.size(); ++i) {
+                const std::uint32_t *tri = &tris[3 * candidates[i]];
+                std::size_t added = std::size_t(vertexStamp[tri[0]] != id) + std::size_t(vertexStamp[tri[1]] != id) +
+                                    std::size_t(vertexStamp[tri[2]] != id);
+                if (numMeshletVertices + added > maxVertices) {
+                    continue;
+                }
+                float score = float(added) + (1.0f - glm::dot(normals[candidates[i]], axis)) * 0.5f;
+                if (score < bestScore) {
+                    bestScore = score;
+                    best = i;
+                }
+            }
+            if (best == candidates.size()) {
+                break;
+            }
+            std::uint32_t t = candidates[best];
+            candidates[best] = candidates.back();
+            candidates.pop_back();
+
+            // Adds the triangle, and its unused neighbours as candidates
+            used[t] = 1;
+            order.push_back(t);
+            if (glm::length(axis) > 0.0f || normals[t] != glm::vec3(0.0f)) {
+                glm::vec3 sum = axis * float(order.size() - meshletBegin - 1) + normals[t];
+                float length = glm::length(sum);
+                axis = (length > 0.0f) ? sum / length : axis;
+            }
+            for (int k = 0; k < 3; ++k) {
+                std::uint32_t v = tris[3 * t + k];
+                if (vertexStamp[v] != id) {
+                    vertexStamp[v] = id;
+                    numMeshletVertices++;
+                }
+                for (std::uint32_t a = first[v]; a < first[v + 1]; ++a) {
+                    std::uint32_t neighbour = adjacency[a];
+                    if (!used[neighbour] && candidateStamp[neighbour] != id) {
+                        candidateStamp[neighbour] = id;
+                        candidates.push_back(neighbour);
+                    }
+                }
+            }
+        }
+
+        Meshlet meshlet = {};
+        meshlet.firstIndex = std::uint32_t(firstIndex + 3 * meshletBegin);
+        meshlet.numIndices = std::uint32_t(3 * (order.size() - meshletBegin));
+        meshlets->push_back(meshlet);
+    }
+
+    // Writes the triangles in meshlet order, and computes the bounds
+    std::vector<std::uint32_t> reordered(3 * numTriangles);
+    for (std::size_t i = 0; i < numTriangles; ++i) {
+        for (int k = 0; k < 3; ++k) {
+            reordered[3 * i + k] = tris[3 * order[i] + k];
+        }
+    }
+    std::copy(reordered.begin(), reordered.end(), indices + firstIndex);
+    std::size_t firstMeshlet = meshlets->size() - std::size_t(id);
+    meshParallelFor(std::size_t(id), 256, [&](std::size_t begin, std::size_t end) {
+        for (std::size_t i = begin; i < end; ++i) {
+            meshletBounds(vertices, indices, &(*meshlets)[firstMeshlet + i]);
+        }
+    });
+}
+
+// Extracts the planes of the view frustum of a model-view-projection
+// matrix, in model space, with normals pointing into the frustum
+void frustumPlanes(const glm::mat4 &mvp, glm::vec4 planes[6])
+{
+    for (int i = 0; i < 3; ++i) {
+        for (int side = 0; side < 2; ++side) {
+            glm::vec4 &plane = planes[2 * i + side];
+            float sign = side ? -1.0f : 1.0f;
+            for (int k = 0; k < 4; ++k) {
+                plane[k] = mvp[k][3] + sign * mvp[k][i];
+            }
+            plane *= 1.0f / glm::length(glm::vec3(plane.x, plane.y, plane.z));
+        }
+    }
+}
+
+// Culls the meshlets [begin, end) that are outside the view frustum
+// (given by its planes in model space, e.g., from frustumPlanes) or
+// backfacing as seen from eye (in model space), in parallel. The index
+// ranges of the remaining meshlets are written to firstIndices and
+// indexCounts, with adjacent ranges merged into one. Returns the number
+// of triangles in the ranges.
+std::size_t cullMeshlets(const std::vector<Meshlet> &meshlets, std::size_t begin, std::size_t end,
+                         const glm::vec4 planes[6], const glm::vec3 &eye,
+                         std::vector<std::uint32_t> *firstIndices,
+                         std::vector<std::uint32_t> *indexCounts)
+{
+    std::vector<std::uint8_t> visible(end - begin);
+    meshParallelFor(end - begin, 4096, [&](std::size_t first, std::size_t last) {
+        for (std::size_t i = first; i < last; ++i) {
+            const Meshlet &meshlet = meshlets[begin + i];
+            bool inside = true;
+            for (int p = 0; p < 6 && inside; ++p) {
+                inside = glm::dot(glm::vec3(planes[p].x, planes[p].y, planes[p].z), meshlet.center) +
+                         planes[p].w >= -meshlet.radius;
+            }
+            bool backfacing = glm::dot(glm::normalize(meshlet.coneApex - eye), meshlet.coneAxis) >=
+                              meshlet.coneCutoff;
+            visible[i] = inside && !backfacing;
+        }
+    });
+
+    firstIndices->clear();
+    indexCounts->clear();
+    std::size_t numIndices = 0;
+    for (std::size_t i = begin; i < end; ++i) {
+        if (!visible[i - begin]) {
+            continue;
+        }
+        const Meshlet &meshlet = meshlets[i];
+        if (!indexCounts->empty() && firstIndices->back() + indexCounts->back() == meshlet.firstIndex) {
+            indexCounts->back() += meshlet.numIndices;
+        }
+        else {
+            firstIndices->push_back(meshlet.firstIndex);
+            indexCounts->push_back(meshlet.numIndices);
+        }
+        numIndices += meshlet.numIndices;
+    }
+    return numIndices / 3;
+}
+
+// Bounding volume hierarchy (BVH) over the triangles of a mesh, for ray
+// queries. The nodes are stored depth-first, so that the left child of
+// an inner node directly follows it. Each leaf holds a range of
+// triangles, whose vertices are copied into the BVH in leaf order, so
+// that queries need no access to the mesh.
+struct BVHNode {
+    glm::vec3 boundsMin;
+    std::uint32_t first;  // right child (inner node) or first triangle (leaf)
+    glm::vec3 boundsMax;
+    std::uint32_t count;  // number of triangles (0 for inner nodes)
+};
+
+struct MeshBVH {
+    std::vector<BVHNode> nodes;
+    std::vector<glm::vec3> vertices;  // three per triangle, in leaf order
+    std::vector<std::uint32_t> triangles;  // mesh triangle of each leaf triangle
+};
+
+// Closest intersection of a ray with a mesh
+struct RayHit {
+    std::uint32_t triangle;  // index of the first triangle index divided by three
+    float t;  // distance along the ray (in units of the ray direction)
+    glm::vec3 barycentrics;  // weights of the three triangle vertices
+    glm::vec3 position;
+};
+
+namespace {
+const int BVH_NUM_BINS = 16;
+const std::uint32_t BVH_MAX_LEAF_SIZE = 8;
+
+struct BVHBuildContext {
+    const glm::vec3 *boundsMin;  // per triangle
+    const glm::vec3 *boundsMax;
+    const glm::vec3 *centroids;
+    std::uint32_t *triangles;
+};
+
+float bvhSurfaceArea(const glm::vec3 &boundsMin, const glm::vec3 &boundsMax)
+{
+    glm::vec3 d = glm::max(boundsMax - boundsMin, glm::vec3(0.0f));
+    return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+}
+
+// Builds the subtree of the triangles [begin, end) of the build context
+// (which it partitions in place) into nodes, with the right child
+// indices relative to the node. The two subtrees of large nodes near the
+// root are built in parallel.
+void bvhBuildRecursive(const BVHBuildContext &ctx, std::uint32_t begin, std::uint32_t end,
+                       int parallelDepth, std::vector<BVHNode> *nodes)
+{
+    BVHNode node;
+    node.boundsMin = glm::vec3(HUGE_VALF);
+    node.boundsMax = glm::vec3(-HUGE_VALF);
+    glm::vec3 centroidMin(HUGE_VALF), centroidMax(-HUGE_VALF);
+    for (std::uint32_t i = begin; i < end; ++i) {
+        std::uint32_t t = ctx.triangles[i];
+        node.boundsMin = glm::min(node.boundsMin, ctx.boundsMin[t]);
+        node.boundsMax = glm::max(node.boundsMax, ctx.boundsMax[t]);
+        centroidMin = glm::min(centroidMin, ctx.centroids[t]);
+        centroidMax = glm::max(centroidMax, ctx.centroids[t]);
+    }
+    std::uint32_t count = end - begin;
+    node.first = begin;
+    node.count = count;
+
+    // Finds the split with the lowest surface area heuristic (SAH) cost,
+    // over binned centroid positions along the three axes
+    int bestAxis = -1, bestBin = 0;
+    float bestCost = HUGE_VALF;
+    glm::vec3 extent = centroidMax - centroidMin;
+    if (count > 2) {
+        for (int axis = 0; axis < 3; ++axis) {
+            if (!(extent[axis] > 0.0f)) {
+                continue;
+            }
+            float scale = BVH_NUM_BINS / extent[axis];
+            glm::vec3 binMin[BVH_NUM_BINS], binMax[BVH_NUM_BINS];
+            std::uint32_t binCount[BVH_NUM_BINS] = {};
+            for (int b = 0; b < BVH_NUM_BINS; ++b) {
+                binMin[b] = glm::vec3(HUGE_VALF);
+                binMax[b] = glm::vec3(-HUGE_VALF);
+            }
+            for (std::uint32_t i = begin; i < end; ++i) {
+                std::uint32_t t = ctx.triangles[i];
+                int b = std::min(int((ctx.centroids[t][axis] - centroidMin[axis]) * scale), BVH_NUM_BINS - 1);
+                binCount[b]++;
+                binMin[b] = glm::min(binMin[b], ctx.boundsMin[t]);
+                binMax[b] = glm::max(binMax[b], ctx.boundsMax[t]);
+            }
+            // Sweeps from the right to get the cost of the right sides
+            float rightArea[BVH_NUM_BINS];
+            std::uint32_t rightCount[BVH_NUM_BINS];
+            glm::vec3 sweepMin(HUGE_VALF), sweepMax(-HUGE_VALF);
+            std::uint32_t sweepCount = 0;
+            for (int b = BVH_NUM_BINS - 1; b > 0; --b) {
+                sweepMin = glm::min(sweepMin, binMin[b]);
+                sweepMax = glm::max(sweepMax, binMax[b]);
+                sweepCount += binCount[b];
+                rightArea[b] = bvhSurfaceArea(sweepMin, sweepMax);
+                rightCount[b] = sweepCount;
+            }
+            sweepMin = glm::vec3(HUGE_VALF);
+            sweepMax = glm::vec3(-HUGE_VALF);
+            sweepCount = 0;
+            for (int b = 0; b < BVH_NUM_BINS - 1; ++b) {
+                sweepMin = glm::min(sweepMin, binMin[b]);
+                sweepMax = glm::max(sweepMax, binMax[b]);
+                sweepCount += binCount[b];
+                if (sweepCount == 0 || rightCount[b + 1] == 0) {
+                    continue;
+                }
+                float cost = bvhSurfaceArea(sweepMin, sweepMax) * sweepCount +
+                             rightArea[b + 1] * rightCount[b + 1];
+                if (cost < bestCost) {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestBin = b;
+                }
+            }
+        }
+    }
+
+    // Makes a leaf if splitting does not pay off (relative to the cost
+    // of intersecting all triangles, with one triangle test as the
+    // cost of a node traversal)
+    float leafCost = bvhSurfaceArea(node.boundsMin, node.boundsMax) * (float(count) - 1.0f);
+    if (count <= 2 || (count <= BVH_MAX_LEAF_SIZE && bestCost >= leafCost)) {
+        nodes->push_back(node);
+        return;
+    }
+
+    std::uint32_t middle = begin + count / 2;
+    if (bestAxis >= 0) {
+        float scale = BVH_NUM_BINS / extent[bestAxis];
+        std::uint32_t *split = std::partition(ctx.triangles + begin, ctx.triangles + end, [&](std::uint32_t t) {
+            int b = std::min(int((ctx.centroids[t][bestAxis] - centroidMin[bestAxis]) * scale), BVH_NUM_BINS - 1);
+            return b <= bestBin;
+        });
+        middle = std::uint32_t(split - ctx.triangles);
+    }
+    if (middle == begin || middle == end) {
+        // Coincident centroids: splits in the middle
+        middle = begin + count / 2;
+    }
+
+    node.count = 0;
+    std::vector<BVHNode> right;
+    nodes->push_back(node);
+    std::size_t parent = nodes->size() - 1;
+    if (parallelDepth > 0 && count > 16 * 1024) {
+        std::thread thread(bvhBuildRecursive, std::cref(ctx), middle, end, parallelDepth - 1, &right);
+        bvhBuildRecursive(ctx, begin, middle, parallelDepth - 1, nodes);
+        thread.join();
+    }
+    else {
+        bvhBuildRecursive(ctx, begin, middle, parallelDepth - 1, nodes);
+        bvhBuildRecursive(ctx, middle, end, parallelDepth - 1, &right);
+    }
+    (*nodes)[parent].first = std::uint32_t(nodes->size() - parent);
+    nodes->insert(nodes->end(), right.begin(), right.end());
+}
+
+// Slab test of a ray against a box. Returns the entry distance, or
+// HUGE_VALF if the ray misses the box before tMax.
+inline float bvhIntersectBox(const glm::vec3 &origin, const glm::vec3 &invDirection,
+                             const glm::vec3 &boundsMin, const glm::vec3 &boundsMax, float tMax)
+{
+    glm::vec3 t0 = (boundsMin - origin) * invDirection;
+    glm::vec3 t1 = (boundsMax - origin) * invDirection;
+    glm::vec3 tNear = glm::min(t0, t1), tFar = glm::max(t0, t1);
+    float entry = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+    float exit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, tMax));
+    return (entry <= exit) ? entry : HUGE_VALF;
+}
+} // namespace
+
+// Builds a BVH over the triangles of a mesh, with binned SAH splits.
+// The subtrees near the root are built in parallel.
+void buildMeshBVH(const glm::vec3 *vertices, const std::uint32_t *indices, std::size_t numIndices,
+                  MeshBVH *bvh)
+{
+    std::size_t numTriangles = numIndices / 3;
+    std::vector<glm::vec3> boundsMin(numTriangles), boundsMax(numTriangles), centroids(numTriangles);
+    meshParallelFor(numTriangles, 64 * 1024, [&](std::size_t begin, std::size_t end) {
+        for (std::size_t t = begin; t < end; ++t) {
+            const glm::vec3 &v0 = vertices[indices[3 * t]];
+            const glm::vec3 &v1 = vertices[indices[3 * t + 1]];
+            const glm::vec3 &v2 = vertices[indices[3 * t + 2]];
+            boundsMin[t] = glm::min(glm::min(v0, v1), v2);
+            boundsMax[t] = glm::max(glm::max(v0, v1), v2);
+            centroids[t] = 0.5f * (boundsMin[t] + boundsMax[t]);
+        }
+    });
+    bvh->triangles.resize(numTriangles);
+    for (std::size_t t = 0; t < numTriangles; ++t) {
+        bvh->triangles[t] = std::uint32_t(t);
+    }
+
+    int parallelDepth = 0;
+    while ((1u << parallelDepth) < std::thread::hardware_concurrency()) {
+        parallelDepth++;
+    }
+    BVHBuildContext ctx = { boundsMin.data(), boundsMax.data(), centroids.data(), bvh->triangles.data() };
+    bvh->nodes.clear();
+    if (numTriangles > 0) {
+        bvhBuildRecursive(ctx, 0, std::uint32_t(numTriangles), parallelDepth, &(bvh->nodes));
+    }
+
+    // Makes the right child indices absolute, and copies the vertices
+    for (std::size_t i = 0; i < bvh->nodes.size(); ++i) {
+        if (bvh->nodes[i].count == 0) {
+            bvh->nodes[i].first += std::uint32_t(i);
+        }
+    }
+    bvh->vertices.resize(3 * numTriangles);
+    meshParallelFor(numTriangles, 64 * 1024, [&](std::size_t begin, std::size_t end) {
+        for (std::size_t i = begin; i < end; ++i) {
+            for (int k = 0; k < 3; ++k) {
+                bvh->vertices[3 * i + k] = vertices[indices[3 * bvh->triangles[i] + k]];
+            }
+        }
+    });
+}
+
+// Intersects a ray with the triangles of a BVH (from both sides), and
+// returns the closest hit in hit. Returns false if the ray misses.
+bool intersectMeshBVH(const MeshBVH &bvh, const glm::vec3 &origin, const glm::vec3 &direction,
+                      RayHit *hit)
+{
+    if (bvh.nodes.empty()) {
+        return false;
+    }
+    glm::vec3 invDirection = 1.0f / direction;
+    float tMax = HUGE_VALF;
+    std::uint32_t hitIndex = 0;
+    float hitU = 0.0f, hitV = 0.0f;
+    std::uint32_t stack[64];
+    int stackSize = 0;
+    std::uint32_t nodeIndex = 0;
+    if (bvhIntersectBox(origin, invDirection, bvh.nodes[0].boundsMin, bvh.nodes[0].boundsMax, tMax) == HUGE_VALF) {
+        return false;
+    }
+    while (true) {
+        const BVHNode &node = bvh.nodes[nodeIndex];
+        if (node.count > 0) {
+            // Moller-Trumbore ray-triangle intersection
+            for (std::uint32_t i = node.first; i < node.first + node.count; ++i) {
+                const glm::vec3 &v0 = bvh.vertices[3 * i];
+                glm::vec3 e1 = bvh.vertices[3 * i + 1] - v0;
+                glm::vec3 e2 = bvh.vertices[3 * i + 2] - v0;
+                glm::vec3 p = glm::cross(direction, e2);
+                float det = glm::dot(e1, p);
+                if (det == 0.0f) {
+                    continue;
+                }
+                float invDet = 1.0f / det;
+                glm::vec3 s = origin - v0;
+                float u = glm::dot(s, p) * invDet;
+                if (u < 0.0f || u > 1.0f) {
+                    continue;
+                }
+                glm::vec3 q = glm::cross(s, e1);
+                float v = glm::dot(direction, q) * invDet;
+                if (v < 0.0f || u + v > 1.0f) {
+                    continue;
+                }
+                float t = glm::dot(e2, q) * invDet;
+                if (t > 0.0f && t < tMax) {
+                    tMax = t;
+                    hitIndex = i;
+                    hitU = u;
+                    hitV = v;
+                }
+            }
+        }
+        else {
+            // Visits the nearer child first
+            std::uint32_t left = nodeIndex + 1, right = node.first;
+            float tLeft = bvhIntersectBox(origin, invDirection, bvh.nodes[left].boundsMin,
+                                          bvh.nodes[left].boundsMax, tMax);
+            float tRight = bvhIntersectBox(origin, invDirection, bvh.nodes[right].boundsMin,
+                                           bvh.nodes[right].boundsMax, tMax);
+            if (tLeft > tRight) {
+                std::swap(tLeft, tRight);
+                std::swap(left, right);
+            }
+            if (tLeft != HUGE_VALF) {
+                if (tRight != HUGE_VALF && stackSize < 64) {
+                    stack[stackSize++] = right;
+                }
+                nodeIndex = left;
+                continue;
+            }
+        }
+        if (stackSize == 0) {
+            break;
+        }
+        nodeIndex = stack[--stackSize];
+    }
+    if (tMax == HUGE_VALF) {
+        return false;
+    }
+
+    hit->triangle = bvh.triangles[hitIndex];
+    hit->t = tMax;
+    hit->barycentrics = glm::vec3(1.0f - hitU - hitV, hitU, hitV);
+    hit->position = origin + tMax * direction;
+    return true;
+}
+
+// Axis-aligned bounding boxes of the objects of a scene, stored as a
+// structure of arrays so that the boxes can be tested four at a time.
+// The arrays are padded to a multiple of four with empty boxes.
+struct SceneBounds {
+    std::vector<float> minX, minY, minZ;
+    std::vector<float> maxX, maxY, maxZ;
+    std::size_t numObjects = 0;
+};
+
+// Adds the bounding box of an object to a scene
+void sceneBoundsAdd(SceneBounds *scene, const glm::vec3 &boundsMin, const glm::vec3 &boundsMax)
+{
+    std::size_t i = scene->numObjects++;
+    if (i == scene->minX.size()) {
+        std::size_t size = i + 4;
+        for (std::vector<float> *v : { &scene->minX, &scene->minY, &scene->minZ }) {
+            v->resize(size, HUGE_VALF);
+        }
+        for (std::vector<float> *v : { &scene->maxX, &scene->maxY, &scene->maxZ }) {
+            v->resize(size, -HUGE_VALF);
+        }
+    }
+    scene->minX[i] = boundsMin.x;
+    scene->minY[i] = boundsMin.y;
+    scene->minZ[i] = boundsMin.z;
+    scene->maxX[i] = boundsMax.x;
+    scene->maxY[i] = boundsMax.y;
+    scene->maxZ[i] = boundsMax.z;
+}
+
+// Computes the bounding box of a transformed bounding box
+void transformBounds(const glm::mat4 &transform, const glm::vec3 &boundsMin,
+                     const glm::vec3 &boundsMax, glm::vec3 *transformedMin,
+                     glm::vec3 *transformedMax)
+{
+    glm::vec4 center = transform * glm::vec4(0.5f * (boundsMin + boundsMax), 1.0f);
+    glm::vec3 extent = 0.5f * (boundsMax - boundsMin);
+    glm::vec3 radius(0.0f);
+    for (int i = 0; i < 3; ++i) {
+        for (int k = 0; k < 3; ++k) {
+            radius[i] += std::fabs(transform[k][i]) * extent[k];
+        }
+    }
+    *transformedMin = glm::vec3(center.x, center.y, center.z) - radius;
+    *transformedMax = glm::vec3(center.x, center.y, center.z) + radius;
+}
+
+// Tests the bounding boxes of a scene against the view frustum (given by
+// its planes, e.g., from frustumPlanes), in parallel and four boxes at
+// a time. Sets visible[i] to 1 if box i intersects the frustum, and to
+// 0 otherwise. Returns the number of visible boxes.
+std::size_t cullSceneFrustum(const SceneBounds &scene, const glm::vec4 planes[6],
+                             std::vector<std::uint8_t> *visible)
+{
+    // Each plane is tested against the corner of a box that is farthest
+    // along its normal, which is selected once per plane
+    visible->assign(scene.minX.size(), 0);
+    std::atomic<std::size_t> numVisible(0);
+    meshParallelFor(scene.minX.size() / 4, 1024, [&](std::size_t begin, std::size_t end) {
+        std::size_t count = 0;
+        for (std::size_t block = begin; block < end; ++block) {
+            std::size_t i = 4 * block;
+#ifdef __SSE2__
+            __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+            for (int p = 0; p < 6; ++p) {
+                const glm::vec4 &plane = planes[p];
+                __m128 x = _mm_loadu_ps(&(plane.x > 0.0f ? scene.maxX : scene.minX)[i]);
+                __m128 y = _mm_loadu_ps(&(plane.y > 0.0f ? scene.maxY : scene.minY)[i]);
+                __m128 z = _mm_loadu_ps(&(plane.z > 0.0f ? scene.maxZ : scene.minZ)[i]);
+                __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(plane.x)),
+                                                        _mm_mul_ps(y, _mm_set1_ps(plane.y))),
+                                             _mm_add_ps(_mm_mul_ps(z, _mm_set1_ps(plane.z)),
+                                                        _mm_set1_ps(plane.w)));
+                inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, _mm_setzero_ps()));
+            }
+            int mask = _mm_movemask_ps(inside);
+            for (int k = 0; k < 4; ++k) {
+                (*visible)[i + k] = (mask >> k) & 1;
+            }
+#else
+            for (int k = 0; k < 4; ++k) {
+                bool inside = true;
+                for (int p = 0; p < 6 && inside; ++p) {
+                    const glm::vec4 &plane = planes[p];
+                    float x = (plane.x > 0.0f ? scene.maxX : scene.minX)[i + k];
+                    float y = (plane.y > 0.0f ? scene.maxY : scene.minY)[i + k];
+                    float z = (plane.z > 0.0f ? scene.maxZ : scene.minZ)[i + k];
+                    inside = plane.x * x + plane.y * y + plane.z * z + plane.w >= 0.0f;
+                }
+                (*visible)[i + k] = inside;
+            }
+#endif
+            for (int k = 0; k < 4; ++k) {
+                count += (*visible)[i + k];
+            }
+        }
+        numVisible += count;
+    });
+    visible->resize(scene.numObjects);
+    return numVisible;
+}
+
+// Low-resolution depth buffer of occluders, rasterized on the CPU, for
+// hierarchical occlusion culling. Every level after the first stores the
+// farthest depth of 2x2 texels of the previous level. Depths are window
+// depths in [0, 1].
+struct OcclusionBuffer {
+    std::vector<glm::ivec2> sizes;
+    std::vector<std::vector<float>> levels;
+};
+
+// Clears an occlusion buffer of width x height texels to the far plane
+void occlusionBufferClear(OcclusionBuffer *buffer, int width, int height)
+{
+    buffer->sizes.assign(1, glm::ivec2(width, height));
+    buffer->levels.resize(1);
+    buffer->levels[0].assign(std::size_t(width) * height, 1.0f);
+}
+
+// Rasterizes the front-facing triangles of an occluder mesh (transformed
+// by mvp) into level 0 of an occlusion buffer. Triangles that cross the
+// near plane are skipped, which only makes the buffer less occluding.
+// Depths are interpolated per texel center, so the buffer is accurate to
+// about one texel at the silhouettes of the occluders.
+void occlusionBufferRasterize(OcclusionBuffer *buffer, const glm::mat4 &mvp,
+                              const glm::vec3 *vertices, const std::uint32_t *indices,
+                              std::size_t numIndices)
+{
+    int width = buffer->sizes[0].x, height = buffer->sizes[0].y;
+    std::vector<float> &depth = buffer->levels[0];
+    for (std::size_t t = 0; t + 2 < numIndices; t += 3) {
+        glm::vec3 window[3];
+        bool clipped = false;
+        for (int k = 0; k < 3; ++k) {
+            glm::vec4 clip = mvp * glm::vec4(vertices[indices[t + k]], 1.0f);
+            if (clip.w < 1e-5f || clip.z < -clip.w) {
+                clipped = true;
+                break;
+            }
+            float invW = 1.0f / clip.w;
+            window[k] = glm::vec3((clip.x * invW * 0.5f + 0.5f) * width,
+                                  (clip.y * invW * 0.5f + 0.5f) * height,
+                                  clip.z * invW * 0.5f + 0.5f);
+        }
+        if (clipped) {
+            continue;
+        }
+        glm::vec3 e1 = window[1] - window[0], e2 = window[2] - window[0];
+        float area = e1.x * e2.y - e1.y * e2.x;
+        if (!(area > 0.0f)) {
+            continue;
+        }
+
+        // Pixel centers inside the triangle, by the signs of the edge
+        // functions (normalized to barycentrics)
+        int x0 = std::max(int(std::floor(std::min(std::min(window[0].x, window[1].x), window[2].x))), 0);
+        int x1 = std::min(int(std::ceil(std::max(std::max(window[0].x, window[1].x), window[2].x))), width - 1);
+        int y0 = std::max(int(std::floor(std::min(std::min(window[0].y, window[1].y), window[2].y))), 0);
+        int y1 = std::min(int(std::ceil(std::max(std::max(window[0].y, window[1].y), window[2].y))), height - 1);
+        float invArea = 1.0f / area;
+        for (int y = y0; y <= y1; ++y) {
+            float py = y + 0.5f;
+            for (int x = x0; x <= x1; ++x) {
+                float px = x + 0.5f;
+                float b1 = ((px - window[0].x) * e2.y - (py - window[0].y) * e2.x) * invArea;
+                float b2 = (e1.x * (py - window[0].y) - e1.y * (px - window[0].x)) * invArea;
+                if (b1 < 0.0f || b2 < 0.0f || b1 + b2 > 1.0f) {
+                    continue;
+                }
+                float z = window[0].z + b1 * e1.z + b2 * e2.z;
+                float &d = depth[std::size_t(y) * width + x];
+                d = std::min(d, z);
+            }
+        }
+    }
+}
+
+// Shrinks the occluders in level 0 of an occlusion buffer by radius
+// texels: every texel takes the farthest depth within radius texels
+// (the far plane outside of the buffer). This makes up for occluders that
+// cover slightly more than the objects they stand for, such as
+// simplified meshes, and for coverage sampled at texel centers.
+void occlusionBufferErode(OcclusionBuffer *buffer, int radius)
+{
+    if (radius <= 0) {
+        return;
+    }
+    int width = buffer->sizes[0].x, height = buffer->sizes[0].y;
+    std::vector<float> &depth = buffer->levels[0];
+    std::vector<float> rows(depth.size());
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            float d = (x < radius || x + radius >= width) ? 1.0f : 0.0f;
+            for (int i = std::max(x - radius, 0); i <= std::min(x + radius, width - 1); ++i) {
+                d = std::max(d, depth[std::size_t(y) * width + i]);
+            }
+            rows[std::size_t(y) * width + x] = d;
+        }
+    }
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            float d = (y < radius || y + radius >= height) ? 1.0f : 0.0f;
+            for (int j = std::max(y - radius, 0); j <= std::min(y + radius, height - 1); ++j) {
+                d = std::max(d, rows[std::size_t(j) * width + x]);
+            }
+            depth[std::size_t(y) * width + x] = d;
+        }
+    }
+}
+
+// Builds the levels of an occlusion buffer after the occluders have been
+// rasterized into level 0
+void occlusionBufferBuildHierarchy(OcclusionBuffer *buffer)
+{
+    buffer->sizes.resize(1);
+    buffer->levels.resize(1);
+    while (buffer->sizes.back().x > 1 || buffer->sizes.back().y > 1) {
+        glm::ivec2 size = buffer->sizes.back();
+        glm::ivec2 next((size.x + 1) / 2, (size.y + 1) / 2);
+        std::vector<float> level(std::size_t(next.x) * next.y);
+        const std::vector<float> &previous = buffer->levels.back();
+        for (int y = 0; y < next.y; ++y) {
+            for (int x = 0; x < next.x; ++x) {
+                int xs[2] = { 2 * x, std::min(2 * x + 1, size.x - 1) };
+                int ys[2] = { 2 * y, std::min(2 * y + 1, size.y - 1) };
+                float d = 0.0f;
+                for (int j = 0; j < 2; ++j) {
+                    for (int i = 0; i < 2; ++i) {
+                        d = std::max(d, previous[std::size_t(ys[j]) * size.x + xs[i]]);
+                    }
+                }
+                level[std::size_t(y) * next.x + x] = d;
+            }
+        }
+        buffer->sizes.push_back(next);
+        buffer->levels.push_back(std::move(level));
+    }
+}
+
+// Tests a bounding box (transformed by mvp) against an occlusion buffer.
+// Returns true if the box is hidden behind the occluders, i.e., its
+// nearest depth is farther than the occluders over its whole screen
+// rectangle. The rectangle is tested at the level where it covers at
+// most 2x2 texels.
+bool occlusionBufferTestBounds(const OcclusionBuffer &buffer, const glm::mat4 &mvp,
+                               const glm::vec3 &boundsMin, const glm::vec3 &boundsMax)
+{
+    int width = buffer.sizes[0].x, height = buffer.sizes[0].y;
+    float minX = HUGE_VALF, minY = HUGE_VALF, minZ = HUGE_VALF;
+    float maxX = -HUGE_VALF, maxY = -HUGE_VALF;
+    for (int corner = 0; corner < 8; ++corner) {
+        glm::vec3 p((corner & 1) ? boundsMax.x : boundsMin.x,
+                    (corner & 2) ? boundsMax.y : boundsMin.y,
+                    (corner & 4) ? boundsMax.z : boundsMin.z);
+        glm::vec4 clip = mvp * glm::vec4(p, 1.0f);
+        if (clip.w < 1e-5f || clip.z < -clip.w) {
+            return false;  // crosses the near plane
+        }
+        float invW = 1.0f / clip.w;
+        float x = (clip.x * invW * 0.5f + 0.5f) * width;
+        float y = (clip.y * invW * 0.5f + 0.5f) * height;
+        minX = std::min(minX, x);
+        maxX = std::max(maxX, x);
+        minY = std::min(minY, y);
+        maxY = std::max(maxY, y);
+        minZ = std::min(minZ, clip.z * invW * 0.5f + 0.5f);
+    }
+    int x0 = std::max(int(std::floor(minX)), 0), x1 = std::min(int(std::floor(maxX)), width - 1);
+    int y0 = std::max(int(std::floor(minY)), 0), y1 = std::min(int(std::floor(maxY)), height - 1);
+    if (x0 > x1 || y0 > y1) {
+        return false;  // outside of the buffer, left to frustum culling
+    }
+
+    std::size_t level = 0;
+    while (level + 1 < buffer.levels.size() && ((x1 >> level) - (x0 >> level) > 1 ||
+                                                (y1 >> level) - (y0 >> level) > 1)) {
+        level++;
+    }
+    const std::vector<float> &depth = buffer.levels[level];
+    int levelWidth = buffer.sizes[level].x;
+    for (int y = y0 >> level; y <= (y1 >> level); ++y) {
+        for (int x = x0 >> level; x <= (x1 >> level); ++x) {
+            if (depth[std::size_t(y) * levelWidth + x] >= minZ) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
@@ -26,20 +26,35 @@ bool specularToggle = true;
 bool gammaToggle = false;
 bool normalToggle = false;
 bool cubemapToggle = false;
+bool cullingToggle = true;
+bool ggxToggle = false;
 float zoom = 45.0f;
 float shine = 2048.0f;
 
 // The attribute locations we will use in the vertex shader
 enum AttributeLocation {
     POSITION = 0,
-    NORMAL = 1
+    NORMAL = 1,
+    TEXCOORD = 2
 };
 
-// Struct for representing an indexed triangle mesh
+// Struct for representing an indexed triangle mesh. Meshes loaded from
+// a mesh cache keep the cache file mapped instead of filling the vectors.
 struct Mesh {
     std::vector<glm::vec3> vertices;
     std::vector<glm::vec3> normals;
     std::vector<uint32_t> indices;
+    MeshCache cache;
+};
+
+// Vertex layout options of a MeshVAO
+enum MeshVAOFlags {
+    MESH_VAO_QUANTIZED = 1,  // vertices in the QuantizedMesh format
+    MESH_VAO_INTERLEAVED = 2,  // all vertex attributes in vertexVBO
+    MESH_VAO_TEXCOORDS = 4,  // UV texture coordinates (interleaved only)
+    MESH_VAO_LODS = 8,  // chain of levels of detail in indexVBO
+    MESH_VAO_MESHLETS = 16,  // meshlets of every level, for culling
+    MESH_VAO_BVH = 32  // BVH of the full-resolution triangles, for picking
 };
 
 // Struct for representing a vertex array object (VAO) created from a
@@ -47,10 +62,19 @@ struct Mesh {
 struct MeshVAO {
     GLuint vao;
     GLuint vertexVBO;
-    GLuint normalVBO;
+    GLuint normalVBO;  // 0 for interleaved vertices
     GLuint indexVBO;
     int numVertices;
     int numIndices;
+    GLenum indexType;  // GL_UNSIGNED_INT or GL_UNSIGNED_SHORT
+    int flags;  // MeshVAOFlags
+    GLsizei stride;  // bytes per interleaved vertex
+    glm::vec3 positionOffset;
+    glm::vec3 positionScale;
+    MeshLODChain lods;  // levels of detail (without the indices)
+    std::vector<Meshlet> meshlets;
+    std::vector<std::size_t> lodFirstMeshlet;  // first meshlet of each level, and the total
+    MeshBVH bvh;  // triangles in the order of the index buffer
 };
 
 // Struct for resources and state
@@ -64,7 +88,16 @@ struct Context {
     Mesh mesh;
     MeshVAO meshVAO;
     GLuint defaultVAO;
+    int meshLOD;  // level of detail drawn in the last frame
+    int numTrianglesDrawn;  // in the last frame
+    int numTrianglesCulled;  // in the last frame
+    glm::mat4 model;  // matrices of the last frame, for picking
+    glm::mat4 mvp;
+    bool picked;  // result of the last pick
+    RayHit pick;
+    double pickTime;  // seconds
     GLuint cubemap;
+    double prefilterTime;  // seconds, 0 if the cubemap was prefiltered before
     float elapsed_time;
 };
 
@@ -113,50 +146,234 @@ std::string cubemapDir(void)
     return rootDir + "/model_viewer/cubemaps/";
 }
 
+// Loads a mesh from its mesh cache if that is up to date, and otherwise
+// from the OBJ file, optimizes its vertex order for rendering, and
+// writes the mesh cache
 void loadMesh(const std::string &filename, Mesh *mesh)
 {
+    meshCacheClose(&mesh->cache);
+    if (meshCacheOpen(&mesh->cache, filename)) {
+        mesh->vertices.clear();
+        mesh->normals.clear();
+        mesh->indices.clear();
+        return;
+    }
+
+    // A mesh that fails to load is left empty, and not cached
     OBJMesh obj_mesh;
-    objMeshLoad(obj_mesh, filename);
+    if (objMeshLoad(obj_mesh, filename)) {
+        optimizeMeshVertexOrder(obj_mesh);
+        meshCacheWrite(obj_mesh, filename);
+    }
+    else {
+        obj_mesh = OBJMesh();
+    }
     mesh->vertices = obj_mesh.vertices;
     mesh->normals = obj_mesh.normals;
     mesh->indices = obj_mesh.indices;
 }
 
-void createMeshVAO(Context &ctx, const Mesh &mesh, MeshVAO *meshVAO)
+// Creates a vertex array object (VAO) for drawing a mesh from the
+// vertex, normal, and index VBOs of meshVAO. Quantized vertices are
+// passed as normalized integers and decoded by the vertex shader.
+// Interleaved vertices store the position, normal, and texture
+// coordinates of a vertex one after the other in vertexVBO.
+void createMeshVertexArray(Context &ctx, MeshVAO *meshVAO)
+{
+    bool quantized = (meshVAO->flags & MESH_VAO_QUANTIZED) != 0;
+    bool interleaved = (meshVAO->flags & MESH_VAO_INTERLEAVED) != 0;
+    std::size_t positionSize = quantized ? 4 * sizeof(std::uint16_t) : sizeof(glm::vec3);
+    std::size_t normalSize = quantized ? 2 * sizeof(std::int16_t) : sizeof(glm::vec3);
+    GLsizei stride = interleaved ? meshVAO->stride : 0;
+    const GLvoid *normalOffset = reinterpret_cast<const GLvoid *>(interleaved ? positionSize : 0);
+
+    glGenVertexArrays(1, &(meshVAO->vao));
+    glBindVertexArray(meshVAO->vao);
+    glBindBuffer(GL_ARRAY_BUFFER, meshVAO->vertexVBO);
+    glEnableVertexAttribArray(POSITION);
+    if (quantized) {
+        glVertexAttribPointer(POSITION, 4, GL_UNSIGNED_SHORT, GL_TRUE, stride, nullptr);
+    }
+    else {
+        glVertexAttribPointer(POSITION, 3, GL_FLOAT, GL_FALSE, stride, nullptr);
+    }
+    if (!interleaved) {
+        glBindBuffer(GL_ARRAY_BUFFER, meshVAO->normalVBO);
+    }
+    glEnableVertexAttribArray(NORMAL);
+    if (quantized) {
+        glVertexAttribPointer(NORMAL, 2, GL_SHORT, GL_TRUE, stride, normalOffset);
+    }
+    else {
+        glVertexAttribPointer(NORMAL, 3, GL_FLOAT, GL_FALSE, stride, normalOffset);
+    }
+    if ((meshVAO->flags & MESH_VAO_TEXCOORDS) != 0) {
+        const GLvoid *texcoordOffset = reinterpret_cast<const GLvoid *>(positionSize + normalSize);
+        glEnableVertexAttribArray(TEXCOORD);
+        glVertexAttribPointer(TEXCOORD, 2, GL_FLOAT, GL_FALSE, stride, texcoordOffset);
+    }
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, meshVAO->indexVBO);
+    glBindVertexArray(ctx.defaultVAO); // unbinds the VAO
+}
+
+// Creates a VAO from arrays of vertices, normals, and indices, with the
+// vertex layout given by flags (MeshVAOFlags). Texture coordinates are
+// optional, and always interleaved.
+void createMeshVAO(Context &ctx, const glm::vec3 *vertices, const glm::vec3 *normals,
+                   const glm::vec2 *texcoords, std::size_t numVertices, const uint32_t *indices,
+                   std::size_t numIndices, MeshVAO *meshVAO, int flags)
 {
+    flags &= ~MESH_VAO_TEXCOORDS;
+    if (texcoords != nullptr) {
+        flags |= MESH_VAO_INTERLEAVED | MESH_VAO_TEXCOORDS;
+    }
+    // The levels of detail are stored one after the other in the index
+    // buffer, starting with the full-resolution mesh
+    meshVAO->lods = MeshLODChain();
+    std::size_t numFullIndices = numIndices;
+    if ((flags & MESH_VAO_LODS) != 0) {
+        buildMeshLODChain(vertices, numVertices, indices, numIndices, 5, &(meshVAO->lods));
+        indices = meshVAO->lods.indices.data();
+        numIndices = meshVAO->lods.indices.size();
+    }
+
+    // Meshlets of every level of detail, for culling. The triangles of
+    // each level are reordered into the meshlets.
+    meshVAO->meshlets.clear();
+    meshVAO->lodFirstMeshlet.clear();
+    std::vector<std::uint32_t> meshletIndices;
+    if ((flags & MESH_VAO_MESHLETS) != 0) {
+        meshletIndices.assign(indices, indices + numIndices);
+        std::vector<std::size_t> levels = meshVAO->lods.offsets;
+        if (levels.empty()) {
+            levels = { 0, numIndices };
+        }
+        for (std::size_t l = 0; l + 1 < levels.size(); ++l) {
+            meshVAO->lodFirstMeshlet.push_back(meshVAO->meshlets.size());
+            buildMeshlets(vertices, numVertices, meshletIndices.data(), levels[l],
+                          levels[l + 1] - levels[l], &(meshVAO->meshlets));
+        }
+        meshVAO->lodFirstMeshlet.push_back(meshVAO->meshlets.size());
+        indices = meshletIndices.data();
+    }
+
+    // BVH of the full-resolution level, for picking
+    meshVAO->bvh = MeshBVH();
+    if ((flags & MESH_VAO_BVH) != 0) {
+        buildMeshBVH(vertices, indices, numFullIndices, &(meshVAO->bvh));
+    }
+
+    bool quantized = (flags & MESH_VAO_QUANTIZED) != 0;
+    std::size_t positionSize = quantized ? 4 * sizeof(std::uint16_t) : sizeof(glm::vec3);
+    std::size_t normalSize = quantized ? 2 * sizeof(std::int16_t) : sizeof(glm::vec3);
+    const void *vertexData = vertices;
+    const void *normalData = normals;
+    const void *indexData = indices;
+    auto verticesNBytes = numVertices * positionSize;
+    auto normalsNBytes = numVertices * normalSize;
+    auto indicesNBytes = numIndices * sizeof(indices[0]);
+    meshVAO->indexType = GL_UNSIGNED_INT;
+    meshVAO->flags = flags;
+    meshVAO->stride = 0;
+    meshVAO->positionOffset = glm::vec3(0.0f);
+    meshVAO->positionScale = glm::vec3(1.0f);
+    QuantizedMesh compact;
+    if (quantized) {
+        quantizeMesh(vertices, normals, numVertices, indices, numIndices, &compact);
+        vertexData = compact.positions.data();
+        normalData = compact.normals.data();
+        if (!compact.indices16.empty()) {
+            indexData = compact.indices16.data();
+            indicesNBytes = compact.indices16.size() * sizeof(compact.indices16[0]);
+            meshVAO->indexType = GL_UNSIGNED_SHORT;
+        }
+        meshVAO->positionOffset = compact.positionOffset;
+        meshVAO->positionScale = compact.positionScale;
+    }
+    std::vector<std::uint8_t> interleaved;
+    if ((flags & MESH_VAO_INTERLEAVED) != 0) {
+        std::vector<VertexAttributeArray> attributes = {
+            { vertexData, positionSize }, { normalData, normalSize } };
+        if (texcoords != nullptr) {
+            attributes.push_back({ texcoords, sizeof(glm::vec2) });
+        }
+        meshVAO->stride = interleaveVertexAttributes(attributes, numVertices, 4, &interleaved);
+        vertexData = interleaved.data();
+        verticesNBytes = interleaved.size();
+    }
+
     // Generates and populates a VBO for the vertices
     glGenBuffers(1, &(meshVAO->vertexVBO));
     glBindBuffer(GL_ARRAY_BUFFER, meshVAO->vertexVBO);
-    auto verticesNBytes = mesh.vertices.size() * sizeof(mesh.vertices[0]);
-    glBufferData(GL_ARRAY_BUFFER, verticesNBytes, mesh.vertices.data(), GL_STATIC_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, verticesNBytes, vertexData, GL_STATIC_DRAW);
 
     // Generates and populates a VBO for the vertex normals
-    glGenBuffers(1, &(meshVAO->normalVBO));
-    glBindBuffer(GL_ARRAY_BUFFER, meshVAO->normalVBO);
-    auto normalsNBytes = mesh.normals.size() * sizeof(mesh.normals[0]);
-    glBufferData(GL_ARRAY_BUFFER, normalsNBytes, mesh.normals.data(), GL_STATIC_DRAW);
+    meshVAO->normalVBO = 0;
+    if ((flags & MESH_VAO_INTERLEAVED) == 0) {
+        glGenBuffers(1, &(meshVAO->normalVBO));
+        glBindBuffer(GL_ARRAY_BUFFER, meshVAO->normalVBO);
+        glBufferData(GL_ARRAY_BUFFER, normalsNBytes, normalData, GL_STATIC_DRAW);
+    }
 
     // Generates and populates a VBO for the element indices
     glGenBuffers(1, &(meshVAO->indexVBO));
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, meshVAO->indexVBO);
-    auto indicesNBytes = mesh.indices.size() * sizeof(mesh.indices[0]);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indicesNBytes, mesh.indices.data(), GL_STATIC_DRAW);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indicesNBytes, indexData, GL_STATIC_DRAW);
 
-    // Creates a vertex array object (VAO) for drawing the mesh
-    glGenVertexArrays(1, &(meshVAO->vao));
-    glBindVertexArray(meshVAO->vao);
-    glBindBuffer(GL_ARRAY_BUFFER, meshVAO->vertexVBO);
-    glEnableVertexAttribArray(POSITION);
-    glVertexAttribPointer(POSITION, 3, GL_FLOAT, GL_FALSE, 0, nullptr);
-    glBindBuffer(GL_ARRAY_BUFFER, meshVAO->normalVBO);
-    glEnableVertexAttribArray(NORMAL);
-    glVertexAttribPointer(NORMAL, 3, GL_FLOAT, GL_FALSE, 0, nullptr);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, meshVAO->indexVBO);
-    glBindVertexArray(ctx.defaultVAO); // unbinds the VAO
+    createMeshVertexArray(ctx, meshVAO);
 
     // Additional information required by draw calls
-    meshVAO->numVertices = mesh.vertices.size();
-    meshVAO->numIndices = mesh.indices.size();
+    meshVAO->numVertices = numVertices;
+    meshVAO->numIndices = numFullIndices;
+    meshVAO->lods.indices = std::vector<std::uint32_t>();
+}
+
+void createMeshVAO(Context &ctx, const Mesh &mesh, MeshVAO *meshVAO, int flags = 0)
+{
+    // Meshes loaded from a mesh cache are uploaded straight from the
+    // mapped cache file
+    bool cached = (mesh.cache.vertices != nullptr);
+    std::size_t numVertices = cached ? mesh.cache.numVertices : mesh.vertices.size();
+    std::size_t numIndices = cached ? mesh.cache.numIndices : mesh.indices.size();
+    const glm::vec3 *vertices = cached ? mesh.cache.vertices : mesh.vertices.data();
+    const glm::vec3 *normals = cached ? mesh.cache.normals : mesh.normals.data();
+    const uint32_t *indices = cached ? mesh.cache.indices : mesh.indices.data();
+    createMeshVAO(ctx, vertices, normals, nullptr, numVertices, indices, numIndices, meshVAO, flags);
+}
+
+// Creates an interleaved VAO for a mesh with UV texture coordinates
+// (which are left out if the OBJ file does not have them for every
+// vertex). Normals are computed if there is not one for every vertex.
+void createMeshVAO(Context &ctx, const OBJMeshUV &mesh, MeshVAO *meshVAO, int flags = 0)
+{
+    std::vector<glm::vec2> texcoords;
+    if (mesh.texcoords.size() == mesh.vertices.size()) {
+        for (const glm::vec3 &texcoord : mesh.texcoords) {
+            texcoords.push_back(glm::vec2(texcoord.x, texcoord.y));
+        }
+    }
+    std::vector<glm::vec3> computedNormals;
+    const glm::vec3 *normals = mesh.normals.data();
+    if (mesh.normals.size() != mesh.vertices.size()) {
+        computeNormals(mesh.vertices, mesh.indices, &computedNormals);
+        normals = computedNormals.data();
+    }
+    createMeshVAO(ctx, mesh.vertices.data(), normals,
+                  texcoords.empty() ? nullptr : texcoords.data(), mesh.vertices.size(),
+                  mesh.indices.data(), mesh.indices.size(), meshVAO, flags | MESH_VAO_INTERLEAVED);
+}
+
+// Loads a mesh (from its mesh cache if that is up to date, see
+// loadMesh) and creates its VAO with the vertex layout given by flags
+// (see MeshVAOFlags). The layouts, levels of detail, meshlets, and BVH
+// are built on the CPU, from the mapped cache file or a CPU copy of the
+// mesh that is released after the upload.
+void loadMeshVAO(Context &ctx, const std::string &filename, MeshVAO *meshVAO, int flags = 0)
+{
+    Mesh mesh;
+    loadMesh(filename, &mesh);
+    createMeshVAO(ctx, mesh, meshVAO, flags);
+    meshCacheClose(&mesh.cache);
 }
 
 void initializeTrackball(Context &ctx)
@@ -172,11 +389,30 @@ void init(Context &ctx)
     ctx.program = loadShaderProgram(shaderDir() + "mesh.vert",
                                     shaderDir() + "mesh.frag");
 
-    loadMesh((modelDir() + "gargo.obj"), &ctx.mesh);
-    createMeshVAO(ctx, ctx.mesh, &ctx.meshVAO);
+    // Vertex layout of the mesh, with levels of detail, meshlets, and a
+    // BVH for picking
+    int flags = MESH_VAO_QUANTIZED | MESH_VAO_LODS | MESH_VAO_MESHLETS | MESH_VAO_BVH;
+    loadMeshVAO(ctx, (modelDir() + "gargo.obj"), &ctx.meshVAO, flags);
+
+    // Load the prefiltered cubemaps once as a single mipmap chain (level
+    // 0 is shininess 2048, and every level divides it by 4), so that the
+    // shader can select the level from the shininess. The chain is
+    // prefiltered from the cubemap on the first run.
+	/* Replace folder name for other available textures!:
+	-Forrest
+	-LarnacaCastle
+	-LarnacaCastle2
+	-RomeChurch
+	*/
+	ctx.cubemap = loadPrefilteredCubemap(cubemapDir() + "/Forrest", PREFILTER_PHONG, &ctx.prefilterTime);
 
-    // Load cubemap texture(s)
-	ctx.cubemap = loadCubemap(cubemapDir() + "/Forrest/");
+    ctx.meshLOD = 0;
+    ctx.numTrianglesDrawn = 0;
+    ctx.numTrianglesCulled = 0;
+    ctx.model = glm::mat4(1.0f);
+    ctx.mvp = glm::mat4(1.0f);
+    ctx.picked = false;
+    ctx.pickTime = 0.0;
 
     initializeTrackball(ctx);
 }
@@ -196,10 +432,12 @@ void drawMesh(Context &ctx, GLuint program, const MeshVAO &meshVAO)
 	);
 
     //glm::mat4 projection = glm::ortho(-ctx.aspect, ctx.aspect, -1.0f, 1.0f, -1.0f, 1.0f);
-	glm::mat4 projection = glm::perspective(glm::radians(45.0f /*zoom*/), 1.0f, 0.1f, 100.0f);
+	glm::mat4 projection = glm::perspective(glm::radians(zoom), 1.0f, 0.1f, 100.0f);
     
 	glm::mat4 mv = view * model;
     glm::mat4 mvp = projection * mv;
+    ctx.model = model;
+    ctx.mvp = mvp;
     
 	//Light 
 	glm::vec3 lightpos = glm::vec3(3.0, 0.0, 0.0); // Position of the light
@@ -213,39 +451,6 @@ void drawMesh(Context &ctx, GLuint program, const MeshVAO &meshVAO)
     glUseProgram(program);
 
     // Bind textures
-	
-	/* Replace folder name for other available textures!:
-	-Forrest
-	-LarnacaCastle
-	-LarnacaCastle2
-	-RomeChurch
-	*/
-
-	if (shine <= 0.125) {
-		ctx.cubemap = loadCubemap(cubemapDir() + "/Forrest/prefiltered/0.125");
-	}
-	else if (shine > 0.125 && shine <= 0.5) {
-		ctx.cubemap = loadCubemap(cubemapDir() + "/Forrest/prefiltered/0.5");
-	}
-	else if (shine > 0.5 && shine <= 2) {
-		ctx.cubemap = loadCubemap(cubemapDir() + "/Forrest/prefiltered/2");
-	}
-	else if (shine > 2 && shine <= 8) {
-		ctx.cubemap = loadCubemap(cubemapDir() + "/Forrest/prefiltered/8");
-	}
-	else if (shine > 8 && shine <= 32) {
-		ctx.cubemap = loadCubemap(cubemapDir() + "/Forrest/prefiltered/32");
-	}
-	else if (shine > 32 && shine <= 128) {
-		ctx.cubemap = loadCubemap(cubemapDir() + "/Forrest/prefiltered/128");
-	}
-	else if (shine > 128 && shine <= 512) {
-		ctx.cubemap = loadCubemap(cubemapDir() + "/Forrest/prefiltered/512");
-	}
-	else if (shine > 512) {
-		ctx.cubemap = loadCubemap(cubemapDir() + "/Forrest/prefiltered/2048");
-	}
-
 	glActiveTexture(GL_TEXTURE0);
 	glBindTexture(GL_TEXTURE_CUBE_MAP, ctx.cubemap);
 
@@ -266,10 +471,54 @@ void drawMesh(Context &ctx, GLuint program, const MeshVAO &meshVAO)
 	glUniform1i(glGetUniformLocation(program, "u_normal_toggle"), normalToggle);
 	glUniform1i(glGetUniformLocation(program, "u_cubemap_toggle"), cubemapToggle);
 	glUniform1i(glGetUniformLocation(program, "u_cubemap"), 0);
+	glUniform3fv(glGetUniformLocation(program, "u_position_offset"), 1, &meshVAO.positionOffset[0]);
+	glUniform3fv(glGetUniformLocation(program, "u_position_scale"), 1, &meshVAO.positionScale[0]);
+	glUniform1i(glGetUniformLocation(program, "u_quantized"), (meshVAO.flags & MESH_VAO_QUANTIZED) != 0);
+
+    // Selects the level of detail from the projected radius (in pixels)
+    // of the bounding sphere of the mesh
+    std::size_t firstIndex = 0;
+    std::size_t numIndices = meshVAO.numIndices;
+    if (!meshVAO.lods.errors.empty()) {
+        glm::vec4 center = mv * glm::vec4(meshVAO.lods.center, 1.0f);
+        float distance = std::max(glm::length(glm::vec3(center.x, center.y, center.z)), meshVAO.lods.radius);
+        float projectedRadius = 0.5f * ctx.height * meshVAO.lods.radius /
+                                (distance * std::tan(0.5f * glm::radians(zoom)));
+        ctx.meshLOD = selectMeshLOD(meshVAO.lods, projectedRadius, ctx.meshLOD);
+        firstIndex = meshVAO.lods.offsets[ctx.meshLOD];
+        numIndices = meshVAO.lods.offsets[ctx.meshLOD + 1] - firstIndex;
+    }
+    std::size_t indexSize = (meshVAO.indexType == GL_UNSIGNED_SHORT) ? 2 : 4;
+    ctx.numTrianglesDrawn = int(numIndices / 3);
+    ctx.numTrianglesCulled = 0;
 
     // Draw!
     glBindVertexArray(meshVAO.vao);
-    glDrawElements(GL_TRIANGLES, meshVAO.numIndices, GL_UNSIGNED_INT, 0);
+    if (!meshVAO.meshlets.empty() && cullingToggle) {
+        // Culls the meshlets of the level of detail by the view frustum
+        // and their normal cones, and draws the remaining index ranges
+        int lod = meshVAO.lods.errors.empty() ? 0 : ctx.meshLOD;
+        glm::vec4 planes[6];
+        frustumPlanes(mvp, planes);
+        glm::vec4 eye = glm::inverse(mv) * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+        std::vector<std::uint32_t> firstIndices, indexCounts;
+        std::size_t numVisible = cullMeshlets(meshVAO.meshlets, meshVAO.lodFirstMeshlet[lod],
+                                              meshVAO.lodFirstMeshlet[lod + 1], planes,
+                                              glm::vec3(eye.x, eye.y, eye.z), &firstIndices, &indexCounts);
+        ctx.numTrianglesCulled = ctx.numTrianglesDrawn - int(numVisible);
+        ctx.numTrianglesDrawn = int(numVisible);
+        std::vector<GLsizei> counts(indexCounts.begin(), indexCounts.end());
+        std::vector<const GLvoid *> offsets;
+        for (std::uint32_t first : firstIndices) {
+            offsets.push_back(reinterpret_cast<const GLvoid *>(first * indexSize));
+        }
+        glMultiDrawElements(GL_TRIANGLES, counts.data(), meshVAO.indexType, offsets.data(),
+                            GLsizei(counts.size()));
+    }
+    else {
+        glDrawElements(GL_TRIANGLES, numIndices, meshVAO.indexType,
+                       reinterpret_cast<const GLvoid *>(firstIndex * indexSize));
+    }
     glBindVertexArray(ctx.defaultVAO);
 }
 
@@ -282,6 +531,36 @@ void display(Context &ctx)
     drawMesh(ctx, ctx.program, ctx.meshVAO);
 }
 
+// Displays rendering statistics
+void runGUI(Context &ctx)
+{
+    ImGui::Begin("Stats");
+    ImGui::Text("Level of detail: %d", ctx.meshLOD);
+    ImGui::Text("Triangles: %d", ctx.numTrianglesDrawn);
+    int numTriangles = ctx.numTrianglesDrawn + ctx.numTrianglesCulled;
+    ImGui::Text("Meshlet culling (7): %s, %.1f%% culled", cullingToggle ? "on" : "off",
+                numTriangles > 0 ? 100.0f * ctx.numTrianglesCulled / numTriangles : 0.0f);
+    ImGui::Text("Frame time: %.2f ms", 1000.0f / ImGui::GetIO().Framerate);
+    if (ctx.prefilterTime > 0.0) {
+        ImGui::Text("Environment (P): %s, prefiltered in %.2f s", ggxToggle ? "GGX" : "Phong",
+                    ctx.prefilterTime);
+    }
+    else {
+        ImGui::Text("Environment (P): %s, cached", ggxToggle ? "GGX" : "Phong");
+    }
+    if (ctx.picked) {
+        ImGui::Text("Picked triangle %u (%.1f us)", ctx.pick.triangle, ctx.pickTime * 1e6);
+        ImGui::Text("  position (%.3f, %.3f, %.3f)", ctx.pick.position.x, ctx.pick.position.y,
+                    ctx.pick.position.z);
+        ImGui::Text("  barycentrics (%.3f, %.3f, %.3f)", ctx.pick.barycentrics.x,
+                    ctx.pick.barycentrics.y, ctx.pick.barycentrics.z);
+    }
+    else {
+        ImGui::Text("Picked nothing (right click to pick)");
+    }
+    ImGui::End();
+}
+
 void reloadShaders(Context *ctx)
 {
     glDeleteProgram(ctx->program);
@@ -289,12 +568,38 @@ void reloadShaders(Context *ctx)
                                      shaderDir() + "mesh.frag");
 }
 
+// Casts a ray from the cursor position (in window coordinates) through
+// the mesh as drawn in the last frame, using the BVH of the mesh.
+// Returns the closest hit, with its position in world coordinates.
+bool pickMesh(const Context &ctx, const MeshVAO &meshVAO, double x, double y, RayHit *hit)
+{
+    // Unprojects the cursor on the near and far planes into model space
+    glm::vec2 ndc(2.0 * x / ctx.width - 1.0, 1.0 - 2.0 * y / ctx.height);
+    glm::mat4 inverseMVP = glm::inverse(ctx.mvp);
+    glm::vec4 nearPoint = inverseMVP * glm::vec4(ndc.x, ndc.y, -1.0f, 1.0f);
+    glm::vec4 farPoint = inverseMVP * glm::vec4(ndc.x, ndc.y, 1.0f, 1.0f);
+    glm::vec3 origin = glm::vec3(nearPoint.x, nearPoint.y, nearPoint.z) / nearPoint.w;
+    glm::vec3 direction = glm::vec3(farPoint.x, farPoint.y, farPoint.z) / farPoint.w - origin;
+
+    if (!intersectMeshBVH(meshVAO.bvh, origin, direction, hit)) {
+        return false;
+    }
+    glm::vec4 position = ctx.model * glm::vec4(hit->position, 1.0f);
+    hit->position = glm::vec3(position.x, position.y, position.z);
+    return true;
+}
+
 void mouseButtonPressed(Context *ctx, int button, int x, int y)
 {
     if (button == GLFW_MOUSE_BUTTON_LEFT) {
         ctx->trackball.center = glm::vec2(x, y);
         trackballStartTracking(ctx->trackball, glm::vec2(x, y));
     }
+    if (button == GLFW_MOUSE_BUTTON_RIGHT) {
+        double start = glfwGetTime();
+        ctx->picked = pickMesh(*ctx, ctx->meshVAO, x, y, &ctx->pick);
+        ctx->pickTime = glfwGetTime() - start;
+    }
 }
 
 void mouseButtonReleased(Context *ctx, int button, int x, int y)
@@ -345,11 +650,21 @@ void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods
 	if (key == GLFW_KEY_6 && action == GLFW_PRESS) {
 		cubemapToggle = !cubemapToggle;
 	}
+	if (key == GLFW_KEY_7 && action == GLFW_PRESS) {
+		cullingToggle = !cullingToggle;
+	}
+	if (key == GLFW_KEY_P && action == GLFW_PRESS) {
+		// Switches the lobe that the cubemap is prefiltered with
+		ggxToggle = !ggxToggle;
+		glDeleteTextures(1, &ctx->cubemap);
+		ctx->cubemap = loadPrefilteredCubemap(cubemapDir() + "/Forrest", ggxToggle ? PREFILTER_GGX : PREFILTER_PHONG,
+		                                      &ctx->prefilterTime);
+	}
 	if (key == GLFW_KEY_Q && action == GLFW_PRESS) {
-		zoom += 10.0f;
+		zoom = std::min(zoom + 10.0f, 175.0f);
 	}
 	if (key == GLFW_KEY_W && action == GLFW_PRESS) {
-		zoom -= 10.0f;
+		zoom = std::max(zoom - 10.0f, 5.0f);
 	}
 	if (key == GLFW_KEY_Z && action == GLFW_PRESS) {
 		shine = shine * 4;
@@ -450,6 +765,7 @@ int main(void)
         glfwPollEvents();
         ctx.elapsed_time = glfwGetTime();
         ImGui_ImplGlfwGL3_NewFrame();
+        runGUI(ctx);
         display(ctx);
         ImGui::Render();
         glfwSwapBuffers(ctx.window);
@@ -22,15 +22,32 @@ uniform int u_gamma_toggle;
 uniform int u_normal_toggle;
 uniform int u_cubemap_toggle;
 uniform samplerCube u_cubemap;
+uniform vec3 u_position_offset;
+uniform vec3 u_position_scale;
+uniform int u_quantized;
+
+// Decodes a normal stored as octahedral coordinates
+vec3 octDecode(vec2 e)
+{
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    if (n.z < 0.0) {
+        n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    }
+    return normalize(n);
+}
 
 void main()
 {
-    v_normal = a_normal;
-    gl_Position = u_mvp * a_position;
+	// Quantized positions are relative to the bounding box of the mesh
+	vec4 position = vec4(u_position_offset + u_position_scale * a_position.xyz, 1.0);
+	vec3 normal = (u_quantized != 0) ? octDecode(a_normal.xy) : a_normal;
+
+    v_normal = normal;
+    gl_Position = u_mvp * position;
 
-	vec3 N = normalize(mat3(u_mv) * a_normal.xyz);
-	vec3 L = normalize(u_lightpos.xyz - (u_mv * a_position).xyz);
-	vec3 V = -normalize((u_mv * a_position).xyz);
+	vec3 N = normalize(mat3(u_mv) * normal);
+	vec3 L = normalize(u_lightpos.xyz - (u_mv * position).xyz);
+	vec3 V = -normalize((u_mv * position).xyz);
 	vec3 H = normalize(L+V);
 	vec3 R = reflect(-V, N);
 	
@@ -45,9 +62,12 @@ void main()
 		specular = ((u_shininess+8.0f)/8.0f) * u_specular * pow(max(dot(N, H), 0.0), u_shininess);
 	}
 	
+	// The mipmap levels of the cubemap are prefiltered for shininess
+	// 2048, 512, ..., 0.125 (divided by 4 per level)
 	vec4 cube_color;
 	if(u_cubemap_toggle){
-		cube_color = vec4(texture(u_cubemap, R).rgb, 0);
+		float lod = clamp(log2(2048.0 / max(u_shininess, 1e-6)) / 2.0, 0.0, 7.0);
+		cube_color = vec4(textureLod(u_cubemap, R, lod).rgb, 0);
 	}
 
 	if(u_normal_toggle){
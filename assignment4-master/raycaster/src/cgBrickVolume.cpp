@@ -0,0 +1,323 @@
+#include "cgBrickVolume.h"
+#include "cgVolumeResample.h"
+#include "cgParallel.h"
+
+#include <iostream>
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+
+namespace {
+
+const char BRICK_FILE_MAGIC[8] = { 'C', 'G', 'B', 'R', 'I', 'C', 'K', '1' };
+
+template<typename T>
+void writeValue(std::ostream &out, const T &value)
+{
+    out.write(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+template<typename T>
+bool readValue(std::istream &in, T *value)
+{
+    return bool(in.read(reinterpret_cast<char *>(value), sizeof(T)));
+}
+
+// Number of bricks along each axis of a level
+glm::ivec3 brickGridDimensions(const glm::ivec3 &levelDims, int brickSize)
+{
+    int payload = brickSize - 2;
+    return (levelDims + glm::ivec3(payload - 1)) / payload;
+}
+
+// Copies a brick (including its one voxel border, clamped to the edge
+// of the volume) from a level of the volume. Returns true if all voxels
+// of the brick are zero.
+bool extractBrick(const cg::VolumeBase &level, const glm::ivec3 &brick, int brickSize,
+                  std::size_t voxelSize, std::uint8_t *dst)
+{
+    glm::ivec3 dims = level.dimensions;
+    int payload = brickSize - 2;
+    glm::ivec3 first = brick * payload - 1;
+    std::vector<int> xs(brickSize);
+    for (int i = 0; i < brickSize; ++i) {
+        xs[i] = std::min(std::max(first.x + i, 0), dims.x - 1);
+    }
+    bool contiguous = (xs[brickSize - 1] - xs[0] == brickSize - 1);
+    std::size_t rowBytes = brickSize * voxelSize;
+
+    for (int z = 0; z < brickSize; ++z) {
+        int vz = std::min(std::max(first.z + z, 0), dims.z - 1);
+        for (int y = 0; y < brickSize; ++y) {
+            int vy = std::min(std::max(first.y + y, 0), dims.y - 1);
+            const std::uint8_t *src = &level.data[(std::size_t(vz) * dims.y + vy) * dims.x * voxelSize];
+            std::uint8_t *row = dst + (std::size_t(z) * brickSize + y) * rowBytes;
+            if (contiguous) {
+                std::memcpy(row, src + xs[0] * voxelSize, rowBytes);
+            }
+            else {
+                for (int x = 0; x < brickSize; ++x) {
+                    std::memcpy(row + x * voxelSize, src + xs[x] * voxelSize, voxelSize);
+                }
+            }
+        }
+    }
+
+    std::size_t brickBytes = rowBytes * brickSize * brickSize;
+    return std::all_of(dst, dst + brickBytes, [](std::uint8_t b) { return b == 0; });
+}
+
+} // namespace
+
+
+
+namespace cg {
+
+bool brickVolumeBuild(const VolumeBase &volume, const std::string &filename, int brickSize)
+{
+    std::size_t voxelSize = volumeVoxelSize(volume.datatype);
+    if (voxelSize == 0 || brickSize < 4 || volume.data.empty()) {
+        std::cerr << "Error: Cannot build bricks for volume with datatype "
+                  << volume.datatype << std::endl;
+        return false;
+    }
+    std::ofstream out(filename, std::ios::binary);
+    if (!out) {
+        std::cerr << "Error: Could not open file " << filename << std::endl;
+        return false;
+    }
+
+    // Dimensions of the levels (halved until a level fits in one brick)
+    int payload = brickSize - 2;
+    std::vector<glm::ivec3> levelDims(1, volume.dimensions);
+    while (levelDims.back().x > payload || levelDims.back().y > payload ||
+           levelDims.back().z > payload) {
+        levelDims.push_back((levelDims.back() + 1) / 2);
+    }
+    int numBricks = 0;
+    for (const glm::ivec3 &dims : levelDims) {
+        glm::ivec3 grid = brickGridDimensions(dims, brickSize);
+        numBricks += grid.x * grid.y * grid.z;
+    }
+
+    // Header. The empty flags are written after the bricks are known.
+    out.write(BRICK_FILE_MAGIC, sizeof(BRICK_FILE_MAGIC));
+    writeValue(out, volume.dimensions);
+    writeValue(out, volume.origin);
+    writeValue(out, volume.spacing);
+    writeValue(out, std::int32_t(brickSize));
+    writeValue(out, std::int32_t(levelDims.size()));
+    writeValue(out, std::int32_t(volume.datatype.size()));
+    out.write(volume.datatype.data(), volume.datatype.size());
+    for (const glm::ivec3 &dims : levelDims) {
+        writeValue(out, dims);
+    }
+    std::streampos emptyOffset = out.tellp();
+    std::vector<std::uint8_t> brickEmpty(numBricks, 0);
+    out.write(reinterpret_cast<const char *>(brickEmpty.data()), numBricks);
+
+    // Bricks, level by level, one z-row of bricks at a time
+    std::size_t brickBytes = std::size_t(brickSize) * brickSize * brickSize * voxelSize;
+    VolumeBase coarser;
+    const VolumeBase *level = &volume;
+    int brickIndex = 0;
+    for (std::size_t l = 0; l < levelDims.size(); ++l) {
+        if (l > 0) {
+            VolumeBase resampled;
+            volumeResample(*level, levelDims[l], &resampled);
+            coarser.data.swap(resampled.data);
+            coarser.dimensions = resampled.dimensions;
+            coarser.datatype = resampled.datatype;
+            level = &coarser;
+        }
+        glm::ivec3 grid = brickGridDimensions(levelDims[l], brickSize);
+        int bricksPerRow = grid.x * grid.y;
+        std::vector<std::uint8_t> row(bricksPerRow * brickBytes);
+        for (int bz = 0; bz < grid.z; ++bz) {
+            parallelFor(0, bricksPerRow, [&](int begin, int end) {
+                for (int i = begin; i < end; ++i) {
+                    glm::ivec3 brick(i % grid.x, i / grid.x, bz);
+                    brickEmpty[brickIndex + i] = extractBrick(*level, brick, brickSize, voxelSize,
+                                                              &row[i * brickBytes]);
+                }
+            });
+            out.write(reinterpret_cast<const char *>(row.data()), row.size());
+            brickIndex += bricksPerRow;
+        }
+    }
+
+    out.seekp(emptyOffset);
+    out.write(reinterpret_cast<const char *>(brickEmpty.data()), numBricks);
+    if (!out) {
+        std::cerr << "Error: Could not write file " << filename << std::endl;
+        return false;
+    }
+
+    // Display log message
+    std::cout << "Built bricked volume " << filename << " (" << levelDims.size()
+              << " levels, " << numBricks << " bricks of " << brickSize << "^3, "
+              << std::count(brickEmpty.begin(), brickEmpty.end(), 1) << " empty)" << std::endl;
+
+    return true;
+}
+
+bool brickVolumeOpen(BrickVolumeFile *file, const std::string &filename)
+{
+    std::ifstream in(filename, std::ios::binary);
+    if (!in) {
+        std::cerr << "Error: Could not open file " << filename << std::endl;
+        return false;
+    }
+
+    char magic[sizeof(BRICK_FILE_MAGIC)];
+    std::int32_t brickSize = 0, numLevels = 0, datatypeLength = 0;
+    BrickVolumeFile header;
+    if (!in.read(magic, sizeof(magic)) ||
+        std::memcmp(magic, BRICK_FILE_MAGIC, sizeof(magic)) != 0 ||
+        !readValue(in, &header.info.dimensions) || !readValue(in, &header.info.origin) ||
+        !readValue(in, &header.info.spacing) || !readValue(in, &brickSize) ||
+        !readValue(in, &numLevels) || !readValue(in, &datatypeLength) ||
+        brickSize < 4 || numLevels < 1 || datatypeLength < 0 || datatypeLength > 16) {
+        std::cerr << "Error: Invalid bricked volume file " << filename << std::endl;
+        return false;
+    }
+    header.info.datatype.resize(datatypeLength);
+    in.read(&header.info.datatype[0], datatypeLength);
+    std::size_t voxelSize = volumeVoxelSize(header.info.datatype);
+    if (voxelSize == 0) {
+        std::cerr << "Error: Unsupported datatype " << header.info.datatype << std::endl;
+        return false;
+    }
+
+    header.filename = filename;
+    header.brickSize = brickSize;
+    header.numLevels = numLevels;
+    int numBricks = 0;
+    for (int l = 0; l < numLevels; ++l) {
+        glm::ivec3 dims;
+        readValue(in, &dims);
+        glm::ivec3 grid = brickGridDimensions(dims, brickSize);
+        header.levelDimensions.push_back(dims);
+        header.gridDimensions.push_back(grid);
+        header.levelFirstBrick.push_back(numBricks);
+        numBricks += grid.x * grid.y * grid.z;
+    }
+    header.brickEmpty.resize(numBricks);
+    in.read(reinterpret_cast<char *>(header.brickEmpty.data()), numBricks);
+    if (!in) {
+        std::cerr << "Error: Invalid bricked volume file " << filename << std::endl;
+        return false;
+    }
+    header.brickBytes = std::size_t(brickSize) * brickSize * brickSize * voxelSize;
+    header.dataOffset = std::size_t(in.tellg());
+
+    *file = header;
+    return true;
+}
+
+int brickVolumeIndex(const BrickVolumeFile &file, int level, const glm::ivec3 &brick)
+{
+    glm::ivec3 grid = file.gridDimensions[level];
+    return file.levelFirstBrick[level] + (brick.z * grid.y + brick.y) * grid.x + brick.x;
+}
+
+void brickVolumeLocate(const BrickVolumeFile &file, int index, int *level, glm::ivec3 *brick)
+{
+    int l = int(std::upper_bound(file.levelFirstBrick.begin(), file.levelFirstBrick.end(), index) -
+                file.levelFirstBrick.begin()) - 1;
+    glm::ivec3 grid = file.gridDimensions[l];
+    int i = index - file.levelFirstBrick[l];
+    *level = l;
+    *brick = glm::ivec3(i % grid.x, (i / grid.x) % grid.y, i / (grid.x * grid.y));
+}
+
+bool brickVolumeRead(const BrickVolumeFile &file, const std::vector<int> &bricks,
+                     std::vector<std::uint8_t> *data)
+{
+    data->resize(bricks.size() * file.brickBytes);
+    std::atomic<bool> ok(true);
+    parallelFor(0, int(bricks.size()), [&](int begin, int end) {
+        std::ifstream in(file.filename, std::ios::binary);
+        for (int i = begin; i < end && in; ++i) {
+            in.seekg(file.dataOffset + std::size_t(bricks[i]) * file.brickBytes);
+            in.read(reinterpret_cast<char *>(&(*data)[i * file.brickBytes]), file.brickBytes);
+        }
+        if (!in) {
+            ok = false;
+        }
+    }, 8);
+    if (!ok) {
+        std::cerr << "Error: Could not read bricks from " << file.filename << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void brickCacheInit(BrickCache *cache, int numSlots)
+{
+    cache->entries.clear();
+    cache->lookup.clear();
+    cache->freeSlots.clear();
+    for (int slot = numSlots - 1; slot >= 0; --slot) {
+        cache->freeSlots.push_back(slot);
+    }
+    cache->frame = 0;
+}
+
+int brickCacheTouch(BrickCache *cache, int brick)
+{
+    auto it = cache->lookup.find(brick);
+    if (it == cache->lookup.end()) {
+        return -1;
+    }
+    // Move the entry to the front of the LRU list
+    cache->entries.splice(cache->entries.begin(), cache->entries, it->second);
+    it->second->lastUsed = cache->frame;
+    return it->second->slot;
+}
+
+int brickCacheInsert(BrickCache *cache, int brick, bool pinned, int *evicted)
+{
+    *evicted = -1;
+    int slot = brickCacheTouch(cache, brick);
+    if (slot >= 0) {
+        return slot;
+    }
+
+    if (!cache->freeSlots.empty()) {
+        slot = cache->freeSlots.back();
+        cache->freeSlots.pop_back();
+    }
+    else if (!cache->entries.empty()) {
+        // Evict the least recently used brick that may be evicted
+        auto it = cache->entries.end();
+        while (it != cache->entries.begin()) {
+            --it;
+            if (!it->pinned && it->lastUsed < cache->frame) {
+                break;
+            }
+        }
+        if (it->pinned || it->lastUsed >= cache->frame) {
+            return -1;
+        }
+        slot = it->slot;
+        *evicted = it->brick;
+        cache->lookup.erase(it->brick);
+        cache->entries.erase(it);
+    }
+    else {
+        return -1;
+    }
+
+    BrickCache::Entry entry = { brick, slot, cache->frame, pinned };
+    cache->entries.push_front(entry);
+    cache->lookup[brick] = cache->entries.begin();
+    return slot;
+}
+
+void brickCacheNextFrame(BrickCache *cache)
+{
+    cache->frame++;
+}
+
+} // namespace cg
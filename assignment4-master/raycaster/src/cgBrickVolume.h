@@ -0,0 +1,92 @@
+#pragma once
+
+#include "cgVolume.h"
+
+#include <vector>
+#include <list>
+#include <string>
+#include <fstream>
+#include <cstdint>
+#include <cstddef>
+#include <unordered_map>
+
+namespace cg {
+
+// Multi-resolution bricked volume stored on disk, for streaming volumes
+// that do not fit in texture memory. Level 0 is the full-resolution
+// volume and every following level halves the dimensions, until the
+// whole level fits in a single brick. Each level is split into bricks
+// of brickSize^3 voxels that overlap their neighbours by one voxel on
+// each side, so that bricks can be filtered independently; a brick thus
+// covers (brickSize - 2)^3 voxels of its level.
+struct BrickVolumeFile {
+    std::string filename;
+    VolumeBase info;  // level 0 dimensions, origin, spacing, and datatype (no data)
+    int brickSize;  // stored brick size in voxels (including the borders)
+    int numLevels;
+    std::vector<glm::ivec3> levelDimensions;  // voxels per level
+    std::vector<glm::ivec3> gridDimensions;  // bricks per level
+    std::vector<int> levelFirstBrick;  // global index of the first brick of each level
+    std::vector<std::uint8_t> brickEmpty;  // 1 for bricks with only zero voxels
+    std::size_t brickBytes;
+    std::size_t dataOffset;  // file offset of the first brick
+
+    BrickVolumeFile() : brickSize(0), numLevels(0), brickBytes(0), dataOffset(0) {}
+};
+
+// LRU cache that maps bricks (by global index) to slots of a brick
+// atlas with a fixed number of slots. Bricks used in the current frame
+// and pinned bricks are never evicted.
+struct BrickCache {
+    struct Entry {
+        int brick;
+        int slot;
+        int lastUsed;  // frame number
+        bool pinned;
+    };
+    std::list<Entry> entries;  // most recently used first
+    std::unordered_map<int, std::list<Entry>::iterator> lookup;
+    std::vector<int> freeSlots;
+    int frame;
+
+    BrickCache() : frame(0) {}
+};
+
+// Builds a bricked volume file from a volume image, with brickSize^3
+// voxels per stored brick. The coarser levels are computed with
+// volumeResample. Returns true on success, false otherwise.
+bool brickVolumeBuild(const VolumeBase &volume, const std::string &filename, int brickSize = 32);
+
+// Opens a bricked volume file and reads its header. Returns true on
+// success, false otherwise.
+bool brickVolumeOpen(BrickVolumeFile *file, const std::string &filename);
+
+// Returns the global index of brick (x, y, z) of a level
+int brickVolumeIndex(const BrickVolumeFile &file, int level, const glm::ivec3 &brick);
+
+// Returns the level and brick coordinates of a global brick index
+void brickVolumeLocate(const BrickVolumeFile &file, int index, int *level, glm::ivec3 *brick);
+
+// Reads bricks (given by their global indices) from the file into
+// consecutive blocks of brickBytes each, in parallel. Returns true on
+// success, false otherwise.
+bool brickVolumeRead(const BrickVolumeFile &file, const std::vector<int> &bricks,
+                     std::vector<std::uint8_t> *data);
+
+// Initializes a brick cache with numSlots free slots
+void brickCacheInit(BrickCache *cache, int numSlots);
+
+// Returns the slot of a cached brick and marks it as used in the
+// current frame, or returns -1 if the brick is not cached
+int brickCacheTouch(BrickCache *cache, int brick);
+
+// Inserts a brick into the cache and returns its slot. If the cache is
+// full, the least recently used brick that is neither pinned nor used
+// in the current frame is evicted and returned in *evicted (otherwise
+// *evicted is -1). Returns -1 if no slot could be freed.
+int brickCacheInsert(BrickCache *cache, int brick, bool pinned, int *evicted);
+
+// Starts a new frame
+void brickCacheNextFrame(BrickCache *cache);
+
+} // namespace cg
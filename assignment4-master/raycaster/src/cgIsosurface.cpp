@@ -0,0 +1,477 @@
+#include "cgIsosurface.h"
+#include "cgParallel.h"
+
+#include <iostream>
+#include <chrono>
+#include <algorithm>
+
+namespace {
+
+// Cube corner c has the offset (c & 1, (c >> 1) & 1, (c >> 2) & 1). Edge
+// e runs along axis e / 4 and connects edgeCorners[e][0] (the corner
+// with the smaller coordinate) to edgeCorners[e][1].
+const int edgeCorners[12][2] = {
+    { 0, 1 }, { 2, 3 }, { 4, 5 }, { 6, 7 },  // x-axis edges
+    { 0, 2 }, { 1, 3 }, { 4, 6 }, { 5, 7 },  // y-axis edges
+    { 0, 4 }, { 1, 5 }, { 2, 6 }, { 3, 7 }   // z-axis edges
+};
+
+// Marching cubes lookup table. For each of the 256 corner configurations
+// it lists the cube edges of the triangles to emit, terminated by -1.
+struct MarchingCubesTable {
+    signed char triangles[256][31];
+
+    MarchingCubesTable();
+};
+
+// Returns the cube edge connecting corners a and b
+int findEdge(int a, int b)
+{
+    for (int e = 0; e < 12; ++e) {
+        if ((edgeCorners[e][0] == a && edgeCorners[e][1] == b) ||
+            (edgeCorners[e][0] == b && edgeCorners[e][1] == a)) {
+            return e;
+        }
+    }
+    return -1;
+}
+
+// Returns true if cube edges a and b lie on a common cube face
+bool edgesShareFace(int a, int b)
+{
+    int corners[4] = { edgeCorners[a][0], edgeCorners[a][1], edgeCorners[b][0], edgeCorners[b][1] };
+    for (int axis = 0; axis < 3; ++axis) {
+        int bit = (corners[0] >> axis) & 1;
+        if (((corners[1] >> axis) & 1) == bit && ((corners[2] >> axis) & 1) == bit &&
+            ((corners[3] >> axis) & 1) == bit) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Builds the table from the cube topology instead of storing it by
+// hand. On each face the boundary of the inside region is traced with
+// the inside on the left (seen from outside the cube), and ambiguous
+// faces always separate the inside corners. Neighboring cells therefore
+// agree on every shared face, which keeps the surface watertight. The
+// traced segments are chained into loops and each loop is triangulated
+// as a fan, wound counter-clockwise when seen from the outside.
+MarchingCubesTable::MarchingCubesTable()
+{
+    // Corners of each face in counter-clockwise order seen from outside
+    int faceCorners[6][4];
+    for (int axis = 0; axis < 3; ++axis) {
+        int u = (axis + 1) % 3, v = (axis + 2) % 3;
+        const int cycle[4][2] = { { 0, 0 }, { 1, 0 }, { 1, 1 }, { 0, 1 } };
+        for (int side = 0; side < 2; ++side) {
+            for (int k = 0; k < 4; ++k) {
+                int kk = (side == 1) ? k : 3 - k;
+                faceCorners[2 * axis + side][k] = (side << axis) |
+                    (cycle[kk][0] << u) | (cycle[kk][1] << v);
+            }
+        }
+    }
+
+    for (int config = 0; config < 256; ++config) {
+        int next[12];
+        std::fill(next, next + 12, -1);
+        for (int f = 0; f < 6; ++f) {
+            int edges[4];
+            bool inside[4];
+            for (int k = 0; k < 4; ++k) {
+                inside[k] = ((config >> faceCorners[f][k]) & 1) != 0;
+                edges[k] = findEdge(faceCorners[f][k], faceCorners[f][(k + 1) % 4]);
+            }
+            // Connect each exit edge to the closest preceding entry edge
+            for (int k = 0; k < 4; ++k) {
+                if (inside[k] && !inside[(k + 1) % 4]) {
+                    for (int j = 1; j < 4; ++j) {
+                        int p = (k + 4 - j) % 4;
+                        if (!inside[p] && inside[(p + 1) % 4]) {
+                            next[edges[k]] = edges[p];
+                            break;
+                        }
+                    }
+                }
+            }
+        }
+
+        int count = 0;
+        bool visited[12] = { false };
+        for (int start = 0; start < 12; ++start) {
+            if (next[start] < 0 || visited[start]) {
+                continue;
+            }
+            int loop[12];
+            int loopSize = 0;
+            for (int e = start; !visited[e]; e = next[e]) {
+                visited[e] = true;
+                loop[loopSize++] = e;
+            }
+            // Pick the fan apex with the fewest diagonals lying on a cube
+            // face, since such diagonals can coincide with a diagonal of
+            // the neighboring cell and make the surface non-manifold
+            int apex = 0;
+            int minOnFace = loopSize;
+            for (int a = 0; a < loopSize; ++a) {
+                int onFace = 0;
+                for (int i = 2; i + 1 < loopSize; ++i) {
+                    onFace += edgesShareFace(loop[a], loop[(a + i) % loopSize]);
+                }
+                if (onFace < minOnFace) {
+                    apex = a;
+                    minOnFace = onFace;
+                }
+            }
+            for (int i = 1; i + 1 < loopSize; ++i) {
+                triangles[config][count++] = loop[apex];
+                triangles[config][count++] = loop[(apex + i + 1) % loopSize];
+                triangles[config][count++] = loop[(apex + i) % loopSize];
+            }
+        }
+        triangles[config][count] = -1;
+    }
+}
+
+const MarchingCubesTable &marchingCubesTable()
+{
+    static const MarchingCubesTable table;
+    return table;
+}
+
+const std::uint64_t EMPTY_KEY = ~std::uint64_t(0);
+
+// Open addressing hash map from cell edge ids to vertex indices
+class EdgeVertexMap {
+public:
+    EdgeVertexMap() : m_size(0) { rehash(1024); }
+
+    // Returns the vertex index of an edge, or -1 if it is not present
+    std::int64_t find(std::uint64_t key) const
+    {
+        std::size_t mask = m_keys.size() - 1;
+        for (std::size_t i = hash(key) & mask; ; i = (i + 1) & mask) {
+            if (m_keys[i] == key) {
+                return m_values[i];
+            }
+            if (m_keys[i] == EMPTY_KEY) {
+                return -1;
+            }
+        }
+    }
+
+    void insert(std::uint64_t key, std::uint32_t value)
+    {
+        if (2 * (m_size + 1) > m_keys.size()) {
+            rehash(2 * m_keys.size());
+        }
+        std::size_t mask = m_keys.size() - 1;
+        std::size_t i = hash(key) & mask;
+        while (m_keys[i] != EMPTY_KEY) {
+            i = (i + 1) & mask;
+        }
+        m_keys[i] = key;
+        m_values[i] = value;
+        m_size++;
+    }
+
+private:
+    static std::size_t hash(std::uint64_t key)
+    {
+        key ^= key >> 33;
+        key *= 0xff51afd7ed558ccdull;
+        key ^= key >> 33;
+        return std::size_t(key);
+    }
+
+    void rehash(std::size_t capacity)
+    {
+        std::vector<std::uint64_t> keys;
+        std::vector<std::uint32_t> values;
+        keys.swap(m_keys);
+        values.swap(m_values);
+        m_keys.assign(capacity, EMPTY_KEY);
+        m_values.resize(capacity);
+        m_size = 0;
+        for (std::size_t i = 0; i < keys.size(); ++i) {
+            if (keys[i] != EMPTY_KEY) {
+                insert(keys[i], values[i]);
+            }
+        }
+    }
+
+    std::vector<std::uint64_t> m_keys;
+    std::vector<std::uint32_t> m_values;
+    std::size_t m_size;
+};
+
+// Mesh extracted from the cells of one z-slab
+struct SlabMesh {
+    int zBegin;
+    std::vector<glm::vec3> vertices;
+    std::vector<glm::vec3> normals;
+    std::vector<std::uint64_t> vertexEdges;  // edge id of each vertex
+    std::vector<std::uint32_t> indices;  // slab-local vertex indices
+    EdgeVertexMap edgeToVertex;
+    // Filled in during merging: rank among the vertices owned by the
+    // slab, or the vertex of the slab below (marked with SHARED_BIT)
+    std::vector<std::uint32_t> remap;
+    std::size_t numOwnedVertices;
+};
+
+const std::uint32_t SHARED_BIT = 0x80000000u;
+
+// Typed view of the voxel data, with clamped access and gradients
+template<typename VoxelType>
+struct VoxelGrid {
+    const VoxelType *voxels;
+    glm::ivec3 dims;
+    glm::vec3 spacing;
+
+    float value(int x, int y, int z) const
+    {
+        return float(voxels[(std::size_t(z) * dims.y + y) * dims.x + x]);
+    }
+
+    // Central-difference gradient in physical units at a grid point
+    glm::vec3 gradient(int x, int y, int z) const
+    {
+        int x0 = std::max(x - 1, 0), x1 = std::min(x + 1, dims.x - 1);
+        int y0 = std::max(y - 1, 0), y1 = std::min(y + 1, dims.y - 1);
+        int z0 = std::max(z - 1, 0), z1 = std::min(z + 1, dims.z - 1);
+        return glm::vec3(
+            (value(x1, y, z) - value(x0, y, z)) / (std::max(x1 - x0, 1) * spacing.x),
+            (value(x, y1, z) - value(x, y0, z)) / (std::max(y1 - y0, 1) * spacing.y),
+            (value(x, y, z1) - value(x, y, z0)) / (std::max(z1 - z0, 1) * spacing.z));
+    }
+};
+
+// Run marching cubes over the cells with z in [zBegin, zEnd)
+template<typename VoxelType>
+void extractSlab(const VoxelGrid<VoxelType> &grid, float isovalue,
+                 const glm::vec3 &offset, SlabMesh *slab, int zEnd)
+{
+    const MarchingCubesTable &table = marchingCubesTable();
+    glm::ivec3 dims = grid.dims;
+    float values[8];
+
+    for (int z = slab->zBegin; z < zEnd; ++z) {
+        for (int y = 0; y < dims.y - 1; ++y) {
+            // The four corners at x + 1 are reused as the corners at x of
+            // the next cell, so only four voxels are read per cell
+            const VoxelType *rows[4];
+            for (int c = 0; c < 4; ++c) {
+                rows[c] = grid.voxels + (std::size_t(z + (c >> 1)) * dims.y + y + (c & 1)) * dims.x;
+                values[2 * c] = float(rows[c][0]);
+            }
+            int leftConfig = 0;
+            for (int c = 0; c < 4; ++c) {
+                leftConfig |= (values[2 * c] >= isovalue) << (2 * c);
+            }
+
+            for (int x = 0; x < dims.x - 1; ++x) {
+                int config = leftConfig;
+                for (int c = 0; c < 4; ++c) {
+                    values[2 * c + 1] = float(rows[c][x + 1]);
+                    config |= (values[2 * c + 1] >= isovalue) << (2 * c + 1);
+                }
+                leftConfig = (config >> 1) & 0x55;
+                if (config == 0 || config == 255) {
+                    for (int c = 0; c < 4; ++c) {
+                        values[2 * c] = values[2 * c + 1];
+                    }
+                    continue;
+                }
+
+                const signed char *edges = table.triangles[config];
+                for (int i = 0; edges[i] >= 0; ++i) {
+                    int e = edges[i];
+                    int c0 = edgeCorners[e][0], c1 = edgeCorners[e][1];
+                    int bx = x + (c0 & 1), by = y + ((c0 >> 1) & 1), bz = z + ((c0 >> 2) & 1);
+                    std::uint64_t key = ((std::uint64_t(bz) * dims.y + by) * dims.x + bx) * 3 + e / 4;
+
+                    std::int64_t vertex = slab->edgeToVertex.find(key);
+                    if (vertex < 0) {
+                        // Interpolate position and gradient along the edge
+                        float t = (isovalue - values[c0]) / (values[c1] - values[c0]);
+                        glm::vec3 p0 = glm::vec3(bx, by, bz);
+                        glm::vec3 p1 = glm::vec3(x + (c1 & 1), y + ((c1 >> 1) & 1), z + ((c1 >> 2) & 1));
+                        glm::vec3 g0 = grid.gradient(bx, by, bz);
+                        glm::vec3 g1 = grid.gradient(int(p1.x), int(p1.y), int(p1.z));
+                        glm::vec3 g = g0 + t * (g1 - g0);
+                        float length = glm::length(g);
+
+                        vertex = slab->vertices.size();
+                        slab->vertices.push_back((p0 + t * (p1 - p0) + offset) * grid.spacing);
+                        slab->normals.push_back(length > 0.0f ? -g / length : glm::vec3(0.0f, 0.0f, 1.0f));
+                        slab->vertexEdges.push_back(key);
+                        slab->edgeToVertex.insert(key, std::uint32_t(vertex));
+                    }
+                    slab->indices.push_back(std::uint32_t(vertex));
+                }
+                for (int c = 0; c < 4; ++c) {
+                    values[2 * c] = values[2 * c + 1];
+                }
+            }
+        }
+    }
+}
+
+template<typename VoxelType>
+void extractIsosurface(const cg::VolumeBase &volume, float isovalue,
+                       std::vector<glm::vec3> *vertices,
+                       std::vector<glm::vec3> *normals,
+                       std::vector<std::uint32_t> *indices)
+{
+    auto startTime = std::chrono::steady_clock::now();
+
+    VoxelGrid<VoxelType> grid;
+    grid.voxels = reinterpret_cast<const VoxelType *>(&volume.data[0]);
+    grid.dims = volume.dimensions;
+    grid.spacing = volume.spacing;
+
+    vertices->clear();
+    normals->clear();
+    indices->clear();
+    int numCellsZ = grid.dims.z - 1;
+    if (grid.dims.x < 2 || grid.dims.y < 2 || numCellsZ < 1) {
+        return;
+    }
+
+    // Maps voxel coordinates to the space of volumeComputeModelMatrix
+    // (after the division by the spacing, which is applied last)
+    glm::vec3 offset = 0.5f - 0.5f * glm::vec3(grid.dims) + volume.origin / grid.spacing;
+
+    // Extract slabs in parallel, with a few slabs per thread for balance
+    int numSlabs = std::min(numCellsZ, 4 * cg::parallelNumThreads());
+    int slabSize = (numCellsZ + numSlabs - 1) / numSlabs;
+    numSlabs = (numCellsZ + slabSize - 1) / slabSize;
+    std::vector<SlabMesh> slabs(numSlabs);
+    cg::parallelFor(0, numSlabs, [&](int begin, int end) {
+        for (int s = begin; s < end; ++s) {
+            slabs[s].zBegin = s * slabSize;
+            extractSlab(grid, isovalue, offset, &slabs[s], std::min((s + 1) * slabSize, numCellsZ));
+        }
+    });
+
+    // Find vertices on the bottom plane of each slab that the slab below
+    // already owns, and rank the remaining (owned) vertices
+    cg::parallelFor(0, numSlabs, [&](int begin, int end) {
+        for (int s = begin; s < end; ++s) {
+            SlabMesh &slab = slabs[s];
+            std::uint64_t planeBegin = std::uint64_t(slab.zBegin) * grid.dims.y * grid.dims.x * 3;
+            std::uint64_t planeEnd = planeBegin + std::uint64_t(grid.dims.y) * grid.dims.x * 3;
+            slab.remap.resize(slab.vertices.size());
+            slab.numOwnedVertices = 0;
+            for (std::size_t v = 0; v < slab.vertices.size(); ++v) {
+                std::uint64_t key = slab.vertexEdges[v];
+                std::int64_t shared = -1;
+                if (s > 0 && key >= planeBegin && key < planeEnd && key % 3 != 2) {
+                    shared = slabs[s - 1].edgeToVertex.find(key);
+                }
+                slab.remap[v] = (shared >= 0) ? (std::uint32_t(shared) | SHARED_BIT) :
+                                                std::uint32_t(slab.numOwnedVertices++);
+            }
+        }
+    });
+
+    // Compute output offsets of each slab
+    std::vector<std::size_t> vertexOffsets(numSlabs + 1, 0);
+    std::vector<std::size_t> indexOffsets(numSlabs + 1, 0);
+    for (int s = 0; s < numSlabs; ++s) {
+        vertexOffsets[s + 1] = vertexOffsets[s] + slabs[s].numOwnedVertices;
+        indexOffsets[s + 1] = indexOffsets[s] + slabs[s].indices.size();
+    }
+    vertices->resize(vertexOffsets[numSlabs]);
+    normals->resize(vertexOffsets[numSlabs]);
+    indices->resize(indexOffsets[numSlabs]);
+
+    // Copy owned vertices and remapped indices to the output in parallel
+    cg::parallelFor(0, numSlabs, [&](int begin, int end) {
+        for (int s = begin; s < end; ++s) {
+            const SlabMesh &slab = slabs[s];
+            std::vector<std::uint32_t> globalIndex(slab.vertices.size());
+            for (std::size_t v = 0; v < slab.vertices.size(); ++v) {
+                std::uint32_t r = slab.remap[v];
+                if (r & SHARED_BIT) {
+                    // Vertices on the top plane are always owned
+                    std::uint32_t below = r & ~SHARED_BIT;
+                    globalIndex[v] = std::uint32_t(vertexOffsets[s - 1] + slabs[s - 1].remap[below]);
+                }
+                else {
+                    globalIndex[v] = std::uint32_t(vertexOffsets[s] + r);
+                    (*vertices)[globalIndex[v]] = slab.vertices[v];
+                    (*normals)[globalIndex[v]] = slab.normals[v];
+                }
+            }
+            std::uint32_t *out = &(*indices)[0] + indexOffsets[s];
+            for (std::size_t i = 0; i < slab.indices.size(); ++i) {
+                out[i] = globalIndex[slab.indices[i]];
+            }
+        }
+    });
+
+    // Display log message
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    std::size_t numTriangles = indices->size() / 3;
+    std::size_t nBytes = vertices->size() * 2 * sizeof(glm::vec3) + indices->size() * sizeof(std::uint32_t);
+    std::cout << "Extracted isosurface " << isovalue << ": " << numTriangles << " triangles, "
+              << vertices->size() << " vertices in " << seconds << " s ("
+              << numTriangles / std::max(seconds, 1e-9) / 1e6 << " Mtriangles/s, "
+              << nBytes / (1024.0 * 1024.0) << " MB)" << std::endl;
+}
+
+} // namespace
+
+
+
+namespace cg {
+
+template <typename VoxelType>
+void volumeExtractIsosurface(Volume<VoxelType> &volume, float isovalue,
+                             std::vector<glm::vec3> *vertices,
+                             std::vector<glm::vec3> *normals,
+                             std::vector<std::uint32_t> *indices)
+{
+    extractIsosurface<VoxelType>(volume.base, isovalue, vertices, normals, indices);
+}
+
+template void volumeExtractIsosurface(VolumeUInt8 &, float, std::vector<glm::vec3> *,
+                                      std::vector<glm::vec3> *, std::vector<std::uint32_t> *);
+template void volumeExtractIsosurface(VolumeUInt16 &, float, std::vector<glm::vec3> *,
+                                      std::vector<glm::vec3> *, std::vector<std::uint32_t> *);
+template void volumeExtractIsosurface(VolumeInt16 &, float, std::vector<glm::vec3> *,
+                                      std::vector<glm::vec3> *, std::vector<std::uint32_t> *);
+template void volumeExtractIsosurface(VolumeUInt32 &, float, std::vector<glm::vec3> *,
+                                      std::vector<glm::vec3> *, std::vector<std::uint32_t> *);
+template void volumeExtractIsosurface(VolumeFloat32 &, float, std::vector<glm::vec3> *,
+                                      std::vector<glm::vec3> *, std::vector<std::uint32_t> *);
+
+bool volumeExtractIsosurface(const VolumeBase &volume, float isovalue,
+                             std::vector<glm::vec3> *vertices,
+                             std::vector<glm::vec3> *normals,
+                             std::vector<std::uint32_t> *indices)
+{
+    if (volume.datatype == "uint8") {
+        extractIsosurface<std::uint8_t>(volume, isovalue, vertices, normals, indices);
+    }
+    else if (volume.datatype == "uint16") {
+        extractIsosurface<std::uint16_t>(volume, isovalue, vertices, normals, indices);
+    }
+    else if (volume.datatype == "int16") {
+        extractIsosurface<std::int16_t>(volume, isovalue, vertices, normals, indices);
+    }
+    else if (volume.datatype == "uint32") {
+        extractIsosurface<std::uint32_t>(volume, isovalue, vertices, normals, indices);
+    }
+    else if (volume.datatype == "float32") {
+        extractIsosurface<float>(volume, isovalue, vertices, normals, indices);
+    }
+    else {
+        return false;
+    }
+    return true;
+}
+
+} // namespace cg
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "cgVolume.h"
+
+#include <vector>
+#include <cstdint>
+
+namespace cg {
+
+// Extracts the isosurface at the given isovalue (in voxel units) from a
+// volume image with marching cubes, as an indexed triangle mesh with
+// per-vertex normals. Voxels with values >= isovalue are inside. The
+// volume is processed in z-slabs on all cores, and vertices on shared
+// cell edges are merged via edge hashing, so the mesh is watertight.
+// Normals are taken from the central-difference volume gradient and
+// point towards lower values. Vertices are placed in the same space as
+// the 2-unit cube transformed by volumeComputeModelMatrix, so the mesh
+// lines up with the ray-cast image of the volume.
+template <typename VoxelType>
+void volumeExtractIsosurface(Volume<VoxelType> &volume, float isovalue,
+                             std::vector<glm::vec3> *vertices,
+                             std::vector<glm::vec3> *normals,
+                             std::vector<std::uint32_t> *indices);
+
+// Same as above, for an untyped volume image. Returns false if the
+// datatype of the volume is not supported.
+bool volumeExtractIsosurface(const VolumeBase &volume, float isovalue,
+                             std::vector<glm::vec3> *vertices,
+                             std::vector<glm::vec3> *normals,
+                             std::vector<std::uint32_t> *indices);
+
+} // namespace cg
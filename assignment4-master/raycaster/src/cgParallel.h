@@ -0,0 +1,52 @@
+#pragma once
+
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+
+namespace cg {
+
+// Returns the number of worker threads used by the parallel helpers
+inline int parallelNumThreads()
+{
+    unsigned numThreads = std::thread::hardware_concurrency();
+    return numThreads > 0 ? int(numThreads) : 1;
+}
+
+// Splits the range [begin, end) into chunks of grainSize items and
+// calls func(chunkBegin, chunkEnd) for every chunk, using all worker
+// threads (including the calling thread). Chunks are handed out
+// dynamically, so uneven workloads are balanced automatically. Blocks
+// until the whole range has been processed.
+template <typename Func>
+void parallelFor(int begin, int end, Func func, int grainSize = 1)
+{
+    if (end <= begin) {
+        return;
+    }
+    grainSize = std::max(grainSize, 1);
+    int numChunks = (end - begin + grainSize - 1) / grainSize;
+    int numThreads = std::min(parallelNumThreads(), numChunks);
+
+    std::atomic<int> nextChunk(0);
+    auto worker = [&]() {
+        int chunk;
+        while ((chunk = nextChunk.fetch_add(1)) < numChunks) {
+            int chunkBegin = begin + chunk * grainSize;
+            int chunkEnd = std::min(chunkBegin + grainSize, end);
+            func(chunkBegin, chunkEnd);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int i = 1; i < numThreads; ++i) {
+        threads.push_back(std::thread(worker));
+    }
+    worker();
+    for (auto &thread : threads) {
+        thread.join();
+    }
+}
+
+} // namespace cg
@@ -4,6 +4,8 @@
 #include <fstream>
 #include <cstdio>
 #include <cstring>
+#include <limits>
+#include <algorithm>
 
 namespace {
 
@@ -199,17 +201,53 @@ void readVTKBinary(std::ifstream &is, std::vector<T> *imageData, int n)
     }
 }
 
-// Read image data in ASCII format
+// Read image data in ASCII format. Values are read via the promoted
+// type, so that 8-bit voxels are parsed as numbers and not characters.
 template<typename T>
 void readVTKASCII(std::ifstream &is, std::vector<T> *imageData, int n)
 {
-    T value;
+    decltype(+T()) value;
     for(int i = 0; i < n; i++) {
         is >> value;
-        imageData->push_back(value);
+        imageData->push_back(T(value));
     }
 }
 
+// Write image data in binary (big-endian) format. The data is byte
+// swapped in blocks, so that no full copy of the volume is needed.
+template<typename T>
+bool writeVTKBinary(std::ofstream &os, const std::vector<std::uint8_t> &data)
+{
+    if (!isLittleEndian() || sizeof(T) == 1) {
+        os.write(reinterpret_cast<const char *>(&data[0]), data.size());
+        return bool(os);
+    }
+
+    const std::size_t blockSizeInBytes = (1 << 20) * sizeof(T);
+    std::vector<T> block;
+    for (std::size_t offset = 0; offset < data.size(); offset += blockSizeInBytes) {
+        std::size_t nBytes = std::min(blockSizeInBytes, data.size() - offset);
+        block.resize(nBytes / sizeof(T));
+        std::memcpy(&block[0], &data[offset], nBytes);
+        swapByteOrder(&block);
+        os.write(reinterpret_cast<const char *>(&block[0]), nBytes);
+    }
+    return bool(os);
+}
+
+// Write image data in ASCII format, sixteen values per line
+template<typename T>
+bool writeVTKASCII(std::ofstream &os, const std::vector<std::uint8_t> &data)
+{
+    const T *values = reinterpret_cast<const T *>(&data[0]);
+    std::size_t n = data.size() / sizeof(T);
+    os.precision(std::numeric_limits<T>::max_digits10);
+    for (std::size_t i = 0; i < n; ++i) {
+        os << +values[i] << ((i % 16 == 15 || i == n - 1) ? '\n' : ' ');
+    }
+    return bool(os);
+}
+
 // Read the header part (the first ten lines) of the file
 bool readHeader(const std::string filename, VTKHeader *header)
 {
@@ -383,4 +421,87 @@ bool volumeLoadVTK(VolumeBase *volume, const std::string &filename)
     return true;
 }
 
+// Write a volume image in the legacy VTK StructuredPoints format
+// to a file, using the same ten line header that volumeLoadVTK reads.
+// Binary data is stored in big-endian byte order, as required by VTK.
+bool volumeSaveVTK(const VolumeBase &volume, const std::string &filename, bool binary)
+{
+    std::string typestring;
+    if (volume.datatype == "uint8") {
+        typestring = "unsigned_char";
+    }
+    else if (volume.datatype == "uint16") {
+        typestring = "unsigned_short";
+    }
+    else if (volume.datatype == "int16") {
+        typestring = "short";
+    }
+    else if (volume.datatype == "uint32") {
+        typestring = "unsigned_int";
+    }
+    else if (volume.datatype == "float32") {
+        typestring = "float";
+    }
+    else {
+        std::cerr << "Error: Unsupported datatype " << volume.datatype << std::endl;
+        return false;
+    }
+
+    std::size_t numElements = std::size_t(volume.dimensions[0]) *
+                              volume.dimensions[1] * volume.dimensions[2];
+    if (numElements == 0 || volume.data.empty()) {
+        std::cerr << "Error: Volume is empty" << std::endl;
+        return false;
+    }
+
+    std::ofstream VTKFile(filename, std::ios::binary);
+    if (!VTKFile.is_open()) {
+        std::cerr << "Could not open " << filename << std::endl;
+        return false;
+    }
+
+    // Write header
+    VTKFile << "# vtk DataFile Version 3.0\n"
+            << "Written by cg::volumeSaveVTK\n"
+            << (binary ? "BINARY\n" : "ASCII\n")
+            << "DATASET STRUCTURED_POINTS\n"
+            << "DIMENSIONS " << volume.dimensions[0] << " "
+            << volume.dimensions[1] << " " << volume.dimensions[2] << "\n"
+            << "ORIGIN " << volume.origin[0] << " "
+            << volume.origin[1] << " " << volume.origin[2] << "\n"
+            << "SPACING " << volume.spacing[0] << " "
+            << volume.spacing[1] << " " << volume.spacing[2] << "\n"
+            << "POINT_DATA " << numElements << "\n"
+            << "SCALARS image_data " << typestring << "\n"
+            << "LOOKUP_TABLE default\n";
+
+    // Write data
+    bool ok = false;
+    if (volume.datatype == "uint8") {
+        ok = binary ? writeVTKBinary<uint8_t>(VTKFile, volume.data) :
+                      writeVTKASCII<uint8_t>(VTKFile, volume.data);
+    }
+    else if (volume.datatype == "uint16") {
+        ok = binary ? writeVTKBinary<uint16_t>(VTKFile, volume.data) :
+                      writeVTKASCII<uint16_t>(VTKFile, volume.data);
+    }
+    else if (volume.datatype == "int16") {
+        ok = binary ? writeVTKBinary<int16_t>(VTKFile, volume.data) :
+                      writeVTKASCII<int16_t>(VTKFile, volume.data);
+    }
+    else if (volume.datatype == "uint32") {
+        ok = binary ? writeVTKBinary<uint32_t>(VTKFile, volume.data) :
+                      writeVTKASCII<uint32_t>(VTKFile, volume.data);
+    }
+    else if (volume.datatype == "float32") {
+        ok = binary ? writeVTKBinary<float>(VTKFile, volume.data) :
+                      writeVTKASCII<float>(VTKFile, volume.data);
+    }
+    if (!ok) {
+        std::cerr << "Error: Could not write " << filename << std::endl;
+    }
+
+    return ok;
+}
+
 } // namespace cg
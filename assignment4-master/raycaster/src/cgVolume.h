@@ -83,4 +83,9 @@ inline glm::mat4 volumeComputeModelMatrix(const VolumeBase &volume)
 // raw data........\n
 bool volumeLoadVTK(VolumeBase *volume, const std::string &filename);
 
+// Writes a volume image in the legacy VTK StructuredPoints format
+// (same ten line header as above) to a file, with the data section
+// in binary or ASCII format. Returns true on success, false otherwise.
+bool volumeSaveVTK(const VolumeBase &volume, const std::string &filename, bool binary = true);
+
 } // namespace cg
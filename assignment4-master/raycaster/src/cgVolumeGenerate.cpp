@@ -0,0 +1,269 @@
+#include "cgVolumeGenerate.h"
+#include "cgParallel.h"
+
+#include <iostream>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+namespace {
+
+const float PI = 3.14159265358979f;
+
+// Hash integer lattice coordinates and a seed into 32 random bits
+std::uint32_t hash3(int x, int y, int z, std::uint32_t seed)
+{
+    std::uint32_t h = seed * 0x9e3779b9u;
+    h ^= std::uint32_t(x) * 0x8da6b343u;
+    h ^= std::uint32_t(y) * 0xd8163841u;
+    h ^= std::uint32_t(z) * 0xcb1ab31fu;
+    h = (h ^ (h >> 16)) * 0x7feb352du;
+    h = (h ^ (h >> 15)) * 0x846ca68bu;
+    return h ^ (h >> 16);
+}
+
+// Map 32 random bits to a float in [0, 1)
+float hashToUnit(std::uint32_t h)
+{
+    return (h >> 8) * (1.0f / 16777216.0f);
+}
+
+// Dot product between the lattice gradient selected by h and (x, y, z).
+// Uses the twelve cube edge directions, padded to sixteen entries as in
+// Perlin's improved noise, so that the gradient is picked with a mask.
+float gradientDot(std::uint32_t h, float x, float y, float z)
+{
+    static const float gradients[16][3] = {
+        { 1, 1, 0 }, { -1, 1, 0 }, { 1, -1, 0 }, { -1, -1, 0 },
+        { 1, 0, 1 }, { -1, 0, 1 }, { 1, 0, -1 }, { -1, 0, -1 },
+        { 0, 1, 1 }, { 0, -1, 1 }, { 0, 1, -1 }, { 0, -1, -1 },
+        { 1, 1, 0 }, { -1, 1, 0 }, { 0, -1, 1 }, { 0, -1, -1 }
+    };
+    const float *g = gradients[h & 15];
+    return g[0] * x + g[1] * y + g[2] * z;
+}
+
+// Quintic interpolation curve used by gradient noise
+float fade(float t)
+{
+    return t * t * t * (t * (t * 6.0f - 15.0f) + 10.0f);
+}
+
+float lerp(float a, float b, float t)
+{
+    return a + t * (b - a);
+}
+
+// Gradient (Perlin-style) noise in approximately [-1, 1]
+float gradientNoise(float x, float y, float z, std::uint32_t seed)
+{
+    float fx = std::floor(x), fy = std::floor(y), fz = std::floor(z);
+    int ix = int(fx), iy = int(fy), iz = int(fz);
+    x -= fx; y -= fy; z -= fz;
+    float u = fade(x), v = fade(y), w = fade(z);
+
+    float n000 = gradientDot(hash3(ix, iy, iz, seed), x, y, z);
+    float n100 = gradientDot(hash3(ix + 1, iy, iz, seed), x - 1.0f, y, z);
+    float n010 = gradientDot(hash3(ix, iy + 1, iz, seed), x, y - 1.0f, z);
+    float n110 = gradientDot(hash3(ix + 1, iy + 1, iz, seed), x - 1.0f, y - 1.0f, z);
+    float n001 = gradientDot(hash3(ix, iy, iz + 1, seed), x, y, z - 1.0f);
+    float n101 = gradientDot(hash3(ix + 1, iy, iz + 1, seed), x - 1.0f, y, z - 1.0f);
+    float n011 = gradientDot(hash3(ix, iy + 1, iz + 1, seed), x, y - 1.0f, z - 1.0f);
+    float n111 = gradientDot(hash3(ix + 1, iy + 1, iz + 1, seed), x - 1.0f, y - 1.0f, z - 1.0f);
+
+    return lerp(lerp(lerp(n000, n100, u), lerp(n010, n110, u), v),
+                lerp(lerp(n001, n101, u), lerp(n011, n111, u), v), w);
+}
+
+// Marschner-Lobb test signal for p in [-1, 1]^3 (fM = 6, alpha = 0.25)
+float marschnerLobb(const glm::vec3 &p)
+{
+    const float fM = 6.0f;
+    const float alpha = 0.25f;
+    float r = std::sqrt(p.x * p.x + p.y * p.y);
+    float rhoR = std::cos(2.0f * PI * fM * std::cos(PI * r / 2.0f));
+    return (1.0f - std::sin(PI * p.z / 2.0f) + alpha * (1.0f + rhoR)) /
+           (2.0f * (1.0f + alpha));
+}
+
+// Normalized fBm noise for p in [-1, 1]^3
+float fbmNoise(const glm::vec3 &p, const cg::VolumeGenerateParams &params)
+{
+    float sum = 0.0f;
+    float amplitude = 1.0f;
+    float totalAmplitude = 0.0f;
+    float frequency = 0.5f * params.frequency;
+    for (int i = 0; i < params.octaves; ++i) {
+        sum += amplitude * gradientNoise(p.x * frequency, p.y * frequency, p.z * frequency,
+                                         params.seed + i);
+        totalAmplitude += amplitude;
+        amplitude *= 0.5f;
+        frequency *= 2.0f;
+    }
+    if (totalAmplitude > 0.0f) {
+        sum /= totalAmplitude;
+    }
+    return std::min(std::max(0.5f * sum + 0.5f, 0.0f), 1.0f);
+}
+
+// Concentric shells for p in [-1, 1]^3, where odd shells are less dense
+float nestedSpheres(const glm::vec3 &p, const cg::VolumeGenerateParams &params)
+{
+    float r = glm::length(p);
+    if (r >= 1.0f) {
+        return 0.0f;
+    }
+    int numShells = std::max(params.numShells, 1);
+    int shell = int(r * numShells);
+    return (1.0f - r) * ((shell % 2 == 0) ? 1.0f : 0.35f);
+}
+
+// Sparse blobs for voxel (x, y, z). The volume is split into cubic cells
+// and a cell holds a single blob with probability params.occupancy. Blobs
+// never cross cell borders, so empty cells are exactly zero.
+float sparseBlobs(int x, int y, int z, const cg::VolumeGenerateParams &params)
+{
+    int cellSize = std::max(params.cellSize, 1);
+    int cx = x / cellSize, cy = y / cellSize, cz = z / cellSize;
+    std::uint32_t h = hash3(cx, cy, cz, params.seed);
+    if (hashToUnit(h) >= params.occupancy) {
+        return 0.0f;
+    }
+
+    // Derive blob center, radius, and peak density from the cell hash
+    std::uint32_t h1 = hash3(cx, cy, cz, h);
+    std::uint32_t h2 = hash3(cx, cy, cz, h1);
+    std::uint32_t h3 = hash3(cx, cy, cz, h2);
+    glm::vec3 center = glm::vec3(cx + 0.4f + 0.2f * hashToUnit(h1),
+                                 cy + 0.4f + 0.2f * hashToUnit(h2),
+                                 cz + 0.4f + 0.2f * hashToUnit(h3)) * float(cellSize);
+    float radius = cellSize * (0.2f + 0.15f * hashToUnit(h1 ^ h2));
+    float peak = 0.5f + 0.5f * hashToUnit(h2 ^ h3);
+
+    glm::vec3 d = glm::vec3(x + 0.5f, y + 0.5f, z + 0.5f) - center;
+    float t = glm::dot(d, d) / (radius * radius);
+    if (t >= 1.0f) {
+        return 0.0f;
+    }
+    return peak * (1.0f - t) * (1.0f - t);
+}
+
+// Convert a normalized value in [0, 1] to the voxel type
+template<typename VoxelType>
+VoxelType fromUnit(float value)
+{
+    return VoxelType(double(value) * std::numeric_limits<VoxelType>::max() + 0.5);
+}
+
+template<>
+float fromUnit<float>(float value)
+{
+    return value;
+}
+
+// Evaluate the field for every voxel, parallelized over z-slices
+template<typename VoxelType>
+void generateField(cg::VolumeBase *volume, const cg::VolumeGenerateParams &params)
+{
+    glm::ivec3 dims = volume->dimensions;
+    VoxelType *voxels = reinterpret_cast<VoxelType *>(&volume->data[0]);
+    glm::vec3 scale = 2.0f / glm::vec3(dims);
+
+    cg::parallelFor(0, dims.z, [&](int zBegin, int zEnd) {
+        for (int z = zBegin; z < zEnd; ++z) {
+            VoxelType *slice = voxels + std::size_t(dims.x) * dims.y * z;
+            for (int y = 0; y < dims.y; ++y) {
+                VoxelType *row = slice + std::size_t(dims.x) * y;
+                for (int x = 0; x < dims.x; ++x) {
+                    glm::vec3 p = (glm::vec3(x, y, z) + 0.5f) * scale - 1.0f;
+                    float value = 0.0f;
+                    switch (params.field) {
+                    case cg::FIELD_MARSCHNER_LOBB:
+                        value = marschnerLobb(p);
+                        break;
+                    case cg::FIELD_FBM_NOISE:
+                        value = fbmNoise(p, params);
+                        break;
+                    case cg::FIELD_NESTED_SPHERES:
+                        value = nestedSpheres(p, params);
+                        break;
+                    case cg::FIELD_SPARSE_BLOBS:
+                        value = sparseBlobs(x, y, z, params);
+                        break;
+                    default:
+                        break;
+                    }
+                    row[x] = fromUnit<VoxelType>(std::min(std::max(value, 0.0f), 1.0f));
+                }
+            }
+        }
+    });
+}
+
+// Allocate the voxel data and fill it with the field
+template<typename VoxelType>
+void allocateAndGenerate(cg::VolumeBase *volume, const cg::VolumeGenerateParams &params)
+{
+    std::size_t numVoxels = std::size_t(volume->dimensions.x) *
+                            volume->dimensions.y * volume->dimensions.z;
+    volume->data.clear();
+    volume->data.shrink_to_fit();
+    volume->data.resize(numVoxels * sizeof(VoxelType));
+    generateField<VoxelType>(volume, params);
+}
+
+} // namespace
+
+
+
+namespace cg {
+
+const char *volumeFieldName(VolumeField field)
+{
+    switch (field) {
+    case FIELD_MARSCHNER_LOBB: return "marschner_lobb";
+    case FIELD_FBM_NOISE: return "fbm_noise";
+    case FIELD_NESTED_SPHERES: return "nested_spheres";
+    case FIELD_SPARSE_BLOBS: return "sparse_blobs";
+    default: return "unknown";
+    }
+}
+
+bool volumeGenerate(VolumeBase *volume, const glm::ivec3 &dimensions,
+                    const std::string &datatype, const VolumeGenerateParams &params)
+{
+    if (dimensions.x <= 0 || dimensions.y <= 0 || dimensions.z <= 0) {
+        std::cerr << "Error: Invalid volume dimensions" << std::endl;
+        return false;
+    }
+    if (datatype != "uint8" && datatype != "uint16" && datatype != "int16" &&
+        datatype != "uint32" && datatype != "float32") {
+        std::cerr << "Error: Unsupported datatype " << datatype << std::endl;
+        return false;
+    }
+
+    volume->dimensions = dimensions;
+    volume->origin = glm::vec3(0.0f, 0.0f, 0.0f);
+    volume->spacing = glm::vec3(1.0f, 1.0f, 1.0f);
+    volume->datatype = datatype;
+
+    if (datatype == "uint8") {
+        allocateAndGenerate<std::uint8_t>(volume, params);
+    }
+    else if (datatype == "uint16") {
+        allocateAndGenerate<std::uint16_t>(volume, params);
+    }
+    else if (datatype == "int16") {
+        allocateAndGenerate<std::int16_t>(volume, params);
+    }
+    else if (datatype == "uint32") {
+        allocateAndGenerate<std::uint32_t>(volume, params);
+    }
+    else {
+        allocateAndGenerate<float>(volume, params);
+    }
+
+    return true;
+}
+
+} // namespace cg
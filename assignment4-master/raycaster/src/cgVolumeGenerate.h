@@ -0,0 +1,53 @@
+#pragma once
+
+#include "cgVolume.h"
+
+#include <string>
+#include <cstdint>
+
+namespace cg {
+
+// Procedural scalar fields that can be used to fill a volume image
+enum VolumeField {
+    FIELD_MARSCHNER_LOBB = 0,  // Marschner-Lobb test signal
+    FIELD_FBM_NOISE,  // fractional Brownian motion (fBm) gradient noise
+    FIELD_NESTED_SPHERES,  // concentric shells of alternating density
+    FIELD_SPARSE_BLOBS,  // random blobs in a sparse set of cells
+    NUM_VOLUME_FIELDS
+};
+
+// Parameters for procedural volume generation. Fields that do not
+// apply to the selected VolumeField are ignored.
+struct VolumeGenerateParams {
+    VolumeField field;
+    std::uint32_t seed;  // seed for noise and blob placement
+    float frequency;  // base frequency of fBm noise (periods per volume)
+    int octaves;  // number of fBm octaves
+    int numShells;  // number of nested sphere shells
+    float occupancy;  // fraction of cells that contain a blob [0, 1]
+    int cellSize;  // size (in voxels) of the cubic blob cells
+
+    VolumeGenerateParams() :
+        field(FIELD_MARSCHNER_LOBB),
+        seed(1),
+        frequency(4.0f),
+        octaves(5),
+        numShells(4),
+        occupancy(0.1f),
+        cellSize(16)
+    {}
+};
+
+// Returns a short name ("marschner_lobb", "fbm_noise", ...) for a field
+const char *volumeFieldName(VolumeField field);
+
+// Fills a volume image with a procedural field, evaluated in parallel
+// over all cores. The field is normalized to [0, 1] and scaled to the
+// full range of the datatype (int16 uses [0, 32767]). Possible
+// datatypes are: "uint8", "uint16", "int16", "uint32", and "float32".
+// The origin is set to zero and the spacing to one. Returns true on
+// success, false otherwise (the volume is then left unchanged).
+bool volumeGenerate(VolumeBase *volume, const glm::ivec3 &dimensions,
+                    const std::string &datatype, const VolumeGenerateParams &params);
+
+} // namespace cg
@@ -0,0 +1,277 @@
+#include "cgVolumeResample.h"
+#include "cgParallel.h"
+
+#include <iostream>
+#include <cmath>
+#include <limits>
+#include <vector>
+#include <algorithm>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+// Precomputed 1D filter weights for resampling one axis. Output sample
+// o is the weighted sum of count[o] input samples starting at first[o],
+// with weights starting at weights[offset[o]].
+struct Filter1D {
+    std::vector<int> first;
+    std::vector<int> count;
+    std::vector<int> offset;
+    std::vector<float> weights;
+};
+
+// Build a normalized tent filter for resampling inSize samples to
+// outSize samples. The tent is as wide as the resampling ratio, so each
+// output sample covers the input samples it replaces (no aliasing).
+Filter1D makeTentFilter(int inSize, int outSize)
+{
+    Filter1D filter;
+    float ratio = float(inSize) / float(outSize);
+    float radius = std::max(ratio, 1.0f);
+    for (int o = 0; o < outSize; ++o) {
+        float center = (o + 0.5f) * ratio - 0.5f;
+        int first = std::max(int(std::ceil(center - radius)), 0);
+        int last = std::min(int(std::floor(center + radius)), inSize - 1);
+
+        filter.first.push_back(first);
+        filter.offset.push_back(int(filter.weights.size()));
+        float sum = 0.0f;
+        for (int i = first; i <= last; ++i) {
+            float w = std::max(1.0f - std::fabs(i - center) / radius, 0.0f);
+            filter.weights.push_back(w);
+            sum += w;
+        }
+        filter.count.push_back(last - first + 1);
+        for (int k = 0; k < filter.count.back(); ++k) {
+            filter.weights[filter.offset.back() + k] /= sum;
+        }
+    }
+    return filter;
+}
+
+// y += a * x, for float arrays of length n
+void axpy(float *y, float a, const float *x, int n)
+{
+    int i = 0;
+#ifdef __SSE2__
+    __m128 va = _mm_set1_ps(a);
+    for (; i + 4 <= n; i += 4) {
+        __m128 vy = _mm_loadu_ps(y + i);
+        vy = _mm_add_ps(vy, _mm_mul_ps(va, _mm_loadu_ps(x + i)));
+        _mm_storeu_ps(y + i, vy);
+    }
+#endif
+    for (; i < n; ++i) {
+        y[i] += a * x[i];
+    }
+}
+
+// Convert a filtered value back to the voxel type (round and clamp)
+template<typename VoxelType>
+VoxelType toVoxel(float value)
+{
+    double v = std::floor(double(value) + 0.5);
+    v = std::min(std::max(v, double(std::numeric_limits<VoxelType>::lowest())),
+                 double(std::numeric_limits<VoxelType>::max()));
+    return VoxelType(v);
+}
+
+template<>
+float toVoxel<float>(float value)
+{
+    return value;
+}
+
+// Resample the voxel data, parallelized over output z-slices. Each
+// output slice accumulates the input slices in its z-footprint, after
+// filtering them in x and then y.
+template<typename VoxelType>
+void resampleData(const cg::VolumeBase &volume, const glm::ivec3 &outDims,
+                  std::vector<std::uint8_t> *outData)
+{
+    glm::ivec3 inDims = volume.dimensions;
+    const VoxelType *in = reinterpret_cast<const VoxelType *>(&volume.data[0]);
+    outData->resize(std::size_t(outDims.x) * outDims.y * outDims.z * sizeof(VoxelType));
+    VoxelType *out = reinterpret_cast<VoxelType *>(&(*outData)[0]);
+
+    Filter1D filterX = makeTentFilter(inDims.x, outDims.x);
+    Filter1D filterY = makeTentFilter(inDims.y, outDims.y);
+    Filter1D filterZ = makeTentFilter(inDims.z, outDims.z);
+    std::size_t outSliceSize = std::size_t(outDims.x) * outDims.y;
+
+    int grainSize = std::max(outDims.z / (4 * cg::parallelNumThreads()), 1);
+    cg::parallelFor(0, outDims.z, [&](int zBegin, int zEnd) {
+        std::vector<float> rows(std::size_t(outDims.x) * inDims.y);
+        std::vector<float> slice(outSliceSize);
+        std::vector<float> acc(outSliceSize);
+        for (int zo = zBegin; zo < zEnd; ++zo) {
+            std::fill(acc.begin(), acc.end(), 0.0f);
+            for (int kz = 0; kz < filterZ.count[zo]; ++kz) {
+                int zi = filterZ.first[zo] + kz;
+                float wz = filterZ.weights[filterZ.offset[zo] + kz];
+
+                // Filter along x
+                for (int yi = 0; yi < inDims.y; ++yi) {
+                    const VoxelType *inRow = in + (std::size_t(zi) * inDims.y + yi) * inDims.x;
+                    float *row = &rows[std::size_t(yi) * outDims.x];
+                    for (int xo = 0; xo < outDims.x; ++xo) {
+                        const VoxelType *src = inRow + filterX.first[xo];
+                        const float *w = &filterX.weights[filterX.offset[xo]];
+                        float sum = 0.0f;
+                        for (int kx = 0; kx < filterX.count[xo]; ++kx) {
+                            sum += w[kx] * float(src[kx]);
+                        }
+                        row[xo] = sum;
+                    }
+                }
+
+                // Filter along y
+                std::fill(slice.begin(), slice.end(), 0.0f);
+                for (int yo = 0; yo < outDims.y; ++yo) {
+                    for (int ky = 0; ky < filterY.count[yo]; ++ky) {
+                        int yi = filterY.first[yo] + ky;
+                        axpy(&slice[std::size_t(yo) * outDims.x], filterY.weights[filterY.offset[yo] + ky],
+                             &rows[std::size_t(yi) * outDims.x], outDims.x);
+                    }
+                }
+
+                // Accumulate along z
+                axpy(&acc[0], wz, &slice[0], int(outSliceSize));
+            }
+
+            VoxelType *outSlice = out + outSliceSize * zo;
+            for (std::size_t i = 0; i < outSliceSize; ++i) {
+                outSlice[i] = toVoxel<VoxelType>(acc[i]);
+            }
+        }
+    }, grainSize);
+}
+
+} // namespace
+
+
+
+namespace cg {
+
+std::size_t volumeVoxelSize(const std::string &datatype)
+{
+    if (datatype == "uint8") {
+        return 1;
+    }
+    else if (datatype == "uint16" || datatype == "int16") {
+        return 2;
+    }
+    else if (datatype == "uint32" || datatype == "float32") {
+        return 4;
+    }
+    return 0;
+}
+
+glm::ivec3 volumeFitDimensions(const VolumeBase &volume, std::size_t budgetBytes,
+                               int maxDimension)
+{
+    std::size_t voxelSize = std::max(volumeVoxelSize(volume.datatype), std::size_t(1));
+    glm::ivec3 maxDims = glm::min(volume.dimensions, glm::ivec3(std::max(maxDimension, 1)));
+    auto fits = [&](const glm::ivec3 &d) {
+        return std::size_t(d.x) * d.y * d.z * voxelSize <= budgetBytes;
+    };
+    if (fits(maxDims)) {
+        return maxDims;
+    }
+
+    // Dimensions for a target physical voxel size h. Axes that are
+    // already coarser than h keep their resolution.
+    glm::vec3 extent = glm::vec3(volume.dimensions) * glm::abs(volume.spacing);
+    for (int i = 0; i < 3; ++i) {
+        if (!(extent[i] > 0.0f)) {
+            extent[i] = float(volume.dimensions[i]);
+        }
+    }
+    auto dimsFor = [&](double h) {
+        glm::ivec3 d;
+        for (int i = 0; i < 3; ++i) {
+            d[i] = int(std::min(double(maxDims[i]), std::max(std::floor(extent[i] / h), 1.0)));
+        }
+        return d;
+    };
+
+    // Binary search for the smallest voxel size that fits
+    double lo = 0.0;
+    double hi = std::max(extent.x, std::max(extent.y, extent.z));
+    for (int i = 0; i < 64; ++i) {
+        double mid = 0.5 * (lo + hi);
+        if (fits(dimsFor(mid))) {
+            hi = mid;
+        }
+        else {
+            lo = mid;
+        }
+    }
+    glm::ivec3 dims = dimsFor(hi);
+
+    // Spend any remaining budget on the axis with the coarsest voxels
+    while (true) {
+        int best = -1;
+        float bestSize = 0.0f;
+        for (int i = 0; i < 3; ++i) {
+            glm::ivec3 d = dims;
+            d[i]++;
+            float size = extent[i] / dims[i];
+            if (d[i] <= maxDims[i] && fits(d) && size > bestSize) {
+                best = i;
+                bestSize = size;
+            }
+        }
+        if (best < 0) {
+            break;
+        }
+        dims[best]++;
+    }
+
+    return dims;
+}
+
+bool volumeResample(const VolumeBase &volume, const glm::ivec3 &dimensions,
+                    VolumeBase *resampled)
+{
+    if (dimensions.x <= 0 || dimensions.y <= 0 || dimensions.z <= 0 || volume.data.empty()) {
+        std::cerr << "Error: Invalid volume dimensions" << std::endl;
+        return false;
+    }
+
+    std::vector<std::uint8_t> data;
+    if (volume.datatype == "uint8") {
+        resampleData<std::uint8_t>(volume, dimensions, &data);
+    }
+    else if (volume.datatype == "uint16") {
+        resampleData<std::uint16_t>(volume, dimensions, &data);
+    }
+    else if (volume.datatype == "int16") {
+        resampleData<std::int16_t>(volume, dimensions, &data);
+    }
+    else if (volume.datatype == "uint32") {
+        resampleData<std::uint32_t>(volume, dimensions, &data);
+    }
+    else if (volume.datatype == "float32") {
+        resampleData<float>(volume, dimensions, &data);
+    }
+    else {
+        std::cerr << "Error: Unsupported datatype " << volume.datatype << std::endl;
+        return false;
+    }
+
+    // Keep the extent (dimensions * spacing) of the volume unchanged
+    glm::vec3 spacing = volume.spacing * glm::vec3(volume.dimensions) / glm::vec3(dimensions);
+    resampled->dimensions = dimensions;
+    resampled->origin = volume.origin;
+    resampled->spacing = spacing;
+    resampled->datatype = volume.datatype;
+    resampled->data.swap(data);
+
+    return true;
+}
+
+} // namespace cg
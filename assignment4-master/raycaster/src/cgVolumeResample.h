@@ -0,0 +1,30 @@
+#pragma once
+
+#include "cgVolume.h"
+
+#include <string>
+#include <cstddef>
+
+namespace cg {
+
+// Returns the size in bytes of one voxel of the given datatype, or zero
+// if the datatype is not supported
+std::size_t volumeVoxelSize(const std::string &datatype);
+
+// Returns the largest dimensions (at most the current ones and at most
+// maxDimension along each axis) for which the volume fits in budgetBytes.
+// The reduction is anisotropy-aware: axes with the finest physical
+// spacing are reduced first, so the voxels become as isotropic as
+// possible before coarse axes lose any resolution.
+glm::ivec3 volumeFitDimensions(const VolumeBase &volume, std::size_t budgetBytes,
+                               int maxDimension);
+
+// Resamples a volume image to new (smaller or equal) dimensions with a
+// separable tent filter, in parallel over output z-slices. The spacing
+// is adjusted so that the extent of the volume, and thus the matrix from
+// volumeComputeModelMatrix, stays the same. Returns true on success,
+// false otherwise.
+bool volumeResample(const VolumeBase &volume, const glm::ivec3 &dimensions,
+                    VolumeBase *resampled);
+
+} // namespace cg
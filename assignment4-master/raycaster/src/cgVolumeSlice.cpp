@@ -0,0 +1,256 @@
+#include "cgVolumeSlice.h"
+#include "cgParallel.h"
+
+#include <cmath>
+#include <algorithm>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+// Voxel data with dimensions and strides, with the axes permuted so
+// that a plane lying in a voxel slice always has a constant z
+template<typename VoxelType>
+struct SliceSampler {
+    const VoxelType *data;
+    int dims[3];
+    std::ptrdiff_t strides[3];
+};
+
+inline float lerp(float a, float b, float t)
+{
+    return a + t * (b - a);
+}
+
+// Returns the (bi- or trilinearly) interpolated value at p, or zero
+// if p is outside the volume
+template<typename VoxelType, bool Trilinear>
+float sample(const SliceSampler<VoxelType> &s, float px, float py, float pz)
+{
+    if (!(px >= 0.0f && px <= s.dims[0] - 1 && py >= 0.0f && py <= s.dims[1] - 1 &&
+          pz >= 0.0f && pz <= s.dims[2] - 1)) {
+        return 0.0f;
+    }
+
+    int x0 = int(px), y0 = int(py), z0 = int(pz);
+    float fx = px - x0, fy = py - y0, fz = pz - z0;
+    std::ptrdiff_t dx = (x0 < s.dims[0] - 1) ? s.strides[0] : 0;
+    std::ptrdiff_t dy = (y0 < s.dims[1] - 1) ? s.strides[1] : 0;
+    const VoxelType *v = s.data + x0 * s.strides[0] + y0 * s.strides[1] + z0 * s.strides[2];
+
+    float c0 = lerp(lerp(float(v[0]), float(v[dx]), fx),
+                    lerp(float(v[dy]), float(v[dx + dy]), fx), fy);
+    if (!Trilinear) {
+        return c0;
+    }
+    std::ptrdiff_t dz = (z0 < s.dims[2] - 1) ? s.strides[2] : 0;
+    float c1 = lerp(lerp(float(v[dz]), float(v[dz + dx]), fx),
+                    lerp(float(v[dz + dy]), float(v[dz + dx + dy]), fx), fy);
+    return lerp(c0, c1, fz);
+}
+
+// Samples one row of the slice image, starting at p and advancing by
+// step. The SSE2 path computes coordinates, weights, and bounds masks
+// for four pixels at a time and only gathers the corner voxels in
+// scalar code.
+template<typename VoxelType, bool Trilinear>
+void sampleRow(const SliceSampler<VoxelType> &s, const glm::vec3 &p, const glm::vec3 &step,
+               int width, float *out)
+{
+    int i = 0;
+#ifdef __SSE2__
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 maxX = _mm_set1_ps(float(s.dims[0] - 1));
+    const __m128 maxY = _mm_set1_ps(float(s.dims[1] - 1));
+    const __m128 maxZ = _mm_set1_ps(float(s.dims[2] - 1));
+    alignas(16) int x0[4], y0[4], z0[4];
+    alignas(16) float c[8][4];
+    for (; i + 4 <= width; i += 4) {
+        __m128 lane = _mm_set_ps(i + 3.0f, i + 2.0f, i + 1.0f, float(i));
+        __m128 px = _mm_add_ps(_mm_set1_ps(p.x), _mm_mul_ps(lane, _mm_set1_ps(step.x)));
+        __m128 py = _mm_add_ps(_mm_set1_ps(p.y), _mm_mul_ps(lane, _mm_set1_ps(step.y)));
+        __m128 pz = _mm_add_ps(_mm_set1_ps(p.z), _mm_mul_ps(lane, _mm_set1_ps(step.z)));
+        __m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(px, zero), _mm_cmple_ps(px, maxX)),
+                                   _mm_and_ps(_mm_cmpge_ps(py, zero), _mm_cmple_ps(py, maxY)));
+        inside = _mm_and_ps(inside, _mm_and_ps(_mm_cmpge_ps(pz, zero), _mm_cmple_ps(pz, maxZ)));
+        if (_mm_movemask_ps(inside) == 0) {
+            _mm_storeu_ps(out + i, zero);
+            continue;
+        }
+
+        // Clamp so that lanes outside the volume still gather valid voxels
+        px = _mm_min_ps(_mm_max_ps(px, zero), maxX);
+        py = _mm_min_ps(_mm_max_ps(py, zero), maxY);
+        pz = _mm_min_ps(_mm_max_ps(pz, zero), maxZ);
+        __m128i ix = _mm_cvttps_epi32(px);
+        __m128i iy = _mm_cvttps_epi32(py);
+        __m128i iz = _mm_cvttps_epi32(pz);
+        __m128 fx = _mm_sub_ps(px, _mm_cvtepi32_ps(ix));
+        __m128 fy = _mm_sub_ps(py, _mm_cvtepi32_ps(iy));
+        __m128 fz = _mm_sub_ps(pz, _mm_cvtepi32_ps(iz));
+        _mm_store_si128(reinterpret_cast<__m128i *>(x0), ix);
+        _mm_store_si128(reinterpret_cast<__m128i *>(y0), iy);
+        _mm_store_si128(reinterpret_cast<__m128i *>(z0), iz);
+
+        for (int k = 0; k < 4; ++k) {
+            std::ptrdiff_t dx = (x0[k] < s.dims[0] - 1) ? s.strides[0] : 0;
+            std::ptrdiff_t dy = (y0[k] < s.dims[1] - 1) ? s.strides[1] : 0;
+            const VoxelType *v = s.data + x0[k] * s.strides[0] + y0[k] * s.strides[1] +
+                                 z0[k] * s.strides[2];
+            c[0][k] = float(v[0]);
+            c[1][k] = float(v[dx]);
+            c[2][k] = float(v[dy]);
+            c[3][k] = float(v[dx + dy]);
+            if (Trilinear) {
+                std::ptrdiff_t dz = (z0[k] < s.dims[2] - 1) ? s.strides[2] : 0;
+                c[4][k] = float(v[dz]);
+                c[5][k] = float(v[dz + dx]);
+                c[6][k] = float(v[dz + dy]);
+                c[7][k] = float(v[dz + dx + dy]);
+            }
+        }
+
+        auto lerp4 = [](__m128 a, __m128 b, __m128 t) {
+            return _mm_add_ps(a, _mm_mul_ps(t, _mm_sub_ps(b, a)));
+        };
+        __m128 c0 = lerp4(lerp4(_mm_load_ps(c[0]), _mm_load_ps(c[1]), fx),
+                          lerp4(_mm_load_ps(c[2]), _mm_load_ps(c[3]), fx), fy);
+        if (Trilinear) {
+            __m128 c1 = lerp4(lerp4(_mm_load_ps(c[4]), _mm_load_ps(c[5]), fx),
+                              lerp4(_mm_load_ps(c[6]), _mm_load_ps(c[7]), fx), fy);
+            c0 = lerp4(c0, c1, fz);
+        }
+        _mm_storeu_ps(out + i, _mm_and_ps(c0, inside));
+    }
+#endif
+    for (; i < width; ++i) {
+        glm::vec3 q = p + float(i) * step;
+        out[i] = sample<VoxelType, Trilinear>(s, q.x, q.y, q.z);
+    }
+}
+
+} // namespace
+
+
+
+namespace cg {
+
+// Copies an axis-aligned slice into a float image (width * height)
+template <typename VoxelType>
+void volumeExtractSlice(Volume<VoxelType> &volume, SliceAxis axis, int index,
+                        std::vector<float> *image)
+{
+    SliceView<VoxelType> view = volumeSliceView(volume, axis, index);
+    image->resize(std::size_t(view.width) * view.height);
+    for (int v = 0; v < view.height; ++v) {
+        float *row = &(*image)[std::size_t(v) * view.width];
+        if (view.strideU == 1) {
+            const VoxelType *src = &view(0, v);
+            std::copy(src, src + view.width, row);
+        }
+        else {
+            for (int u = 0; u < view.width; ++u) {
+                row[u] = float(view(u, v));
+            }
+        }
+    }
+}
+
+// Samples an oblique slice into a float image (width * height)
+template <typename VoxelType>
+void volumeExtractObliqueSlice(Volume<VoxelType> &volume, const SlicePlane &plane,
+                               std::vector<float> *image)
+{
+    image->resize(std::size_t(plane.width) * plane.height);
+    if (image->empty()) {
+        return;
+    }
+
+    // Permute the axes so that z is the axis the plane is perpendicular
+    // to, if the plane lies exactly in a voxel slice. In that case
+    // bilinear interpolation within the slice gives the same result as
+    // trilinear interpolation with half of the memory accesses.
+    glm::ivec3 dims = volume.base.dimensions;
+    std::ptrdiff_t strides[3] = { 1, dims.x, std::ptrdiff_t(dims.x) * dims.y };
+    int perm[3] = { 0, 1, 2 };
+    bool trilinear = true;
+    for (int a = 2; a >= 0; --a) {
+        if (plane.u[a] == 0.0f && plane.v[a] == 0.0f &&
+            plane.origin[a] == std::floor(plane.origin[a]) &&
+            plane.origin[a] >= 0.0f && plane.origin[a] <= dims[a] - 1) {
+            std::swap(perm[a], perm[2]);
+            trilinear = false;
+            break;
+        }
+    }
+
+    SliceSampler<VoxelType> sampler;
+    sampler.data = reinterpret_cast<const VoxelType *>(&volume.base.data[0]);
+    glm::vec3 origin, u, v;
+    for (int i = 0; i < 3; ++i) {
+        sampler.dims[i] = dims[perm[i]];
+        sampler.strides[i] = strides[perm[i]];
+        origin[i] = plane.origin[perm[i]];
+        u[i] = plane.u[perm[i]];
+        v[i] = plane.v[perm[i]];
+    }
+
+    float *out = &(*image)[0];
+    int grainSize = std::max(plane.height / (8 * parallelNumThreads()), 1);
+    parallelFor(0, plane.height, [&](int rowBegin, int rowEnd) {
+        for (int j = rowBegin; j < rowEnd; ++j) {
+            glm::vec3 p = origin + float(j) * v;
+            float *row = out + std::size_t(j) * plane.width;
+            if (trilinear) {
+                sampleRow<VoxelType, true>(sampler, p, u, plane.width, row);
+            }
+            else {
+                sampleRow<VoxelType, false>(sampler, p, u, plane.width, row);
+            }
+        }
+    }, grainSize);
+}
+
+// Returns a size x size slice plane through center with the given normal
+SlicePlane slicePlaneFromNormal(const glm::vec3 &center, const glm::vec3 &normal, int size)
+{
+    // Orthonormalize reference axes against the normal, so that planes
+    // close to the axial, coronal, or sagittal orientation get the same
+    // image axes as the corresponding SliceView
+    glm::vec3 n = glm::normalize(normal);
+    glm::vec3 a = glm::abs(n);
+    glm::vec3 refU = (a.x >= a.y && a.x >= a.z) ? glm::vec3(0.0f, 1.0f, 0.0f) : glm::vec3(1.0f, 0.0f, 0.0f);
+    glm::vec3 refV = (a.z >= a.x && a.z >= a.y) ? glm::vec3(0.0f, 1.0f, 0.0f) : glm::vec3(0.0f, 0.0f, 1.0f);
+    glm::vec3 u = glm::normalize(refU - glm::dot(refU, n) * n);
+    // v is completed from n and u, since refU and refV coincide when a.x
+    // ties with a.z (e.g. normal (1, 1, 1)), and oriented along refV
+    glm::vec3 v = glm::cross(n, u);
+    if (glm::dot(v, refV) < 0.0f) {
+        v = -v;
+    }
+
+    SlicePlane plane;
+    plane.u = u;
+    plane.v = v;
+    plane.origin = center - 0.5f * float(size - 1) * (u + v);
+    plane.width = size;
+    plane.height = size;
+    return plane;
+}
+
+// Explicit instantiations for the typed volume images
+template void volumeExtractSlice(VolumeUInt8 &, SliceAxis, int, std::vector<float> *);
+template void volumeExtractSlice(VolumeUInt16 &, SliceAxis, int, std::vector<float> *);
+template void volumeExtractSlice(VolumeInt16 &, SliceAxis, int, std::vector<float> *);
+template void volumeExtractSlice(VolumeUInt32 &, SliceAxis, int, std::vector<float> *);
+template void volumeExtractSlice(VolumeFloat32 &, SliceAxis, int, std::vector<float> *);
+
+template void volumeExtractObliqueSlice(VolumeUInt8 &, const SlicePlane &, std::vector<float> *);
+template void volumeExtractObliqueSlice(VolumeUInt16 &, const SlicePlane &, std::vector<float> *);
+template void volumeExtractObliqueSlice(VolumeInt16 &, const SlicePlane &, std::vector<float> *);
+template void volumeExtractObliqueSlice(VolumeUInt32 &, const SlicePlane &, std::vector<float> *);
+template void volumeExtractObliqueSlice(VolumeFloat32 &, const SlicePlane &, std::vector<float> *);
+
+} // namespace cg
@@ -0,0 +1,84 @@
+#pragma once
+
+#include "cgVolume.h"
+
+#include <vector>
+#include <cstddef>
+
+namespace cg {
+
+// Axis-aligned slice orientations, named by the axis they cut
+enum SliceAxis {
+    SLICE_SAGITTAL = 0,  // x = index, image axes (y, z)
+    SLICE_CORONAL = 1,  // y = index, image axes (x, z)
+    SLICE_AXIAL = 2  // z = index, image axes (x, y)
+};
+
+// Strided view of an axis-aligned slice. Does not copy any voxels:
+// element (u, v) is data[u * strideU + v * strideV].
+template <typename VoxelType>
+struct SliceView {
+    const VoxelType *data;
+    int width;
+    int height;
+    std::ptrdiff_t strideU;  // in voxels
+    std::ptrdiff_t strideV;  // in voxels
+
+    const VoxelType &operator()(int u, int v) const
+    {
+        return data[u * strideU + v * strideV];
+    }
+};
+
+// Arbitrary (oblique) slice plane in voxel coordinates. Pixel (i, j)
+// of the slice image is sampled at origin + i * u + j * v.
+struct SlicePlane {
+    glm::vec3 origin;
+    glm::vec3 u;
+    glm::vec3 v;
+    int width;
+    int height;
+};
+
+// Returns a zero-copy view of an axis-aligned slice (no bounds checking!)
+template <typename VoxelType>
+SliceView<VoxelType> volumeSliceView(Volume<VoxelType> &volume, SliceAxis axis, int index);
+
+// Copies an axis-aligned slice into a float image (width * height)
+template <typename VoxelType>
+void volumeExtractSlice(Volume<VoxelType> &volume, SliceAxis axis, int index,
+                        std::vector<float> *image);
+
+// Samples an oblique slice into a float image (width * height), in
+// parallel over rows. Uses trilinear interpolation, or bilinear
+// interpolation when the plane lies exactly in a voxel slice. Samples
+// outside the volume are zero.
+template <typename VoxelType>
+void volumeExtractObliqueSlice(Volume<VoxelType> &volume, const SlicePlane &plane,
+                               std::vector<float> *image);
+
+// Returns a size x size slice plane through center (in voxel
+// coordinates) with the given normal, sampled at a spacing of one voxel
+SlicePlane slicePlaneFromNormal(const glm::vec3 &center, const glm::vec3 &normal, int size);
+
+
+
+// Returns a zero-copy view of an axis-aligned slice (no bounds checking!)
+template <typename VoxelType>
+inline SliceView<VoxelType> volumeSliceView(Volume<VoxelType> &volume, SliceAxis axis, int index)
+{
+    glm::ivec3 dims = volume.base.dimensions;
+    std::ptrdiff_t strides[3] = { 1, dims.x, std::ptrdiff_t(dims.x) * dims.y };
+    int u = (axis == SLICE_SAGITTAL) ? 1 : 0;
+    int v = (axis == SLICE_AXIAL) ? 1 : 2;
+
+    SliceView<VoxelType> view;
+    view.data = reinterpret_cast<const VoxelType *>(&volume.base.data[0]) + index * strides[axis];
+    view.width = dims[u];
+    view.height = dims[v];
+    view.strideU = strides[u];
+    view.strideV = strides[v];
+    return view;
+}
+
+} // namespace cg
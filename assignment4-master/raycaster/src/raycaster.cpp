@@ -6,6 +6,11 @@
 #include "utils.h"
 #include "utils2.h"
 #include "cgVolume.h"
+#include "cgVolumeGenerate.h"
+#include "cgIsosurface.h"
+#include "cgVolumeResample.h"
+#include "cgVolumeSlice.h"
+#include "cgBrickVolume.h"
 
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
@@ -20,6 +25,7 @@
 #include <iostream>
 #include <cstdlib>
 #include <algorithm>
+#include <filesystem>
 
 // The attribute locations we will use in the vertex shader
 enum AttributeLocation {
@@ -28,11 +34,13 @@ enum AttributeLocation {
     TEXCOORD = 2,
 };
 
-// Struct for representing an indexed triangle mesh
+// Struct for representing an indexed triangle mesh. Meshes loaded from
+// a mesh cache keep the cache file mapped instead of filling the vectors.
 struct Mesh {
     std::vector<glm::vec3> vertices;
     std::vector<glm::vec3> normals;
     std::vector<uint32_t> indices;
+    MeshCache cache;
 };
 
 // Struct for representing a vertex array object (VAO) created from a
@@ -64,6 +72,39 @@ struct RayCastVolume {
     {}
 };
 
+// Struct for streaming a bricked volume (see cgBrickVolume.h) that does
+// not fit in texture memory. Resident bricks are stored in slots of a
+// fixed-size 3D atlas texture, and a page table texture (with one mip
+// level per volume level) maps bricks to atlas slots. The ray-caster
+// writes the bricks it is missing (and some it used) to a small
+// feedback buffer, which is read back asynchronously and drives an LRU
+// cache that streams bricks from disk.
+struct BrickStream {
+    cg::BrickVolumeFile file;
+    cg::BrickCache cache;
+    GLuint atlasTexture;
+    GLuint pageTableTexture;
+    GLuint feedbackTexture;
+    GLuint feedbackFBO;
+    GLuint feedbackPBO[2];
+    glm::ivec3 atlasSlots;  // slots along each axis of the atlas
+    glm::ivec3 pageTableSize;  // size of mip level 0 of the page table
+    glm::ivec2 feedbackSize;
+    int frame;
+
+    BrickStream() :
+        atlasTexture(0),
+        pageTableTexture(0),
+        feedbackTexture(0),
+        feedbackFBO(0),
+        feedbackPBO(),
+        atlasSlots(0),
+        pageTableSize(0),
+        feedbackSize(0),
+        frame(0)
+    {}
+};
+
 // Struct for resources and state
 struct Context {
     int width;
@@ -76,8 +117,13 @@ struct Context {
     MeshVAO quadVAO;
     GLuint defaultVAO;
     RayCastVolume rayCastVolume;
+    BrickStream brickStream;
     GLuint boundingGeometryProgram;
     GLuint rayCasterProgram;
+    GLuint isosurfaceProgram;
+    GLuint sliceProgram;
+    Mesh isosurfaceMesh;
+    MeshVAO isosurfaceVAO = MeshVAO();
     float elapsed_time;
      // Resources used by imgui
      const char* dataset[4] = {"foot.vtk", "abdomen.vtk", "bonsai.vtk", "tooth.vtk"};
@@ -105,6 +151,26 @@ struct Context {
      bool correction_enable = true;
      int correction = 1;
      float correction_threshold = 0.02;
+     // Procedural volume used instead of a dataset (see key G)
+     cg::VolumeGenerateParams synthetic_params;
+     glm::ivec3 synthetic_dimensions = glm::ivec3(256, 256, 256);
+     std::string synthetic_datatype = "uint8";
+     // Volumes larger than this are resampled before upload. Can be set
+     // with the RAYCASTER_TEXTURE_BUDGET_MB environment variable.
+     int texture_budget_mb = 512;
+     // Isosurface drawn as a mesh instead of ray-casting (see key I)
+     bool isosurface_enable = false;
+     float iso_value = 0.4f;  // normalized intensity
+     // Axial, coronal, sagittal, and oblique slice views (see key M)
+     bool slices_enable = false;
+     glm::vec3 slice_position = glm::vec3(0.5f);  // normalized, moved with up/down keys
+     // Stream the full-resolution volume in bricks from disk (see key B).
+     // The atlas size can be set with RAYCASTER_BRICK_ATLAS_MB.
+     bool streaming_enable = false;
+     std::string volume_name = "volume";  // name of the bricked volume file
+     std::string volume_filename;  // empty for procedural volumes
+     int brick_atlas_mb = 256;
+     int brick_uploads_per_frame = 64;
 
 };
 
@@ -164,20 +230,356 @@ std::string volumeDataDir(void)
     return rootDir + "/raycaster/data/";
 }
 
+// Loads a mesh from its mesh cache if that is up to date, and otherwise
+// from the OBJ file, optimizes its vertex order for rendering, and
+// writes the mesh cache
 void loadMesh(const std::string &filename, Mesh *mesh)
 {
+    meshCacheClose(&mesh->cache);
+    if (meshCacheOpen(&mesh->cache, filename)) {
+        mesh->vertices.clear();
+        mesh->normals.clear();
+        mesh->indices.clear();
+        return;
+    }
+
+    // A mesh that fails to load is left empty, and not cached
     OBJMesh obj_mesh;
-    objMeshLoad(obj_mesh, filename);
+    if (objMeshLoad(obj_mesh, filename)) {
+        optimizeMeshVertexOrder(obj_mesh);
+        meshCacheWrite(obj_mesh, filename);
+    }
+    else {
+        obj_mesh = OBJMesh();
+    }
     mesh->vertices = obj_mesh.vertices;
     mesh->normals = obj_mesh.normals;
     mesh->indices = obj_mesh.indices;
 }
 
-void loadRayCastVolume(Context &ctx, const std::string &filename, RayCastVolume *rayCastVolume)
+// Returns the internal format and pixel type used for uploading a
+// volume with the given datatype to a normalized 3D texture
+void volumeTextureFormat(const std::string &datatype, GLint *internalFormat, GLenum *type)
 {
-    cg::VolumeBase volume;
-    cg::volumeLoadVTK(&volume, (volumeDataDir() + ctx.dataset[ctx.dataset_current]));
-    rayCastVolume->volume = volume;
+    if (datatype == "uint16") {
+        *internalFormat = GL_R16;
+        *type = GL_UNSIGNED_SHORT;
+    }
+    else if (datatype == "int16") {
+        *internalFormat = GL_R16_SNORM;
+        *type = GL_SHORT;
+    }
+    else if (datatype == "uint32") {
+        *internalFormat = GL_R32F;
+        *type = GL_UNSIGNED_INT;
+    }
+    else if (datatype == "float32") {
+        *internalFormat = GL_R32F;
+        *type = GL_FLOAT;
+    }
+    else { // uint8
+        *internalFormat = GL_R8;
+        *type = GL_UNSIGNED_BYTE;
+    }
+}
+
+void deleteBrickStream(BrickStream *stream)
+{
+    glDeleteTextures(1, &stream->atlasTexture);
+    glDeleteTextures(1, &stream->pageTableTexture);
+    glDeleteTextures(1, &stream->feedbackTexture);
+    glDeleteFramebuffers(1, &stream->feedbackFBO);
+    glDeleteBuffers(2, stream->feedbackPBO);
+    *stream = BrickStream();
+}
+
+// Sets the page table entry of a brick to an atlas slot and a state
+// (0: missing, 1: resident, 2: empty)
+void setPageTableEntry(BrickStream *stream, int brick, const glm::ivec3 &slot, GLubyte state)
+{
+    int level;
+    glm::ivec3 b;
+    cg::brickVolumeLocate(stream->file, brick, &level, &b);
+    GLubyte entry[4] = { GLubyte(slot.x), GLubyte(slot.y), GLubyte(slot.z), state };
+    glBindTexture(GL_TEXTURE_3D, stream->pageTableTexture);
+    glTexSubImage3D(GL_TEXTURE_3D, level, b.x, b.y, b.z, 1, 1, 1,
+                    GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, entry);
+    glBindTexture(GL_TEXTURE_3D, 0);
+}
+
+// Reads bricks from disk into the atlas, evicting least recently used
+// bricks when the atlas is full. Bricks that do not fit (because all
+// slots are in use in this frame) are skipped.
+void streamBricks(BrickStream *stream, const std::vector<int> &bricks, bool pinned)
+{
+    const cg::BrickVolumeFile &file = stream->file;
+    std::vector<int> loaded;
+    std::vector<glm::ivec3> slots;
+    for (int brick : bricks) {
+        int evicted;
+        int slot = cg::brickCacheInsert(&stream->cache, brick, pinned, &evicted);
+        if (slot < 0) {
+            break;
+        }
+        if (evicted >= 0) {
+            setPageTableEntry(stream, evicted, glm::ivec3(0), 0);
+        }
+        glm::ivec3 n = stream->atlasSlots;
+        loaded.push_back(brick);
+        slots.push_back(glm::ivec3(slot % n.x, (slot / n.x) % n.y, slot / (n.x * n.y)));
+    }
+
+    std::vector<std::uint8_t> data;
+    if (loaded.empty() || !cg::brickVolumeRead(file, loaded, &data)) {
+        return;
+    }
+
+    GLint internalFormat;
+    GLenum type;
+    volumeTextureFormat(file.info.datatype, &internalFormat, &type);
+    int size = file.brickSize;
+    glBindTexture(GL_TEXTURE_3D, stream->atlasTexture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for (std::size_t i = 0; i < loaded.size(); ++i) {
+        glTexSubImage3D(GL_TEXTURE_3D, 0, slots[i].x * size, slots[i].y * size, slots[i].z * size,
+                        size, size, size, GL_RED, type, &data[i * file.brickBytes]);
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glBindTexture(GL_TEXTURE_3D, 0);
+
+    for (std::size_t i = 0; i < loaded.size(); ++i) {
+        setPageTableEntry(stream, loaded[i], slots[i], 1);
+    }
+}
+
+// Builds a bricked volume file from the full-resolution volume and
+// (re)creates the textures and buffers used for streaming it. The
+// bricked file of a volume loaded from a file is reused while it is
+// newer than that file. The coarsest level is loaded and pinned, so that
+// there is always a resident brick to fall back to.
+bool createBrickStream(Context &ctx, const cg::VolumeBase &volume, BrickStream *stream)
+{
+    deleteBrickStream(stream);
+    std::string filename = volumeDataDir() + ctx.volume_name + ".bricks";
+    bool fresh = false;
+    if (!ctx.volume_filename.empty()) {
+        std::error_code error;
+        auto bricksTime = std::filesystem::last_write_time(filename, error);
+        fresh = !error;
+        auto volumeTime = std::filesystem::last_write_time(ctx.volume_filename, error);
+        fresh = fresh && !error && volumeTime <= bricksTime;
+    }
+    fresh = fresh && cg::brickVolumeOpen(&stream->file, filename) &&
+            stream->file.info.dimensions == volume.dimensions &&
+            stream->file.info.datatype == volume.datatype;
+    if (!fresh && (!cg::brickVolumeBuild(volume, filename) ||
+                   !cg::brickVolumeOpen(&stream->file, filename))) {
+        return false;
+    }
+    const cg::BrickVolumeFile &file = stream->file;
+    glm::ivec3 grid = file.gridDimensions[0];
+    if (file.numLevels > 12 || std::max(grid.x, std::max(grid.y, grid.z)) > 512) {
+        // Limits of the page table and feedback encoding in rayCaster.frag
+        std::cerr << "Error: Volume is too large for streaming" << std::endl;
+        return false;
+    }
+
+    // Atlas with as many slots as fit in the budget
+    GLint maxTextureSize = 0;
+    glGetIntegerv(GL_MAX_3D_TEXTURE_SIZE, &maxTextureSize);
+    int maxSlots = std::min(maxTextureSize / file.brickSize, 255);
+    int budgetSlots = int(std::size_t(ctx.brick_atlas_mb) * 1024 * 1024 / file.brickBytes);
+    int side = std::min(std::max(int(std::cbrt(double(budgetSlots))), 1), maxSlots);
+    stream->atlasSlots = glm::ivec3(side, side, std::min(std::max(budgetSlots / (side * side), 1), maxSlots));
+    glm::ivec3 atlasSize = stream->atlasSlots * file.brickSize;
+
+    GLint internalFormat;
+    GLenum type;
+    volumeTextureFormat(file.info.datatype, &internalFormat, &type);
+    glGenTextures(1, &stream->atlasTexture);
+    glBindTexture(GL_TEXTURE_3D, stream->atlasTexture);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexImage3D(GL_TEXTURE_3D, 0, internalFormat, atlasSize.x, atlasSize.y, atlasSize.z,
+                 0, GL_RED, type, nullptr);
+
+    // Page table, with mip level l holding the bricks of volume level l.
+    // The size is a power of two, large enough for every level.
+    glm::ivec3 tableSize(1);
+    for (int l = 0; l < file.numLevels; ++l) {
+        for (int i = 0; i < 3; ++i) {
+            while (tableSize[i] < file.gridDimensions[l][i] * (1 << l)) {
+                tableSize[i] *= 2;
+            }
+        }
+    }
+    stream->pageTableSize = tableSize;
+    glGenTextures(1, &stream->pageTableTexture);
+    glBindTexture(GL_TEXTURE_3D, stream->pageTableTexture);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAX_LEVEL, file.numLevels - 1);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for (int l = 0; l < file.numLevels; ++l) {
+        glm::ivec3 size = glm::max(tableSize / (1 << l), glm::ivec3(1));
+        glm::ivec3 levelGrid = file.gridDimensions[l];
+        std::vector<GLubyte> entries(std::size_t(size.x) * size.y * size.z * 4, 0);
+        for (int z = 0; z < levelGrid.z; ++z) {
+            for (int y = 0; y < levelGrid.y; ++y) {
+                for (int x = 0; x < levelGrid.x; ++x) {
+                    int brick = cg::brickVolumeIndex(file, l, glm::ivec3(x, y, z));
+                    entries[((std::size_t(z) * size.y + y) * size.x + x) * 4 + 3] =
+                        file.brickEmpty[brick] ? 2 : 0;
+                }
+            }
+        }
+        glTexImage3D(GL_TEXTURE_3D, l, GL_RGBA8UI, size.x, size.y, size.z,
+                     0, GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, entries.data());
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glBindTexture(GL_TEXTURE_3D, 0);
+
+    // Feedback buffer (a low-resolution integer color attachment) and
+    // pixel buffers for reading it back without stalling
+    stream->feedbackSize = glm::ivec2(128, 128);
+    glGenTextures(1, &stream->feedbackTexture);
+    glBindTexture(GL_TEXTURE_2D, stream->feedbackTexture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R32UI, stream->feedbackSize.x, stream->feedbackSize.y,
+                 0, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glGenFramebuffers(1, &stream->feedbackFBO);
+    glBindFramebuffer(GL_FRAMEBUFFER, stream->feedbackFBO);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1,
+                           GL_TEXTURE_2D, stream->feedbackTexture, 0);
+    const GLenum drawBuffers[2] = { GL_NONE, GL_COLOR_ATTACHMENT1 };
+    glDrawBuffers(2, drawBuffers);
+    glReadBuffer(GL_COLOR_ATTACHMENT1);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        std::cerr << "Error: Framebuffer is not complete\n";
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    std::vector<GLuint> zeros(stream->feedbackSize.x * stream->feedbackSize.y, 0);
+    glGenBuffers(2, stream->feedbackPBO);
+    for (int i = 0; i < 2; ++i) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, stream->feedbackPBO[i]);
+        glBufferData(GL_PIXEL_PACK_BUFFER, zeros.size() * sizeof(GLuint), zeros.data(), GL_STREAM_READ);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    int numSlots = stream->atlasSlots.x * stream->atlasSlots.y * stream->atlasSlots.z;
+    cg::brickCacheInit(&stream->cache, numSlots);
+    std::vector<int> coarsest;
+    for (int brick = file.levelFirstBrick.back(); brick < int(file.brickEmpty.size()); ++brick) {
+        if (!file.brickEmpty[brick]) {
+            coarsest.push_back(brick);
+        }
+    }
+    streamBricks(stream, coarsest, true);
+
+    // Display log message
+    std::cout << "Streaming " << filename << " with a " << atlasSize.x << "x" << atlasSize.y
+              << "x" << atlasSize.z << " brick atlas (" << numSlots << " slots)" << std::endl;
+
+    return true;
+}
+
+// Reads back the feedback buffer of the previous frame, marks the bricks
+// that were used as recently used, and streams in up to
+// brick_uploads_per_frame missing bricks (coarser levels first)
+void updateBrickStream(Context &ctx, BrickStream *stream)
+{
+    const cg::BrickVolumeFile &file = stream->file;
+    std::vector<GLuint> requests(stream->feedbackSize.x * stream->feedbackSize.y);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, stream->feedbackPBO[(stream->frame + 1) % 2]);
+    const GLuint *feedback = static_cast<const GLuint *>(glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY));
+    if (feedback != nullptr) {
+        std::copy(feedback, feedback + requests.size(), requests.begin());
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    std::sort(requests.begin(), requests.end());
+    requests.erase(std::unique(requests.begin(), requests.end()), requests.end());
+
+    cg::brickCacheNextFrame(&stream->cache);
+    std::vector<int> missing;
+    for (GLuint request : requests) {
+        if (request == 0) {
+            continue;
+        }
+        // Decode the brick packed by packBrick() in rayCaster.frag
+        request -= 1;
+        int level = int(request >> 27);
+        glm::ivec3 brick(request & 511, (request >> 9) & 511, (request >> 18) & 511);
+        if (level >= file.numLevels || brick.x >= file.gridDimensions[level].x ||
+            brick.y >= file.gridDimensions[level].y || brick.z >= file.gridDimensions[level].z) {
+            continue;
+        }
+        int index = cg::brickVolumeIndex(file, level, brick);
+        if (cg::brickCacheTouch(&stream->cache, index) < 0 && !file.brickEmpty[index]) {
+            missing.push_back(index);
+        }
+    }
+
+    // Coarser levels have larger indices
+    std::sort(missing.begin(), missing.end(), std::greater<int>());
+    if (int(missing.size()) > ctx.brick_uploads_per_frame) {
+        missing.resize(ctx.brick_uploads_per_frame);
+    }
+    streamBricks(stream, missing, false);
+}
+
+// Uploads an already loaded (or generated) volume to the GPU and
+// (re)creates the textures and FBOs used for ray-casting. Returns true
+// on success, false otherwise, in which case the previous volume is kept.
+bool uploadRayCastVolume(Context &ctx, const cg::VolumeBase &volume, RayCastVolume *rayCastVolume)
+{
+    // Shrink the volume to the largest resolution that fits in the
+    // texture memory budget (and the maximum 3D texture size), before
+    // anything is replaced
+    GLint maxTextureSize = 0;
+    glGetIntegerv(GL_MAX_3D_TEXTURE_SIZE, &maxTextureSize);
+    std::size_t budgetBytes = std::size_t(ctx.texture_budget_mb) * 1024 * 1024;
+    glm::ivec3 dims = cg::volumeFitDimensions(volume, budgetBytes, maxTextureSize);
+    cg::VolumeBase resampled;
+    if (dims != volume.dimensions) {
+        double startTime = glfwGetTime();
+        if (!cg::volumeResample(volume, dims, &resampled)) {
+            std::cerr << "Error: Could not resample volume, keeping the previous volume" << std::endl;
+            return false;
+        }
+        std::cout << "Volume " << volume.dimensions.x << "x" << volume.dimensions.y << "x"
+                  << volume.dimensions.z << " exceeds texture budget of " << ctx.texture_budget_mb
+                  << " MB, resampled to " << dims.x << "x" << dims.y << "x" << dims.z
+                  << " in " << glfwGetTime() - startTime << " s" << std::endl;
+    }
+
+    // The full-resolution volume is streamed in bricks for ray-casting,
+    // while the (possibly resampled) volume texture below is still used
+    // by the other views
+    if (ctx.streaming_enable && !createBrickStream(ctx, volume, &ctx.brickStream)) {
+        ctx.streaming_enable = false;
+    }
+    if (!ctx.streaming_enable) {
+        deleteBrickStream(&ctx.brickStream);
+    }
+
+    if (dims != volume.dimensions) {
+        rayCastVolume->volume = std::move(resampled);
+    }
+    else {
+        rayCastVolume->volume = volume;
+    }
+
+    GLint internalFormat;
+    GLenum type;
+    volumeTextureFormat(volume.datatype, &internalFormat, &type);
 
     glDeleteTextures(1, &rayCastVolume->volumeTexture);
     glGenTextures(1, &rayCastVolume->volumeTexture);
@@ -187,9 +589,12 @@ void loadRayCastVolume(Context &ctx, const std::string &filename, RayCastVolume
     glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexImage3D(GL_TEXTURE_3D, 0, GL_R8, volume.dimensions.x,
-                 volume.dimensions.y, volume.dimensions.z,
-                 0, GL_RED, GL_UNSIGNED_BYTE, &volume.data[0]);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    const cg::VolumeBase &uploaded = rayCastVolume->volume;
+    glTexImage3D(GL_TEXTURE_3D, 0, internalFormat, uploaded.dimensions.x,
+                 uploaded.dimensions.y, uploaded.dimensions.z,
+                 0, GL_RED, type, &uploaded.data[0]);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
     glBindTexture(GL_TEXTURE_3D, 0);
 
     glDeleteTextures(1, &rayCastVolume->backFaceTexture);
@@ -246,27 +651,133 @@ void loadRayCastVolume(Context &ctx, const std::string &filename, RayCastVolume
         std::cerr << "Error: Framebuffer is not complete\n";
     }
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    return true;
+}
+
+// Extracts an isosurface (at a normalized intensity in [0, 1]) from the
+// ray-cast volume with marching cubes, for drawing with drawIsosurface
+void extractIsosurfaceMesh(const RayCastVolume &rayCastVolume, float isovalue, Mesh *mesh)
+{
+    const cg::VolumeBase &volume = rayCastVolume.volume;
+    float maxValue = 255.0f;
+    if (volume.datatype == "uint16") {
+        maxValue = 65535.0f;
+    }
+    else if (volume.datatype == "int16") {
+        maxValue = 32767.0f;
+    }
+    else if (volume.datatype == "uint32") {
+        maxValue = 4294967295.0f;
+    }
+    else if (volume.datatype == "float32") {
+        maxValue = 1.0f;
+    }
+
+    OBJMesh obj_mesh;
+    cg::volumeExtractIsosurface(volume, isovalue * maxValue, &obj_mesh.vertices,
+                                &obj_mesh.normals, &obj_mesh.indices);
+    mesh->vertices = obj_mesh.vertices;
+    mesh->normals = obj_mesh.normals;
+    mesh->indices = obj_mesh.indices;
+}
+
+// Scale applied to the voxel spacing of every dataset after it is loaded
+// (see init), in addition to datasetSpacingScale
+const float VOLUME_SPACING_SCALE = 0.008f;  // FIXME
+
+// Returns the scale applied to the voxel spacing of a dataset after it is
+// loaded (see loadDefault)
+float datasetSpacingScale(int dataset)
+{
+    switch (dataset) {
+    case 1:
+        return 0.003f;
+    case 2:
+        return 0.005f;
+    default:
+        return 0.008f;  // FIXME
+    }
+}
+
+// Loads a volume from a VTK file into the ray-cast volume. Returns true
+// on success, false otherwise, in which case the previous volume is kept.
+bool loadRayCastVolume(Context &ctx, const std::string &filename, RayCastVolume *rayCastVolume)
+{
+    cg::VolumeBase volume;
+    if (!cg::volumeLoadVTK(&volume, filename)) {
+        return false;
+    }
+    std::string volumeName = ctx.volume_name, volumeFilename = ctx.volume_filename;
+    std::size_t first = filename.find_last_of("/\\") + 1;
+    ctx.volume_name = filename.substr(first, filename.find_last_of('.') - first);
+    ctx.volume_filename = filename;
+    if (!uploadRayCastVolume(ctx, volume, rayCastVolume)) {
+        ctx.volume_name = volumeName;
+        ctx.volume_filename = volumeFilename;
+        return false;
+    }
+    return true;
+}
+
+// Fills the ray-cast volume with a procedural field (see
+// cgVolumeGenerate.h), scaled to fit the 2-unit bounding cube. Returns
+// true on success, false otherwise, in which case the previous volume is
+// kept.
+bool generateRayCastVolume(Context &ctx, const cg::VolumeGenerateParams &params,
+                           RayCastVolume *rayCastVolume)
+{
+    double startTime = glfwGetTime();
+    cg::VolumeBase volume;
+    if (!cg::volumeGenerate(&volume, ctx.synthetic_dimensions, ctx.synthetic_datatype, params)) {
+        return false;
+    }
+    glm::ivec3 dims = volume.dimensions;
+    volume.spacing = glm::vec3(2.0f / std::max(dims.x, std::max(dims.y, dims.z)));
+    double generateTime = glfwGetTime() - startTime;
+    std::string volumeName = ctx.volume_name, volumeFilename = ctx.volume_filename;
+    ctx.volume_name = cg::volumeFieldName(params.field);
+    ctx.volume_filename.clear();
+    if (!uploadRayCastVolume(ctx, volume, rayCastVolume)) {
+        ctx.volume_name = volumeName;
+        ctx.volume_filename = volumeFilename;
+        return false;
+    }
+
+    // Display log message
+    std::cout << "Generated " << cg::volumeFieldName(params.field) << " volume ("
+              << dims.x << "x" << dims.y << "x" << dims.z << ", "
+              << ctx.synthetic_datatype << ") in " << generateTime << " s" << std::endl;
+    return true;
 }
 
 void createMeshVAO(Context &ctx, const Mesh &mesh, MeshVAO *meshVAO)
 {
+    // Meshes loaded from a mesh cache are uploaded straight from the
+    // mapped cache file
+    bool cached = (mesh.cache.vertices != nullptr);
+    std::size_t numVertices = cached ? mesh.cache.numVertices : mesh.vertices.size();
+    std::size_t numIndices = cached ? mesh.cache.numIndices : mesh.indices.size();
+    const glm::vec3 *vertices = cached ? mesh.cache.vertices : mesh.vertices.data();
+    const glm::vec3 *normals = cached ? mesh.cache.normals : mesh.normals.data();
+    const uint32_t *indices = cached ? mesh.cache.indices : mesh.indices.data();
+
     // Generates and populates a VBO for the vertices
     glGenBuffers(1, &(meshVAO->vertexVBO));
     glBindBuffer(GL_ARRAY_BUFFER, meshVAO->vertexVBO);
-    auto verticesNBytes = mesh.vertices.size() * sizeof(mesh.vertices[0]);
-    glBufferData(GL_ARRAY_BUFFER, verticesNBytes, mesh.vertices.data(), GL_STATIC_DRAW);
+    auto verticesNBytes = numVertices * sizeof(vertices[0]);
+    glBufferData(GL_ARRAY_BUFFER, verticesNBytes, vertices, GL_STATIC_DRAW);
 
     // Generates and populates a VBO for the vertex normals
     glGenBuffers(1, &(meshVAO->normalVBO));
     glBindBuffer(GL_ARRAY_BUFFER, meshVAO->normalVBO);
-    auto normalsNBytes = mesh.normals.size() * sizeof(mesh.normals[0]);
-    glBufferData(GL_ARRAY_BUFFER, normalsNBytes, mesh.normals.data(), GL_STATIC_DRAW);
+    auto normalsNBytes = numVertices * sizeof(normals[0]);
+    glBufferData(GL_ARRAY_BUFFER, normalsNBytes, normals, GL_STATIC_DRAW);
 
     // Generates and populates a VBO for the element indices
     glGenBuffers(1, &(meshVAO->indexVBO));
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, meshVAO->indexVBO);
-    auto indicesNBytes = mesh.indices.size() * sizeof(mesh.indices[0]);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indicesNBytes, mesh.indices.data(), GL_STATIC_DRAW);
+    auto indicesNBytes = numIndices * sizeof(indices[0]);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indicesNBytes, indices, GL_STATIC_DRAW);
 
     // Creates a vertex array object (VAO) for drawing the mesh
     glGenVertexArrays(1, &(meshVAO->vao));
@@ -281,8 +792,17 @@ void createMeshVAO(Context &ctx, const Mesh &mesh, MeshVAO *meshVAO)
     glBindVertexArray(ctx.defaultVAO);
 
     // Additional information required by draw calls
-    meshVAO->numVertices = mesh.vertices.size();
-    meshVAO->numIndices = mesh.indices.size();
+    meshVAO->numVertices = numVertices;
+    meshVAO->numIndices = numIndices;
+}
+
+void deleteMeshVAO(MeshVAO *meshVAO)
+{
+    glDeleteVertexArrays(1, &(meshVAO->vao));
+    glDeleteBuffers(1, &(meshVAO->vertexVBO));
+    glDeleteBuffers(1, &(meshVAO->normalVBO));
+    glDeleteBuffers(1, &(meshVAO->indexVBO));
+    *meshVAO = MeshVAO();
 }
 
 void createQuadVAO(Context &ctx, MeshVAO *meshVAO)
@@ -325,11 +845,24 @@ void initializeTrackball(Context &ctx)
 
 void init(Context &ctx)
 {
+    std::string budget = getEnvVar("RAYCASTER_TEXTURE_BUDGET_MB");
+    if (!budget.empty()) {
+        ctx.texture_budget_mb = std::max(std::atoi(budget.c_str()), 1);
+    }
+    std::string atlasBudget = getEnvVar("RAYCASTER_BRICK_ATLAS_MB");
+    if (!atlasBudget.empty()) {
+        ctx.brick_atlas_mb = std::max(std::atoi(atlasBudget.c_str()), 1);
+    }
+
     // Load shaders
     ctx.boundingGeometryProgram = loadShaderProgram(shaderDir() + "boundingGeometry.vert",
                                                     shaderDir() + "boundingGeometry.frag");
     ctx.rayCasterProgram = loadShaderProgram(shaderDir() + "rayCaster.vert",
                                              shaderDir() + "rayCaster.frag");
+    ctx.isosurfaceProgram = loadShaderProgram(shaderDir() + "isosurface.vert",
+                                              shaderDir() + "isosurface.frag");
+    ctx.sliceProgram = loadShaderProgram(shaderDir() + "slice.vert",
+                                         shaderDir() + "slice.frag");
 
     // Load bounding geometry (2-unit cube)
     loadMesh((modelDir() + "cube.obj"), &ctx.cubeMesh);
@@ -340,7 +873,7 @@ void init(Context &ctx)
 
     // Load volume data
     loadRayCastVolume(ctx, (volumeDataDir() + ctx.dataset[ctx.dataset_current]), &ctx.rayCastVolume);
-    ctx.rayCastVolume.volume.spacing *= 0.008f;  // FIXME
+    ctx.rayCastVolume.volume.spacing *= VOLUME_SPACING_SCALE;
     initializeTrackball(ctx);
 }
 
@@ -366,7 +899,7 @@ void drawBoundingGeometry(Context &ctx, GLuint program, const MeshVAO &cubeVAO,
 
 // MODIFY THIS FUNCTION
 void drawRayCasting(Context &ctx, GLuint program, const MeshVAO &quadVAO,
-                    const RayCastVolume &rayCastVolume)
+                    const RayCastVolume &rayCastVolume, bool feedback)
 {
     glUseProgram(program);
     // Set uniforms and bind textures here...
@@ -399,6 +932,106 @@ void drawRayCasting(Context &ctx, GLuint program, const MeshVAO &quadVAO,
      glBindTexture(GL_TEXTURE_2D, rayCastVolume.backFaceTexture);
      glUniform1i(glGetUniformLocation(program, "u_backFaceTexture"), 2);
 
+    // Bricked volume streaming
+    const BrickStream &stream = ctx.brickStream;
+    glUniform1i(glGetUniformLocation(program, "u_streaming"), ctx.streaming_enable);
+    glUniform1i(glGetUniformLocation(program, "u_feedback"), feedback);
+    glUniform1i(glGetUniformLocation(program, "u_frame"), stream.frame);
+    if (ctx.streaming_enable) {
+        std::vector<glm::vec3> levelDims;
+        for (const glm::ivec3 &dims : stream.file.levelDimensions) {
+            levelDims.push_back(glm::vec3(dims));
+        }
+        glm::vec3 atlasSize = glm::vec3(stream.atlasSlots * stream.file.brickSize);
+        glUniform1i(glGetUniformLocation(program, "u_num_levels"), stream.file.numLevels);
+        glUniform3fv(glGetUniformLocation(program, "u_level_dims"), levelDims.size(), &levelDims[0][0]);
+        glUniform3fv(glGetUniformLocation(program, "u_atlas_size"), 1, &atlasSize[0]);
+        glUniform1f(glGetUniformLocation(program, "u_brick_size"), float(stream.file.brickSize));
+    }
+
+    glActiveTexture(GL_TEXTURE3);
+    glBindTexture(GL_TEXTURE_3D, stream.atlasTexture);
+    glUniform1i(glGetUniformLocation(program, "u_brickAtlas"), 3);
+
+    glActiveTexture(GL_TEXTURE4);
+    glBindTexture(GL_TEXTURE_3D, stream.pageTableTexture);
+    glUniform1i(glGetUniformLocation(program, "u_pageTable"), 4);
+
+    glBindVertexArray(quadVAO.vao);
+    glDrawArrays(GL_TRIANGLES, 0, quadVAO.numVertices);
+    glBindVertexArray(ctx.defaultVAO);
+
+    glUseProgram(0);
+}
+
+// Draws the ray-casting pass into the feedback buffer and starts an
+// asynchronous read back of it
+void drawBrickFeedback(Context &ctx, BrickStream *stream)
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, stream->feedbackFBO);
+    glViewport(0, 0, stream->feedbackSize.x, stream->feedbackSize.y);
+    const GLuint zero[4] = { 0, 0, 0, 0 };
+    glClearBufferuiv(GL_COLOR, 1, zero);
+    drawRayCasting(ctx, ctx.rayCasterProgram, ctx.quadVAO, ctx.rayCastVolume, true);
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, stream->feedbackPBO[stream->frame % 2]);
+    glReadPixels(0, 0, stream->feedbackSize.x, stream->feedbackSize.y,
+                 GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(0, 0, ctx.width, ctx.height);
+    stream->frame++;
+}
+
+// Draws the extracted isosurface mesh. Its vertices are already in the
+// space of the volume bounding geometry, so only the trackball rotation
+// is applied as model matrix.
+void drawIsosurface(Context &ctx, GLuint program, const MeshVAO &meshVAO)
+{
+    glm::mat4 model = trackballGetRotationMatrix(ctx.trackball);
+    glm::mat4 view = glm::translate(glm::mat4(), glm::vec3(0.0f, 0.0f, -2.0f));
+    glm::mat4 projection = glm::perspective(45.0f * (3.141592f / 180.0f), ctx.aspect, 0.1f, 100.0f);
+    glm::mat4 mv = view * model;
+    glm::mat4 mvp = projection * mv;
+
+    glUseProgram(program);
+    glUniformMatrix4fv(glGetUniformLocation(program, "u_mv"), 1, GL_FALSE, &mv[0][0]);
+    glUniformMatrix4fv(glGetUniformLocation(program, "u_mvp"), 1, GL_FALSE, &mvp[0][0]);
+    glUniform3fv(glGetUniformLocation(program, "u_color"), 1, &ctx.tf2[0]);
+
+    glBindVertexArray(meshVAO.vao);
+    glDrawElements(GL_TRIANGLES, meshVAO.numIndices, GL_UNSIGNED_INT, 0);
+    glBindVertexArray(ctx.defaultVAO);
+
+    glUseProgram(0);
+}
+
+// Draws a slice of the volume as a textured quad filling the current
+// viewport. The slice is sampled directly from the 3D volume texture, so
+// no voxel data is copied or re-uploaded when the plane moves. The plane
+// is given by its center and unit axes in physical (extent) units
+// relative to the volume center, and covers the largest extent of the
+// volume, so that all slice views have the same scale.
+void drawSlice(Context &ctx, GLuint program, const MeshVAO &quadVAO,
+               const RayCastVolume &rayCastVolume, const glm::vec3 &center,
+               const glm::vec3 &u, const glm::vec3 &v)
+{
+    glm::vec3 extent = glm::abs(cg::volumeComputeExtent(rayCastVolume.volume));
+    float size = std::max(extent.x, std::max(extent.y, extent.z));
+    glm::vec3 origin = glm::vec3(0.5f) + (center - 0.5f * size * (u + v)) / extent;
+    glm::vec3 texU = size * u / extent;
+    glm::vec3 texV = size * v / extent;
+
+    glUseProgram(program);
+    glUniform3fv(glGetUniformLocation(program, "u_origin"), 1, &origin[0]);
+    glUniform3fv(glGetUniformLocation(program, "u_u"), 1, &texU[0]);
+    glUniform3fv(glGetUniformLocation(program, "u_v"), 1, &texV[0]);
+    glUniform3fv(glGetUniformLocation(program, "u_background"), 1, &ctx.background[0]);
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_3D, rayCastVolume.volumeTexture);
+    glUniform1i(glGetUniformLocation(program, "u_volumeTexture"), 0);
+
     glBindVertexArray(quadVAO.vao);
     glDrawArrays(GL_TRIANGLES, 0, quadVAO.numVertices);
     glBindVertexArray(ctx.defaultVAO);
@@ -406,11 +1039,58 @@ void drawRayCasting(Context &ctx, GLuint program, const MeshVAO &quadVAO,
     glUseProgram(0);
 }
 
+// Draws the axial, coronal, sagittal, and oblique slice views in a
+// column of viewports along the right edge of the window. The oblique
+// slice is perpendicular to the viewing direction of the trackball.
+void drawSliceViews(Context &ctx)
+{
+    const RayCastVolume &rayCastVolume = ctx.rayCastVolume;
+    glm::vec3 extent = glm::abs(cg::volumeComputeExtent(rayCastVolume.volume));
+    glm::vec3 center = (ctx.slice_position - 0.5f) * extent;
+    glm::vec3 x(1.0f, 0.0f, 0.0f), y(0.0f, 1.0f, 0.0f), z(0.0f, 0.0f, 1.0f);
+
+    glm::mat4 rotation = trackballGetRotationMatrix(ctx.trackball);
+    glm::vec3 viewDir = glm::vec3(glm::transpose(rotation) * glm::vec4(0.0f, 0.0f, 1.0f, 0.0f));
+    cg::SlicePlane oblique = cg::slicePlaneFromNormal(glm::vec3(0.0f), viewDir, 2);
+
+    const glm::vec3 planes[4][3] = {
+        { glm::vec3(0.0f, 0.0f, center.z), x, y },  // axial
+        { glm::vec3(0.0f, center.y, 0.0f), x, z },  // coronal
+        { glm::vec3(center.x, 0.0f, 0.0f), y, z },  // sagittal
+        { center, oblique.u, oblique.v }
+    };
+
+    glDisable(GL_DEPTH_TEST);
+    glDisable(GL_CULL_FACE);
+    int size = std::min(ctx.height / 4, ctx.width / 3);
+    for (int i = 0; i < 4; ++i) {
+        glViewport(ctx.width - size, ctx.height - (i + 1) * size, size, size);
+        drawSlice(ctx, ctx.sliceProgram, ctx.quadVAO, rayCastVolume,
+                  planes[i][0], planes[i][1], planes[i][2]);
+    }
+    glViewport(0, 0, ctx.width, ctx.height);
+}
+
 void display(Context &ctx)
 {
     glClearColor(ctx.background.x, ctx.background.y, ctx.background.z, 0.0);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
+    if (ctx.isosurface_enable) {
+        glEnable(GL_DEPTH_TEST);
+        glDisable(GL_CULL_FACE);
+        drawIsosurface(ctx, ctx.isosurfaceProgram, ctx.isosurfaceVAO);
+        if (ctx.slices_enable) {
+            drawSliceViews(ctx);
+        }
+        return;
+    }
+
+    // Stream in the bricks requested in the previous frame
+    if (ctx.streaming_enable) {
+        updateBrickStream(ctx, &ctx.brickStream);
+    }
+
     // Render the front faces of the volume bounding box to a texture
     // via the frontFaceFBO
     glDisable(GL_DEPTH_TEST);
@@ -437,7 +1117,14 @@ void display(Context &ctx)
     // ...
      glCullFace(GL_BACK);
      glEnable(GL_DEPTH_TEST);
-     drawRayCasting(ctx, ctx.rayCasterProgram, ctx.quadVAO, ctx.rayCastVolume);
+     drawRayCasting(ctx, ctx.rayCasterProgram, ctx.quadVAO, ctx.rayCastVolume, false);
+     if (ctx.streaming_enable) {
+         drawBrickFeedback(ctx, &ctx.brickStream);
+     }
+
+    if (ctx.slices_enable) {
+        drawSliceViews(ctx);
+    }
 }
 
 void reloadShaders(Context *ctx)
@@ -448,6 +1135,12 @@ void reloadShaders(Context *ctx)
     glDeleteProgram(ctx->rayCasterProgram);
     ctx->rayCasterProgram = loadShaderProgram(shaderDir() + "rayCaster.vert",
                                               shaderDir() + "rayCaster.frag");
+    glDeleteProgram(ctx->isosurfaceProgram);
+    ctx->isosurfaceProgram = loadShaderProgram(shaderDir() + "isosurface.vert",
+                                               shaderDir() + "isosurface.frag");
+    glDeleteProgram(ctx->sliceProgram);
+    ctx->sliceProgram = loadShaderProgram(shaderDir() + "slice.vert",
+                                          shaderDir() + "slice.frag");
 }
 
 void mouseButtonPressed(Context *ctx, int button, int x, int y)
@@ -487,6 +1180,53 @@ void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods
     if (key == GLFW_KEY_R && action == GLFW_PRESS) {
         reloadShaders(ctx);
     }
+    if (key == GLFW_KEY_G && action == GLFW_PRESS) {
+        // Cycle through the procedural volumes
+        generateRayCastVolume(*ctx, ctx->synthetic_params, &ctx->rayCastVolume);
+        int next = (ctx->synthetic_params.field + 1) % cg::NUM_VOLUME_FIELDS;
+        ctx->synthetic_params.field = cg::VolumeField(next);
+    }
+    if (key == GLFW_KEY_I && action == GLFW_PRESS) {
+        // Toggle between ray-casting and the extracted isosurface
+        ctx->isosurface_enable = !ctx->isosurface_enable;
+        if (ctx->isosurface_enable) {
+            extractIsosurfaceMesh(ctx->rayCastVolume, ctx->iso_value, &ctx->isosurfaceMesh);
+            deleteMeshVAO(&ctx->isosurfaceVAO);
+            createMeshVAO(*ctx, ctx->isosurfaceMesh, &ctx->isosurfaceVAO);
+        }
+    }
+    if (key == GLFW_KEY_B && action == GLFW_PRESS) {
+        // Toggle streaming and reload the current volume at full resolution
+        ctx->streaming_enable = !ctx->streaming_enable;
+        bool reloaded;
+        if (!ctx->volume_filename.empty()) {
+            reloaded = loadRayCastVolume(*ctx, ctx->volume_filename, &ctx->rayCastVolume);
+            if (reloaded) {
+                ctx->rayCastVolume.volume.spacing *= VOLUME_SPACING_SCALE *
+                                                     datasetSpacingScale(ctx->dataset_current);
+            }
+        }
+        else {
+            // The G key has already advanced to the next procedural volume
+            cg::VolumeGenerateParams params = ctx->synthetic_params;
+            params.field = cg::VolumeField((params.field + cg::NUM_VOLUME_FIELDS - 1) % cg::NUM_VOLUME_FIELDS);
+            reloaded = generateRayCastVolume(*ctx, params, &ctx->rayCastVolume);
+        }
+        if (!reloaded) {
+            // The previous volume is kept, with its streaming state
+            ctx->streaming_enable = !ctx->streaming_enable;
+        }
+    }
+    if (key == GLFW_KEY_M && action == GLFW_PRESS) {
+        // Toggle the slice views
+        ctx->slices_enable = !ctx->slices_enable;
+    }
+    if ((key == GLFW_KEY_UP || key == GLFW_KEY_DOWN) && action != GLFW_RELEASE) {
+        // Move the slices by one voxel (of the uploaded volume)
+        glm::vec3 step = 1.0f / glm::vec3(ctx->rayCastVolume.volume.dimensions);
+        float sign = (key == GLFW_KEY_UP) ? 1.0f : -1.0f;
+        ctx->slice_position = glm::clamp(ctx->slice_position + sign * step, 0.0f, 1.0f);
+    }
 }
 
 void charCallback(GLFWwindow* window, unsigned int codepoint)
@@ -546,8 +1286,9 @@ void resizeCallback(GLFWwindow* window, int width, int height)
 */
 void loadDefault(Context &ctx) {
 
+    ctx.rayCastVolume.volume.spacing *= datasetSpacingScale(ctx.dataset_current);
+
     if(ctx.dataset_current == 0) {
-        ctx.rayCastVolume.volume.spacing *= 0.008f;
         ctx.tf4 = glm::vec3(0.7f, 0.5f, 0.5f);
         ctx.tf3 = glm::vec3(1.0f, 0.5f, 0.5f);
         ctx.tf2 = glm::vec3(1.0f, 1.0f, 0.8f);
@@ -565,7 +1306,6 @@ void loadDefault(Context &ctx) {
     }
     else if(ctx.dataset_current == 1) {
         // TODO: Set decent default values
-        ctx.rayCastVolume.volume.spacing *= 0.003f;
         ctx.tf4 = glm::vec3(0.7f, 0.5f, 0.5f);
         ctx.tf3 = glm::vec3(1.0f, 0.5f, 0.5f);
         ctx.tf2 = glm::vec3(1.0f, 1.0f, 0.8f);
@@ -583,7 +1323,6 @@ void loadDefault(Context &ctx) {
     }
     else if(ctx.dataset_current == 2) {
         // TODO: Set decent default values
-        ctx.rayCastVolume.volume.spacing *= 0.005f;
         ctx.tf4 = glm::vec3(0.7f, 0.5f, 0.5f);
         ctx.tf3 = glm::vec3(1.0f, 0.5f, 0.5f);
         ctx.tf2 = glm::vec3(1.0f, 1.0f, 0.8f);
@@ -601,7 +1340,6 @@ void loadDefault(Context &ctx) {
         }
     else if(ctx.dataset_current == 3) { 
         // TODO: Set decent default values
-        ctx.rayCastVolume.volume.spacing *= 0.008f;
         ctx.tf4 = glm::vec3(0.7f, 0.5f, 0.5f);
         ctx.tf3 = glm::vec3(1.0f, 0.5f, 0.5f);
         ctx.tf2 = glm::vec3(1.0f, 1.0f, 0.8f);
@@ -619,7 +1357,6 @@ void loadDefault(Context &ctx) {
         }
     else {
         // Should not occur
-        ctx.rayCastVolume.volume.spacing *= 0.008f;  // FIXME
     }
 
 }
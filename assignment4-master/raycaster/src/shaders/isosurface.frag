@@ -0,0 +1,22 @@
+// Fragment shader
+#version 150
+
+in vec3 v_normal;
+in vec3 v_position;
+
+out vec4 frag_color;
+
+uniform vec3 u_color;
+
+void main()
+{
+    // Two-sided Blinn-Phong shading with a headlight
+    vec3 N = normalize(v_normal);
+    vec3 V = normalize(-v_position);
+    if (dot(N, V) < 0.0) {
+        N = -N;
+    }
+    float diffuse = max(dot(N, V), 0.0);
+    float specular = pow(diffuse, 32.0);
+    frag_color = vec4(0.15 * u_color + 0.85 * diffuse * u_color + 0.3 * specular, 1.0);
+}
@@ -0,0 +1,19 @@
+// Vertex shader
+#version 150
+#extension GL_ARB_explicit_attrib_location : require
+
+layout(location = 0) in vec4 a_position;
+layout(location = 1) in vec3 a_normal;
+
+out vec3 v_normal;
+out vec3 v_position;
+
+uniform mat4 u_mv;
+uniform mat4 u_mvp;
+
+void main()
+{
+    v_normal = mat3(u_mv) * a_normal;
+    v_position = vec3(u_mv * a_position);
+    gl_Position = u_mvp * a_position;
+}
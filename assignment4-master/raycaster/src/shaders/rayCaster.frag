@@ -1,9 +1,11 @@
 // Fragment shader
 #version 150
+#extension GL_ARB_explicit_attrib_location : require
 
 in vec2 v_texcoord;
 
-out vec4 frag_color;
+layout(location = 0) out vec4 frag_color;
+layout(location = 1) out uint frag_request;  // feedback buffer (streaming only)
 
 uniform float u_step_size;
 uniform int u_mode;
@@ -29,6 +31,64 @@ uniform sampler3D u_volumeTexture;
 uniform sampler2D u_backFaceTexture;
 uniform sampler2D u_frontFaceTexture;
 
+// Bricked volume streaming. The page table has one mip level per volume
+// level with an entry per brick: the atlas slot in xyz, and in w 1 if
+// the brick is resident, 2 if it is empty, or 0 if it is missing.
+const int MAX_LEVELS = 12;
+uniform int u_streaming;
+uniform int u_feedback;
+uniform int u_frame;
+uniform sampler3D u_brickAtlas;
+uniform usampler3D u_pageTable;
+uniform int u_num_levels;
+uniform vec3 u_level_dims[MAX_LEVELS];
+uniform vec3 u_atlas_size;
+uniform float u_brick_size;
+
+uint g_request = 0u;  // first missing brick along the ray
+uint g_used = 0u;  // a resident brick used by the ray (for the LRU cache)
+int g_sample = 0;
+int g_used_sample = 0;
+
+uint packBrick(int level, ivec3 brick) {
+    return 1u + (uint(level) << 27) + (uint(brick.z) << 18) + (uint(brick.y) << 9) + uint(brick.x);
+}
+
+// Samples the volume, either from the volume texture or from the finest
+// resident level of the bricked volume. In the latter case, the brick
+// one level finer than the one used is requested, so that the volume
+// refines progressively.
+float sampleVolume(vec3 coord) {
+    if (u_streaming == 0) {
+        return texture(u_volumeTexture, coord).x;
+    }
+
+    g_sample++;
+    float payload = u_brick_size - 2.0;
+    ivec3 finer = ivec3(0);
+    for (int level = 0; level < u_num_levels; ++level) {
+        vec3 p = coord * u_level_dims[level];
+        ivec3 grid = ivec3(ceil(u_level_dims[level] / payload));
+        ivec3 brick = clamp(ivec3(max(p, 0.0) / payload), ivec3(0), grid - 1);
+        uvec4 entry = texelFetch(u_pageTable, brick, level);
+        if (entry.w == 2u) {
+            return 0.0;
+        }
+        if (entry.w == 1u) {
+            if (level > 0 && g_request == 0u) {
+                g_request = packBrick(level - 1, finer);
+            }
+            if (g_sample == g_used_sample) {
+                g_used = packBrick(level, brick);
+            }
+            vec3 local = p - vec3(brick) * payload + 1.0;
+            return texture(u_brickAtlas, (vec3(entry.xyz) * u_brick_size + local) / u_atlas_size).x;
+        }
+        finer = brick;
+    }
+    return 0.0;
+}
+
  // Color lookup table.
 vec4 lut(float i) {
 	vec4 grayscale = vec4(i*u_tf1_alpha);
@@ -70,6 +130,11 @@ void main()
 
 	float ray_delta_length = length(ray_delta);
 
+	// Report the brick of a pseudo-random sample along the ray as used
+	int num_samples = max(int(ray_length / u_step_size), 1);
+	g_used_sample = 1 + int(mod(dot(gl_FragCoord.xy, vec2(7.0, 13.0)) + float(u_frame) * 31.0,
+	                            float(num_samples)));
+
 	// Initialize final color and voxel position
     vec3 voxel_coord = ray_start;
     vec4 color = vec4(0);
@@ -87,7 +152,10 @@ void main()
     if(u_mode == 0)
     {
         while (color_out.a < 1.0 && ray_length >= 0) {
-        	intensity = texture(u_volumeTexture, voxel_coord).x;
+        	intensity = sampleVolume(voxel_coord);
+        	if (u_feedback == 1 && g_request != 0u) {
+        		break;
+        	}
         	color_sample = lut(intensity);
 
         	// Interpolation
@@ -109,7 +177,10 @@ void main()
     	float max_sample = 0.0;
 
     	while (ray_length > 0) { 
-    		float sample = texture(u_volumeTexture, voxel_coord).x;
+    		float sample = sampleVolume(voxel_coord);
+    		if (u_feedback == 1 && g_request != 0u) {
+    			break;
+    		}
     		if(sample > max_sample) {
     			max_sample = sample;
     		}
@@ -122,7 +193,8 @@ void main()
 
     // remove cube border and model artifacts produced from texture background
     // ideally black is zero but needs some arbitrary threshold
-    if(u_cor_enable == 1) {
+    frag_request = (g_request != 0u) ? g_request : g_used;
+    if(u_cor_enable == 1 && u_feedback == 0) {
     	if(color.x <= u_cor && color.y <= u_cor && color.z <= u_cor) {
        		discard;
     	}	
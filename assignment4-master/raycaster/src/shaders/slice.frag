@@ -0,0 +1,20 @@
+// Fragment shader
+#version 150
+
+in vec3 v_texcoord;
+
+out vec4 frag_color;
+
+uniform sampler3D u_volumeTexture;
+uniform vec3 u_background;
+
+void main()
+{
+    // Samples outside the volume show the background color
+    if (any(lessThan(v_texcoord, vec3(0.0))) || any(greaterThan(v_texcoord, vec3(1.0)))) {
+        frag_color = vec4(u_background, 1.0);
+        return;
+    }
+    float intensity = texture(u_volumeTexture, v_texcoord).r;
+    frag_color = vec4(vec3(intensity), 1.0);
+}
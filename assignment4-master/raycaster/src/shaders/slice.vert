@@ -0,0 +1,19 @@
+// Vertex shader
+#version 150
+#extension GL_ARB_explicit_attrib_location : require
+
+layout(location = 0) in vec4 a_position;
+
+out vec3 v_texcoord;
+
+// Slice plane in 3D texture coordinates
+uniform vec3 u_origin;
+uniform vec3 u_u;
+uniform vec3 u_v;
+
+void main()
+{
+    vec2 st = 0.5 * a_position.xy + 0.5;
+    v_texcoord = u_origin + st.x * u_u + st.y * u_v;
+    gl_Position = a_position;
+}
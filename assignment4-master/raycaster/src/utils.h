@@ -8,6 +8,21 @@
 #include <sstream>
 #include <string>
 #include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 std::string readShaderSource(const std::string &filename)
 {
@@ -103,51 +118,698 @@ GLuint loadShaderProgram(const std::string &vertexShaderFilename,
     return program;
 }
 
-GLuint load2DTexture(const std::string &filename)
+// Calls func(i) for every i in [0, n) on one thread per hardware
+// thread. The threads take the items one at a time, so that items of
+// different cost are balanced.
+template <typename Func>
+void textureParallelFor(std::size_t n, Func func)
+{
+    std::size_t numThreads = std::min<std::size_t>(std::max(1u, std::thread::hardware_concurrency()), n);
+    std::atomic<std::size_t> next(0);
+    auto worker = [&]() {
+        for (std::size_t i = next++; i < n; i = next++) {
+            func(i);
+        }
+    };
+    std::vector<std::thread> threads;
+    for (std::size_t i = 1; i < numThreads; ++i) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+}
+
+// Image of a level of a texture, decoded from a PNG file
+struct TextureImage {
+    std::string filename;
+    GLenum target;  // GL_TEXTURE_2D or a cubemap face
+    GLint level;
+    std::vector<unsigned char> data;  // RGBA8
+    unsigned width;
+    unsigned height;
+    unsigned error;  // lodepng error code
+
+    TextureImage() : target(GL_TEXTURE_2D), level(0), width(0), height(0), error(0) {}
+    TextureImage(const std::string &filename, GLenum target, GLint level)
+        : filename(filename), target(target), level(level), width(0), height(0), error(0) {}
+};
+
+namespace {
+
+// Converts an 8-bit sRGB value to linear
+float srgbToLinear(unsigned char value)
+{
+    float c = value / 255.0f;
+    return c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+}
+
+// Converts a linear value to 8-bit sRGB
+unsigned char linearToSrgb(float value)
+{
+    float c = std::min(std::max(value, 0.0f), 1.0f);
+    c = c <= 0.0031308f ? 12.92f * c : 1.055f * std::pow(c, 1.0f / 2.4f) - 0.055f;
+    return (unsigned char)(255.0f * c + 0.5f);
+}
+
+} // namespace
+
+// Box filters (or replicates) the texels of an image to a new size. The
+// colors of sRGB images are averaged in linear space, as OpenGL filters
+// sRGB textures.
+void resizeTextureImage(TextureImage *image, unsigned width, unsigned height, bool srgb = false)
+{
+    static const std::vector<float> linear = []() {
+        std::vector<float> table(256);
+        for (int i = 0; i < 256; ++i) {
+            table[i] = srgbToLinear((unsigned char)i);
+        }
+        return table;
+    }();
+
+    std::vector<unsigned char> resized(width * height * 4);
+    for (unsigned y = 0; y < height; ++y) {
+        unsigned y0 = y * image->height / height;
+        unsigned y1 = std::max((y + 1) * image->height / height, y0 + 1);
+        for (unsigned x = 0; x < width; ++x) {
+            unsigned x0 = x * image->width / width;
+            unsigned x1 = std::max((x + 1) * image->width / width, x0 + 1);
+            unsigned count = (y1 - y0) * (x1 - x0);
+            for (unsigned c = 0; c < 4; ++c) {
+                unsigned sum = 0;
+                float linearSum = 0.0f;
+                for (unsigned sy = y0; sy < y1; ++sy) {
+                    for (unsigned sx = x0; sx < x1; ++sx) {
+                        unsigned char value = image->data[(sy * image->width + sx) * 4 + c];
+                        sum += value;
+                        linearSum += linear[value];
+                    }
+                }
+                resized[(y * width + x) * 4 + c] = (srgb && c < 3) ? linearToSrgb(linearSum / count)
+                                                                   : (unsigned char)(sum / count);
+            }
+        }
+    }
+    image->data.swap(resized);
+    image->width = width;
+    image->height = height;
+}
+
+// Decodes the images on one thread per hardware thread, and uploads them
+// (in order) to the targets of the bound texture as soon as they are
+// decoded, so that decoding overlaps the uploads. The texels are copied
+// into a pixel buffer object, from which the driver transfers them to
+// the GPU without blocking this thread. prepare (if set) is called on
+// every image before its upload. Exits if an image cannot be decoded.
+void loadTextureImages(std::vector<TextureImage> *images, GLenum internalFormat,
+                       const std::function<void(TextureImage &)> &prepare = nullptr)
+{
+    std::size_t n = images->size();
+    std::vector<char> decoded(n, 0);
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::thread decoder([&]() {
+        textureParallelFor(n, [&](std::size_t i) {
+            TextureImage &image = (*images)[i];
+            image.error = lodepng::decode(image.data, image.width, image.height, image.filename);
+            std::lock_guard<std::mutex> lock(mutex);
+            decoded[i] = 1;
+            condition.notify_one();
+        });
+    });
+
+    GLuint pbo;
+    glGenBuffers(1, &pbo);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    bool failed = false;
+    for (std::size_t i = 0; i < n && !failed; ++i) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            condition.wait(lock, [&]() { return decoded[i] != 0; });
+        }
+        TextureImage &image = (*images)[i];
+        if (image.error != 0) {
+            failed = true;
+            break;
+        }
+        if (prepare) {
+            prepare(image);
+        }
+
+        // Orphans the storage of the previous image, so that mapping does
+        // not wait for its transfer
+        GLsizeiptr size = GLsizeiptr(image.data.size());
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, size, nullptr, GL_STREAM_DRAW);
+        void *dst = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size,
+                                     GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+        if (dst != nullptr) {
+            std::memcpy(dst, image.data.data(), image.data.size());
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+            glTexImage2D(image.target, image.level, internalFormat, image.width, image.height,
+                         0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        }
+        else {
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            glTexImage2D(image.target, image.level, internalFormat, image.width, image.height,
+                         0, GL_RGBA, GL_UNSIGNED_BYTE, image.data.data());
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+        }
+        std::vector<unsigned char>().swap(image.data);
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    glDeleteBuffers(1, &pbo);
+    decoder.join();
+
+    for (const TextureImage &image : *images) {
+        if (image.error != 0) {
+            std::cout << "Error: " << image.filename << ": " << lodepng_error_text(image.error) << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+    }
+}
+
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+#ifndef GL_COMPRESSED_SRGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_SRGB_S3TC_DXT1_EXT 0x8C4C
+#define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT 0x8C4F
+#endif
+
+// Block compressed texture, as stored in a KTX (version 1) file. The
+// levels are compressed with BC1 (opaque textures) or BC3 (textures with
+// alpha), in blocks of 4x4 texels.
+struct KTXTexture {
+    GLenum internalFormat;  // one of the S3TC formats above
+    GLenum baseInternalFormat;  // GL_RGB or GL_RGBA
+    unsigned width;
+    unsigned height;
+    unsigned numFaces;  // 1 or 6 (cubemap)
+    unsigned numLevels;
+    std::vector<std::vector<unsigned char>> images;  // face f of level l at [l * numFaces + f]
+    std::string writer;  // KTXwriter value of the file
+
+    KTXTexture() : internalFormat(0), baseInternalFormat(0), width(0), height(0), numFaces(0), numLevels(0) {}
+};
+
+namespace {
+
+const unsigned char KTX_IDENTIFIER[12] = { 0xAB, 'K', 'T', 'X', ' ', '1', '1', 0xBB, '\r', '\n', 0x1A, '\n' };
+
+// KTXwriter value of the files written by writeKTX. Cache files from
+// another version of the encoder are compressed again.
+const char KTX_WRITER[] = "model_viewer S3TC 2";
+
+// Packs an RGB color into 5:6:5 bits
+unsigned packRGB565(const float rgb[3])
+{
+    unsigned r = unsigned(std::min(std::max(rgb[0], 0.0f), 255.0f) * 31.0f / 255.0f + 0.5f);
+    unsigned g = unsigned(std::min(std::max(rgb[1], 0.0f), 255.0f) * 63.0f / 255.0f + 0.5f);
+    unsigned b = unsigned(std::min(std::max(rgb[2], 0.0f), 255.0f) * 31.0f / 255.0f + 0.5f);
+    return (r << 11) | (g << 5) | b;
+}
+
+// Unpacks a 5:6:5 color to 8 bits per channel
+void unpackRGB565(unsigned c, int rgb[3])
+{
+    rgb[0] = int(((c >> 11) & 31) * 255 + 15) / 31;
+    rgb[1] = int(((c >> 5) & 63) * 255 + 31) / 63;
+    rgb[2] = int((c & 31) * 255 + 15) / 31;
+}
+
+// Returns the four colors of a BC1 block (three and black for
+// threeColors blocks, which only BC1 has)
+void bc1Palette(unsigned c0, unsigned c1, bool threeColors, int palette[4][3])
+{
+    unpackRGB565(c0, palette[0]);
+    unpackRGB565(c1, palette[1]);
+    for (int c = 0; c < 3; ++c) {
+        if (threeColors) {
+            palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+            palette[3][c] = 0;
+        }
+        else {
+            palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+            palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+        }
+    }
+}
+
+// Compresses the colors of 4x4 RGBA texels into a BC1 color block. The
+// endpoints are the extremes of the texels along their principal axis.
+void compressColorBlock(const unsigned char texels[64], unsigned char block[8])
+{
+    float mean[3] = { 0.0f, 0.0f, 0.0f };
+    for (int i = 0; i < 16; ++i) {
+        for (int c = 0; c < 3; ++c) {
+            mean[c] += texels[4 * i + c] / 16.0f;
+        }
+    }
+    float cov[6] = { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+    for (int i = 0; i < 16; ++i) {
+        float d[3] = { texels[4 * i] - mean[0], texels[4 * i + 1] - mean[1], texels[4 * i + 2] - mean[2] };
+        cov[0] += d[0] * d[0]; cov[1] += d[0] * d[1]; cov[2] += d[0] * d[2];
+        cov[3] += d[1] * d[1]; cov[4] += d[1] * d[2]; cov[5] += d[2] * d[2];
+    }
+    // Power iteration for the principal axis, seeded with the column of
+    // the covariance of the channel with the largest variance (a fixed
+    // seed such as (1, 1, 1) is orthogonal to the axis of e.g. red/green
+    // edges). The seed is kept if the iteration collapses.
+    float axis[3] = { 1.0f, 1.0f, 1.0f };
+    if (cov[0] >= cov[3] && cov[0] >= cov[5] && cov[0] > 0.0f) {
+        axis[0] = cov[0]; axis[1] = cov[1]; axis[2] = cov[2];
+    }
+    else if (cov[3] >= cov[5] && cov[3] > 0.0f) {
+        axis[0] = cov[1]; axis[1] = cov[3]; axis[2] = cov[4];
+    }
+    else if (cov[5] > 0.0f) {
+        axis[0] = cov[2]; axis[1] = cov[4]; axis[2] = cov[5];
+    }
+    for (int iteration = 0; iteration < 8; ++iteration) {
+        float x = cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2];
+        float y = cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2];
+        float z = cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2];
+        float len = std::max(std::max(std::abs(x), std::abs(y)), std::abs(z));
+        if (len < 1e-6f) {
+            break;
+        }
+        axis[0] = x / len; axis[1] = y / len; axis[2] = z / len;
+    }
+    float len2 = axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2];
+    float minT = 0.0f, maxT = 0.0f;
+    for (int i = 0; i < 16; ++i) {
+        float t = ((texels[4 * i] - mean[0]) * axis[0] + (texels[4 * i + 1] - mean[1]) * axis[1] +
+                   (texels[4 * i + 2] - mean[2]) * axis[2]) / len2;
+        minT = std::min(minT, t);
+        maxT = std::max(maxT, t);
+    }
+    float e0[3], e1[3];
+    for (int c = 0; c < 3; ++c) {
+        e0[c] = mean[c] + axis[c] * maxT;
+        e1[c] = mean[c] + axis[c] * minT;
+    }
+    unsigned c0 = packRGB565(e0), c1 = packRGB565(e1);
+    if (c0 < c1) {
+        std::swap(c0, c1);
+    }
+
+    // Four color blocks need c0 > c1, so blocks of a single color use
+    // index 0 only
+    unsigned indices = 0;
+    if (c0 != c1) {
+        int palette[4][3];
+        bc1Palette(c0, c1, false, palette);
+        for (int i = 0; i < 16; ++i) {
+            int best = 0, bestDistance = 1 << 30;
+            for (int p = 0; p < 4; ++p) {
+                int dr = texels[4 * i] - palette[p][0], dg = texels[4 * i + 1] - palette[p][1],
+                    db = texels[4 * i + 2] - palette[p][2];
+                int distance = dr * dr + dg * dg + db * db;
+                if (distance < bestDistance) {
+                    best = p;
+                    bestDistance = distance;
+                }
+            }
+            indices |= unsigned(best) << (2 * i);
+        }
+    }
+    block[0] = c0 & 0xFF; block[1] = c0 >> 8;
+    block[2] = c1 & 0xFF; block[3] = c1 >> 8;
+    for (int i = 0; i < 4; ++i) {
+        block[4 + i] = (indices >> (8 * i)) & 0xFF;
+    }
+}
+
+// Compresses the alpha of 4x4 RGBA texels into a BC3 alpha block, with
+// the minimum and maximum alpha as endpoints
+void compressAlphaBlock(const unsigned char texels[64], unsigned char block[8])
+{
+    int a0 = 0, a1 = 255;
+    for (int i = 0; i < 16; ++i) {
+        a0 = std::max(a0, int(texels[4 * i + 3]));
+        a1 = std::min(a1, int(texels[4 * i + 3]));
+    }
+    std::uint64_t indices = 0;
+    if (a0 > a1) {
+        for (int i = 0; i < 16; ++i) {
+            // Index 0 and 1 are the endpoints, 2..7 interpolate from a0 to a1
+            int step = ((a0 - texels[4 * i + 3]) * 14 + (a0 - a1)) / (2 * (a0 - a1));
+            int index = step == 0 ? 0 : (step == 7 ? 1 : step + 1);
+            indices |= std::uint64_t(index) << (3 * i);
+        }
+    }
+    block[0] = (unsigned char)a0;
+    block[1] = (unsigned char)a1;
+    for (int i = 0; i < 6; ++i) {
+        block[2 + i] = (indices >> (8 * i)) & 0xFF;
+    }
+}
+
+} // namespace
+
+// Compresses RGBA8 texels into BC1 blocks (or BC3 blocks if alpha is
+// set), in parallel over the rows of blocks. Texels outside of the image
+// (in blocks at the edges) repeat the edge texels.
+void compressS3TC(const unsigned char *rgba, unsigned width, unsigned height, bool alpha,
+                  std::vector<unsigned char> *blocks)
+{
+    unsigned blocksX = (width + 3) / 4, blocksY = (height + 3) / 4;
+    std::size_t blockSize = alpha ? 16 : 8;
+    blocks->resize(blocksX * blocksY * blockSize);
+    textureParallelFor(blocksY, [&](std::size_t by) {
+        unsigned char texels[64];
+        for (unsigned bx = 0; bx < blocksX; ++bx) {
+            for (unsigned i = 0; i < 16; ++i) {
+                unsigned x = std::min(4 * bx + i % 4, width - 1), y = std::min(4 * unsigned(by) + i / 4, height - 1);
+                std::memcpy(&texels[4 * i], &rgba[4 * (std::size_t(y) * width + x)], 4);
+            }
+            unsigned char *block = &(*blocks)[(by * blocksX + bx) * blockSize];
+            if (alpha) {
+                compressAlphaBlock(texels, block);
+                block += 8;
+            }
+            compressColorBlock(texels, block);
+        }
+    });
+}
+
+// Decompresses BC1 blocks (or BC3 blocks if alpha is set) into RGBA8
+// texels
+void decompressS3TC(const unsigned char *blocks, unsigned width, unsigned height, bool alpha,
+                    std::vector<unsigned char> *rgba)
+{
+    unsigned blocksX = (width + 3) / 4, blocksY = (height + 3) / 4;
+    std::size_t blockSize = alpha ? 16 : 8;
+    rgba->resize(std::size_t(width) * height * 4);
+    for (unsigned by = 0; by < blocksY; ++by) {
+        for (unsigned bx = 0; bx < blocksX; ++bx) {
+            const unsigned char *block = &blocks[(by * blocksX + bx) * blockSize];
+            int alphas[8] = { 255, 255, 255, 255, 255, 255, 255, 255 };
+            std::uint64_t alphaIndices = 0;
+            if (alpha) {
+                alphas[0] = block[0];
+                alphas[1] = block[1];
+                for (int i = 2; i < 8; ++i) {
+                    alphas[i] = (alphas[0] > alphas[1]) ? ((8 - i) * alphas[0] + (i - 1) * alphas[1]) / 7
+                              : (i < 6 ? ((6 - i) * alphas[0] + (i - 1) * alphas[1]) / 5 : (i == 6 ? 0 : 255));
+                }
+                for (int i = 0; i < 6; ++i) {
+                    alphaIndices |= std::uint64_t(block[2 + i]) << (8 * i);
+                }
+                block += 8;
+            }
+            unsigned c0 = block[0] | (block[1] << 8), c1 = block[2] | (block[3] << 8);
+            unsigned indices = block[4] | (block[5] << 8) | (block[6] << 16) | (unsigned(block[7]) << 24);
+            bool threeColors = !alpha && c0 <= c1;
+            int palette[4][3];
+            bc1Palette(c0, c1, threeColors, palette);
+            for (unsigned i = 0; i < 16; ++i) {
+                unsigned x = 4 * bx + i % 4, y = 4 * by + i / 4;
+                if (x >= width || y >= height) {
+                    continue;
+                }
+                unsigned index = (indices >> (2 * i)) & 3;
+                unsigned char *texel = &(*rgba)[4 * (std::size_t(y) * width + x)];
+                for (int c = 0; c < 3; ++c) {
+                    texel[c] = (unsigned char)palette[index][c];
+                }
+                texel[3] = (unsigned char)(alpha ? alphas[(alphaIndices >> (3 * i)) & 7]
+                                                 : (threeColors && index == 3 ? 0 : 255));
+            }
+        }
+    }
+}
+
+// Writes a texture to a KTX file. Returns true on success, false
+// otherwise.
+bool writeKTX(const std::string &filename, const KTXTexture &ktx)
+{
+    std::ofstream out(filename, std::ios::binary);
+    if (!out) {
+        std::cerr << "Error: Could not open file " << filename << std::endl;
+        return false;
+    }
+    // Key and value pair "KTXwriter", padded to 4 bytes
+    std::string keyValue = std::string("KTXwriter") + '\0' + KTX_WRITER + '\0';
+    std::uint32_t keyValueSize = std::uint32_t(keyValue.size());
+    keyValue.resize((keyValue.size() + 3) / 4 * 4, '\0');
+    const std::uint32_t header[13] = {
+        0x04030201, 0, 1, 0, ktx.internalFormat, ktx.baseInternalFormat, ktx.width, ktx.height,
+        0, 0, ktx.numFaces, ktx.numLevels, std::uint32_t(sizeof(keyValueSize) + keyValue.size())
+    };
+    out.write(reinterpret_cast<const char *>(KTX_IDENTIFIER), sizeof(KTX_IDENTIFIER));
+    out.write(reinterpret_cast<const char *>(header), sizeof(header));
+    out.write(reinterpret_cast<const char *>(&keyValueSize), sizeof(keyValueSize));
+    out.write(keyValue.data(), keyValue.size());
+    for (unsigned l = 0; l < ktx.numLevels; ++l) {
+        // Size of one face (the blocks are multiples of 4 bytes, so
+        // there is no padding)
+        std::uint32_t imageSize = std::uint32_t(ktx.images[l * ktx.numFaces].size());
+        out.write(reinterpret_cast<const char *>(&imageSize), sizeof(imageSize));
+        for (unsigned f = 0; f < ktx.numFaces; ++f) {
+            const std::vector<unsigned char> &image = ktx.images[l * ktx.numFaces + f];
+            out.write(reinterpret_cast<const char *>(image.data()), image.size());
+        }
+    }
+    if (!out) {
+        std::cerr << "Error: Could not write file " << filename << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Reads a texture written by writeKTX. Returns true on success, false
+// otherwise.
+bool readKTX(const std::string &filename, KTXTexture *ktx)
+{
+    std::ifstream in(filename, std::ios::binary);
+    if (!in) {
+        std::cerr << "Error: Could not open file " << filename << std::endl;
+        return false;
+    }
+    unsigned char identifier[sizeof(KTX_IDENTIFIER)];
+    std::uint32_t header[13];
+    if (!in.read(reinterpret_cast<char *>(identifier), sizeof(identifier)) ||
+        std::memcmp(identifier, KTX_IDENTIFIER, sizeof(identifier)) != 0 ||
+        !in.read(reinterpret_cast<char *>(header), sizeof(header)) || header[0] != 0x04030201 ||
+        (header[10] != 1 && header[10] != 6) || header[11] < 1 || header[11] > 16) {
+        std::cerr << "Error: Invalid KTX file " << filename << std::endl;
+        return false;
+    }
+    KTXTexture result;
+    result.internalFormat = header[4];
+    result.baseInternalFormat = header[5];
+    result.width = header[6];
+    result.height = header[7];
+    result.numFaces = header[10];
+    result.numLevels = header[11];
+    if (result.internalFormat != GL_COMPRESSED_RGB_S3TC_DXT1_EXT &&
+        result.internalFormat != GL_COMPRESSED_RGBA_S3TC_DXT5_EXT &&
+        result.internalFormat != GL_COMPRESSED_SRGB_S3TC_DXT1_EXT &&
+        result.internalFormat != GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT) {
+        std::cerr << "Error: Unsupported KTX format " << result.internalFormat << " in " << filename << std::endl;
+        return false;
+    }
+    bool alpha = (result.internalFormat == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT ||
+                  result.internalFormat == GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT);
+    // Key and value pairs, of which only KTXwriter is kept
+    std::vector<char> keyValues(header[12]);
+    in.read(keyValues.data(), keyValues.size());
+    for (std::size_t i = 0; i + 4 <= keyValues.size();) {
+        std::uint32_t size;
+        std::memcpy(&size, &keyValues[i], sizeof(size));
+        std::string keyValue(keyValues.data() + i + 4, std::min<std::size_t>(size, keyValues.size() - i - 4));
+        std::size_t separator = keyValue.find('\0');
+        if (separator != std::string::npos && keyValue.compare(0, separator, "KTXwriter") == 0) {
+            result.writer = keyValue.substr(separator + 1);
+            result.writer = result.writer.substr(0, result.writer.find('\0'));
+        }
+        i += 4 + (std::size_t(size) + 3) / 4 * 4;
+    }
+    for (unsigned l = 0; l < result.numLevels; ++l) {
+        unsigned w = std::max(result.width >> l, 1u), h = std::max(result.height >> l, 1u);
+        std::uint32_t imageSize = 0;
+        in.read(reinterpret_cast<char *>(&imageSize), sizeof(imageSize));
+        if (imageSize != ((w + 3) / 4) * ((h + 3) / 4) * (alpha ? 16 : 8)) {
+            std::cerr << "Error: Invalid KTX file " << filename << std::endl;
+            return false;
+        }
+        for (unsigned f = 0; f < result.numFaces; ++f) {
+            result.images.emplace_back(imageSize);
+            in.read(reinterpret_cast<char *>(result.images.back().data()), imageSize);
+        }
+    }
+    if (!in) {
+        std::cerr << "Error: Invalid KTX file " << filename << std::endl;
+        return false;
+    }
+    *ktx = std::move(result);
+    return true;
+}
+
+// Uploads all levels of a texture to the bound texture of target
+// (GL_TEXTURE_2D or GL_TEXTURE_CUBE_MAP). The blocks are uploaded as they
+// are if the GPU supports S3TC, and are otherwise decompressed on the CPU
+// and uploaded as 8-bit RGBA.
+void uploadKTX(const KTXTexture &ktx, GLenum target)
 {
-    std::vector<unsigned char> data;
-    unsigned width, height;
-    unsigned error = lodepng::decode(data, width, height, filename);
-    if (error != 0) {
-        std::cout << "Error: " << lodepng_error_text(error) << std::endl;
-        std::exit(EXIT_FAILURE);
+    bool srgb = (ktx.internalFormat == GL_COMPRESSED_SRGB_S3TC_DXT1_EXT ||
+                 ktx.internalFormat == GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT);
+    bool alpha = (ktx.internalFormat == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT ||
+                  ktx.internalFormat == GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT);
+    bool supported = GLEW_EXT_texture_compression_s3tc && (!srgb || GLEW_EXT_texture_sRGB);
+    glTexParameteri(target, GL_TEXTURE_BASE_LEVEL, 0);
+    glTexParameteri(target, GL_TEXTURE_MAX_LEVEL, ktx.numLevels - 1);
+    std::vector<unsigned char> rgba;
+    for (unsigned l = 0; l < ktx.numLevels; ++l) {
+        unsigned w = std::max(ktx.width >> l, 1u), h = std::max(ktx.height >> l, 1u);
+        for (unsigned f = 0; f < ktx.numFaces; ++f) {
+            GLenum faceTarget = (ktx.numFaces == 6) ? GL_TEXTURE_CUBE_MAP_POSITIVE_X + f : target;
+            const std::vector<unsigned char> &image = ktx.images[l * ktx.numFaces + f];
+            if (supported) {
+                glCompressedTexImage2D(faceTarget, l, ktx.internalFormat, w, h, 0, GLsizei(image.size()),
+                                       image.data());
+            }
+            else {
+                decompressS3TC(image.data(), w, h, alpha, &rgba);
+                glTexImage2D(faceTarget, l, srgb ? GL_SRGB8_ALPHA8 : GL_RGBA8, w, h, 0, GL_RGBA,
+                             GL_UNSIGNED_BYTE, rgba.data());
+            }
+        }
+    }
+}
+
+// Loads the images of the bound texture (see loadTextureImages) from a
+// block compressed cache file. If the cache file is missing or older
+// than any of the images, the images are decoded in parallel, prepared,
+// given a mipmap chain (if generateMipmaps is set), compressed, and
+// written to the cache file first. internalFormat (GL_RGBA8 or
+// GL_SRGB8_ALPHA8) selects the compressed format.
+void loadCompressedTextureImages(std::vector<TextureImage> *images, const std::string &cacheFilename,
+                                 GLenum internalFormat, bool generateMipmaps,
+                                 const std::function<void(TextureImage &)> &prepare = nullptr)
+{
+    GLenum target = ((*images)[0].target == GL_TEXTURE_2D) ? GL_TEXTURE_2D : GL_TEXTURE_CUBE_MAP;
+    unsigned numFaces = (target == GL_TEXTURE_2D) ? 1 : 6;
+
+    std::error_code ec;
+    auto cacheTime = std::filesystem::last_write_time(cacheFilename, ec);
+    bool fresh = !ec;
+    for (const TextureImage &image : *images) {
+        auto imageTime = std::filesystem::last_write_time(image.filename, ec);
+        fresh = fresh && (ec || imageTime <= cacheTime);
+    }
+    KTXTexture ktx;
+    if (fresh && readKTX(cacheFilename, &ktx) && ktx.numFaces == numFaces && ktx.writer == KTX_WRITER) {
+        uploadKTX(ktx, target);
+        return;
     }
 
+    // Decodes the images (face f of level l at [l * numFaces + f])
+    textureParallelFor(images->size(), [&](std::size_t i) {
+        TextureImage &image = (*images)[i];
+        image.error = lodepng::decode(image.data, image.width, image.height, image.filename);
+    });
+    for (TextureImage &image : *images) {
+        if (image.error != 0) {
+            std::cout << "Error: " << image.filename << ": " << lodepng_error_text(image.error) << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+        if (prepare) {
+            prepare(image);
+        }
+    }
+    bool srgb = (internalFormat == GL_SRGB8_ALPHA8);
+    if (generateMipmaps) {
+        // The faces of each level are filtered in parallel
+        for (unsigned l = 0; std::max((*images)[l * numFaces].width, (*images)[l * numFaces].height) > 1; ++l) {
+            std::vector<TextureImage> level(numFaces);
+            textureParallelFor(numFaces, [&](std::size_t f) {
+                level[f] = (*images)[l * numFaces + f];
+                level[f].level = GLint(l + 1);
+                resizeTextureImage(&level[f], std::max(level[f].width / 2, 1u), std::max(level[f].height / 2, 1u),
+                                   srgb);
+            });
+            images->insert(images->end(), level.begin(), level.end());
+        }
+    }
+
+    bool alpha = false;
+    for (const TextureImage &image : *images) {
+        for (std::size_t i = 3; i < image.data.size() && !alpha; i += 4) {
+            alpha = image.data[i] != 255;
+        }
+    }
+    ktx.internalFormat = alpha ? (srgb ? GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT)
+                               : (srgb ? GL_COMPRESSED_SRGB_S3TC_DXT1_EXT : GL_COMPRESSED_RGB_S3TC_DXT1_EXT);
+    ktx.baseInternalFormat = alpha ? GL_RGBA : GL_RGB;
+    ktx.width = (*images)[0].width;
+    ktx.height = (*images)[0].height;
+    ktx.numFaces = numFaces;
+    ktx.numLevels = unsigned(images->size()) / numFaces;
+    ktx.images.resize(images->size());
+    for (std::size_t i = 0; i < images->size(); ++i) {
+        const TextureImage &image = (*images)[i];
+        compressS3TC(image.data.data(), image.width, image.height, alpha, &ktx.images[i]);
+    }
+    if (writeKTX(cacheFilename, ktx)) {
+        // Display log message
+        std::cout << "Compressed " << images->size() << " images to " << cacheFilename << std::endl;
+    }
+    uploadKTX(ktx, target);
+}
+
+// Load 2D texture with a mipmap chain. The texture is block compressed
+// and cached next to the image (as a .ktx file) if compressed is set.
+GLuint load2DTexture(const std::string &filename, bool compressed = true)
+{
+    std::vector<TextureImage> images(1, TextureImage(filename, GL_TEXTURE_2D, 0));
+
     GLuint texture;
     glGenTextures(1, &texture);
     glBindTexture(GL_TEXTURE_2D, texture);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA,
-                 GL_UNSIGNED_BYTE, &(data[0]));
+    if (compressed) {
+        std::string cacheFilename = std::filesystem::path(filename).replace_extension(".ktx").string();
+        loadCompressedTextureImages(&images, cacheFilename, GL_RGBA8, true);
+    }
+    else {
+        loadTextureImages(&images, GL_RGBA8);
+        glGenerateMipmap(GL_TEXTURE_2D);
+    }
     glBindTexture(GL_TEXTURE_2D, 0);
 
     return texture;
 }
 
-// Load cubemap texture and let OpenGL generate a mipmap chain
-GLuint loadCubemap(const std::string &dirname)
+// Filenames of the cubemap faces, in the order of the face targets
+// (GL_TEXTURE_CUBE_MAP_POSITIVE_X + face)
+const char *const CUBEMAP_FACE_FILENAMES[] = {
+    "posx.png", "negx.png", "posy.png", "negy.png", "posz.png", "negz.png"
+};
+
+// Subdirectories of the levels of a prefiltered cubemap, named by the
+// Phong exponent that each level is filtered for
+const char *const CUBEMAP_PREFILTERED_LEVELS[] = {
+    "2048", "512", "128", "32", "8", "2", "0.5", "0.125"
+};
+
+// Load cubemap texture and let OpenGL generate a mipmap chain. The
+// cubemap is block compressed and cached in dirname/cubemap.ktx (with
+// the mipmap chain) if compressed is set.
+GLuint loadCubemap(const std::string &dirname, bool compressed = true)
 {
-    const char *filenames[] = { "posx.png", "negx.png", "posy.png", "negy.png", "posz.png", "negz.png" };
-    const GLenum targets[] = {
-        GL_TEXTURE_CUBE_MAP_POSITIVE_X, GL_TEXTURE_CUBE_MAP_NEGATIVE_X,
-        GL_TEXTURE_CUBE_MAP_POSITIVE_Y, GL_TEXTURE_CUBE_MAP_NEGATIVE_Y,
-        GL_TEXTURE_CUBE_MAP_POSITIVE_Z, GL_TEXTURE_CUBE_MAP_NEGATIVE_Z
-    };
-    const unsigned num_sides = 6; 
+    const unsigned num_sides = 6;
 
-    std::vector<unsigned char> data[num_sides];
-    unsigned width;
-    unsigned height;
+    std::vector<TextureImage> images;
     for (unsigned i = 0; i < num_sides; ++i) {
-        std::string filename = dirname + "/" + filenames[i];
-        unsigned error = lodepng::decode(data[i], width, height, filename);
-        if (error != 0) {
-            std::cout << "Error: " << lodepng_error_text(error) << std::endl;
-            std::exit(EXIT_FAILURE);
-        }
+        images.emplace_back(dirname + "/" + CUBEMAP_FACE_FILENAMES[i], GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0);
     }
 
     GLuint texture;
@@ -157,41 +819,31 @@ GLuint loadCubemap(const std::string &dirname)
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    for (unsigned i = 0; i < num_sides; ++i) {
-        glTexImage2D(targets[i], 0, GL_SRGB8_ALPHA8, width, height,
-                     0, GL_RGBA, GL_UNSIGNED_BYTE, &(data[i][0]));
+    if (compressed) {
+        loadCompressedTextureImages(&images, dirname + "/cubemap.ktx", GL_SRGB8_ALPHA8, true);
+    }
+    else {
+        loadTextureImages(&images, GL_SRGB8_ALPHA8);
+        glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
     }
-    glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
     glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
 
     return texture;
 }
 
-// Load cubemap with pre-computed mipmap chain
-GLuint loadCubemapMipmap(const std::string &dirname)
+// Load cubemap with pre-computed mipmap chain. The cubemap is block
+// compressed and cached in dirname/mipmap.ktx if compressed is set.
+GLuint loadCubemapMipmap(const std::string &dirname, bool compressed = true)
 {
-    const char *levels[] = { "2048", "512", "128", "32", "8", "2", "0.5", "0.125" };
-    const char *filenames[] = { "posx.png", "negx.png", "posy.png", "negy.png", "posz.png", "negz.png" };
-    const GLenum targets[] = {
-        GL_TEXTURE_CUBE_MAP_POSITIVE_X, GL_TEXTURE_CUBE_MAP_NEGATIVE_X,
-        GL_TEXTURE_CUBE_MAP_POSITIVE_Y, GL_TEXTURE_CUBE_MAP_NEGATIVE_Y,
-        GL_TEXTURE_CUBE_MAP_POSITIVE_Z, GL_TEXTURE_CUBE_MAP_NEGATIVE_Z
-    };
+    const unsigned num_levels = sizeof(CUBEMAP_PREFILTERED_LEVELS) / sizeof(CUBEMAP_PREFILTERED_LEVELS[0]);
+    const unsigned num_sides = 6;
 
-    const unsigned num_levels = sizeof(levels) / sizeof(levels[0]);
-    const unsigned num_sides = 6; 
-
-    std::vector<unsigned char> data[num_levels][num_sides];
-    unsigned width[num_levels];
-    unsigned height[num_levels];
+    // All 48 images are decoded in parallel, level 0 first
+    std::vector<TextureImage> images;
     for (unsigned i = 0; i < num_levels; ++i) {
         for (unsigned j = 0; j < num_sides; ++j) {
-            std::string filename = dirname + "/" + levels[i] + "/" + filenames[j];
-            unsigned error = lodepng::decode(data[i][j], width[i], height[i], filename);
-            if (error != 0) {
-                std::cout << "Error: " << lodepng_error_text(error) << std::endl;
-                std::exit(EXIT_FAILURE);
-            }
+            images.emplace_back(dirname + "/" + CUBEMAP_PREFILTERED_LEVELS[i] + "/" + CUBEMAP_FACE_FILENAMES[j],
+                                GL_TEXTURE_CUBE_MAP_POSITIVE_X + j, GLint(i));
         }
     }
 
@@ -202,13 +854,426 @@ GLuint loadCubemapMipmap(const std::string &dirname)
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    for (unsigned i = 0; i < num_levels; ++i) {
-        for (unsigned j = 0; j < num_sides; ++j) {
-            glTexImage2D(targets[j], i, GL_SRGB8_ALPHA8, width[i], height[i],
-                         0, GL_RGBA, GL_UNSIGNED_BYTE, &(data[i][j][0]));
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_BASE_LEVEL, 0);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, num_levels - 1);
+
+    // Each level must be half the size of the previous one for the
+    // mipmap chain to be complete, so levels stored at other sizes are
+    // box filtered (or replicated) to the expected size
+    unsigned width = 0, height = 0;
+    auto prepare = [&](TextureImage &image) {
+        if (image.level == 0) {
+            width = image.width;
+            height = image.height;
+            return;
         }
+        unsigned w = std::max(width >> image.level, 1u);
+        unsigned h = std::max(height >> image.level, 1u);
+        if (image.width != w || image.height != h) {
+            resizeTextureImage(&image, w, h, true);
+        }
+    };
+    if (compressed) {
+        loadCompressedTextureImages(&images, dirname + "/mipmap.ktx", GL_SRGB8_ALPHA8, false, prepare);
+    }
+    else {
+        loadTextureImages(&images, GL_SRGB8_ALPHA8, prepare);
     }
     glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
 
     return texture;
 }
+
+// Lobes for prefiltering environment maps
+enum PrefilterLobe {
+    PREFILTER_PHONG = 0,  // normalized Phong lobe around the reflection vector
+    PREFILTER_GGX = 1  // GGX distribution, with the roughness of the Phong exponent
+};
+
+// Cubemap with linear RGB float texels and a complete mipmap chain, used
+// as the source of prefiltering
+struct FloatCubemap {
+    std::vector<unsigned> sizes;  // face size of each level
+    std::vector<std::vector<float>> texels;  // RGB texels of face f of level l at [6 * l + f]
+};
+
+namespace {
+
+// Returns the (unnormalized) direction through the point (s, t) in
+// [-1, 1]^2 of a cubemap face, as defined by the OpenGL specification
+void cubemapDirection(int face, float s, float t, float dir[3])
+{
+    switch (face) {
+    case 0: dir[0] = 1.0f; dir[1] = -t; dir[2] = -s; break;
+    case 1: dir[0] = -1.0f; dir[1] = -t; dir[2] = s; break;
+    case 2: dir[0] = s; dir[1] = 1.0f; dir[2] = t; break;
+    case 3: dir[0] = s; dir[1] = -1.0f; dir[2] = -t; break;
+    case 4: dir[0] = s; dir[1] = -t; dir[2] = 1.0f; break;
+    default: dir[0] = -s; dir[1] = -t; dir[2] = -1.0f; break;
+    }
+}
+
+// Projects n directions (stored as separate x, y, and z arrays) onto the
+// cubemap, returning the face and the texture coordinates in [0, 1] of
+// each direction. Four directions at a time with SSE.
+void cubemapProjectDirections(const float *x, const float *y, const float *z, std::size_t n,
+                              int *face, float *s, float *t)
+{
+    std::size_t i = 0;
+#ifdef __SSE2__
+    const __m128 signMask = _mm_set1_ps(-0.0f);
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128i two = _mm_set1_epi32(2), four = _mm_set1_epi32(4);
+    for (; i + 4 <= n; i += 4) {
+        __m128 vx = _mm_loadu_ps(x + i), vy = _mm_loadu_ps(y + i), vz = _mm_loadu_ps(z + i);
+        __m128 sx = _mm_and_ps(vx, signMask), sy = _mm_and_ps(vy, signMask), sz = _mm_and_ps(vz, signMask);
+        __m128 ax = _mm_xor_ps(vx, sx), ay = _mm_xor_ps(vy, sy), az = _mm_xor_ps(vz, sz);
+        __m128 xMajor = _mm_and_ps(_mm_cmpge_ps(ax, ay), _mm_cmpge_ps(ax, az));
+        __m128 yMajor = _mm_andnot_ps(xMajor, _mm_cmpge_ps(ay, az));
+        __m128 zMajor = _mm_andnot_ps(_mm_or_ps(xMajor, yMajor), _mm_castsi128_ps(_mm_set1_epi32(-1)));
+
+        // Major axis, and the s and t coordinates on the face (see
+        // cubemapDirection): +-x: (-+z, -y), +-y: (x, +-z), +-z: (+-x, -y)
+        __m128 ma = _mm_or_ps(_mm_and_ps(xMajor, ax),
+                              _mm_or_ps(_mm_and_ps(yMajor, ay), _mm_and_ps(zMajor, az)));
+        __m128 sc = _mm_or_ps(_mm_and_ps(xMajor, _mm_xor_ps(_mm_xor_ps(vz, signMask), sx)),
+                              _mm_or_ps(_mm_and_ps(yMajor, vx), _mm_and_ps(zMajor, _mm_xor_ps(vx, sz))));
+        __m128 tc = _mm_or_ps(_mm_and_ps(yMajor, _mm_xor_ps(vz, sy)),
+                              _mm_andnot_ps(yMajor, _mm_xor_ps(vy, signMask)));
+        __m128 invMa = _mm_div_ps(half, ma);
+        _mm_storeu_ps(s + i, _mm_add_ps(_mm_mul_ps(sc, invMa), half));
+        _mm_storeu_ps(t + i, _mm_add_ps(_mm_mul_ps(tc, invMa), half));
+
+        __m128i fx = _mm_srli_epi32(_mm_castps_si128(sx), 31);
+        __m128i fy = _mm_add_epi32(_mm_srli_epi32(_mm_castps_si128(sy), 31), two);
+        __m128i fz = _mm_add_epi32(_mm_srli_epi32(_mm_castps_si128(sz), 31), four);
+        __m128i f = _mm_or_si128(_mm_and_si128(_mm_castps_si128(xMajor), fx),
+                                 _mm_or_si128(_mm_and_si128(_mm_castps_si128(yMajor), fy),
+                                              _mm_and_si128(_mm_castps_si128(zMajor), fz)));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(face + i), f);
+    }
+#endif
+    for (; i < n; ++i) {
+        float ax = std::abs(x[i]), ay = std::abs(y[i]), az = std::abs(z[i]);
+        float ma, sc, tc;
+        if (ax >= ay && ax >= az) {
+            face[i] = std::signbit(x[i]) ? 1 : 0;
+            ma = ax;
+            sc = std::signbit(x[i]) ? z[i] : -z[i];
+            tc = -y[i];
+        }
+        else if (ay >= az) {
+            face[i] = std::signbit(y[i]) ? 3 : 2;
+            ma = ay;
+            sc = x[i];
+            tc = std::signbit(y[i]) ? -z[i] : z[i];
+        }
+        else {
+            face[i] = std::signbit(z[i]) ? 5 : 4;
+            ma = az;
+            sc = std::signbit(z[i]) ? -x[i] : x[i];
+            tc = -y[i];
+        }
+        s[i] = 0.5f * sc / ma + 0.5f;
+        t[i] = 0.5f * tc / ma + 0.5f;
+    }
+}
+
+// Adds weight times the bilinearly filtered texel at (s, t) of a face of
+// a level of the cubemap to rgb. Texels are clamped to the face edges.
+void addFloatCubemapTexel(const FloatCubemap &cube, unsigned level, int face, float s, float t,
+                          float weight, float rgb[3])
+{
+    int size = int(cube.sizes[level]);
+    const float *texels = cube.texels[6 * level + face].data();
+    float fx = s * size - 0.5f, fy = t * size - 0.5f;
+    float x0f = std::floor(fx), y0f = std::floor(fy);
+    float wx = fx - x0f, wy = fy - y0f;
+    int x0 = std::min(std::max(int(x0f), 0), size - 1), x1 = std::min(std::max(int(x0f) + 1, 0), size - 1);
+    int y0 = std::min(std::max(int(y0f), 0), size - 1), y1 = std::min(std::max(int(y0f) + 1, 0), size - 1);
+    const float *p00 = texels + 3 * (y0 * size + x0), *p01 = texels + 3 * (y0 * size + x1);
+    const float *p10 = texels + 3 * (y1 * size + x0), *p11 = texels + 3 * (y1 * size + x1);
+    float w00 = (1.0f - wx) * (1.0f - wy) * weight, w01 = wx * (1.0f - wy) * weight;
+    float w10 = (1.0f - wx) * wy * weight, w11 = wx * wy * weight;
+    for (int c = 0; c < 3; ++c) {
+        rgb[c] += w00 * p00[c] + w01 * p01[c] + w10 * p10[c] + w11 * p11[c];
+    }
+}
+
+} // namespace
+
+// Prefilters the cubemap in dirname (posx.png, ..., negz.png) for every
+// Phong exponent of CUBEMAP_PREFILTERED_LEVELS, and writes the levels to
+// outDirname/<exponent>/<face>.png, in the layout of loadCubemapMipmap.
+// Each output texel integrates the environment over the lobe around the
+// direction of the texel with numSamples importance samples, which are
+// read from a mipmap level of the source matching the solid angle of the
+// sample (filtered importance sampling), so that few samples suffice.
+// Level 0 has the size of the source, at most maxSize, and every level
+// halves it. The faces, levels, and rows are filtered in parallel.
+// Returns true on success, false otherwise.
+bool prefilterCubemap(const std::string &dirname, const std::string &outDirname, PrefilterLobe lobe,
+                      unsigned numSamples = 64, unsigned maxSize = 512)
+{
+    const unsigned numLevels = sizeof(CUBEMAP_PREFILTERED_LEVELS) / sizeof(CUBEMAP_PREFILTERED_LEVELS[0]);
+
+    // Decodes the faces and converts them to linear RGB
+    std::vector<unsigned char> data[6];
+    unsigned width[6], height[6], error[6];
+    textureParallelFor(6, [&](std::size_t f) {
+        error[f] = lodepng::decode(data[f], width[f], height[f],
+                                   dirname + "/" + CUBEMAP_FACE_FILENAMES[f]);
+    });
+    for (int f = 0; f < 6; ++f) {
+        if (error[f] != 0) {
+            std::cerr << "Error: " << dirname << "/" << CUBEMAP_FACE_FILENAMES[f] << ": "
+                      << lodepng_error_text(error[f]) << std::endl;
+            return false;
+        }
+        if (width[f] != height[f] || width[f] != width[0]) {
+            std::cerr << "Error: Cubemap faces in " << dirname << " are not squares of equal size"
+                      << std::endl;
+            return false;
+        }
+    }
+    float srgb[256];
+    for (int i = 0; i < 256; ++i) {
+        srgb[i] = srgbToLinear((unsigned char)i);
+    }
+    FloatCubemap source;
+    source.sizes.push_back(width[0]);
+    source.texels.resize(6);
+    for (int f = 0; f < 6; ++f) {
+        source.texels[f].resize(3 * width[0] * width[0]);
+        for (std::size_t i = 0; i < std::size_t(width[0]) * width[0]; ++i) {
+            for (int c = 0; c < 3; ++c) {
+                source.texels[f][3 * i + c] = srgb[data[f][4 * i + c]];
+            }
+        }
+    }
+
+    // Mipmap chain of the source, down to 1x1 texels
+    while (source.sizes.back() > 1) {
+        unsigned size = source.sizes.back(), half = std::max(size / 2, 1u);
+        std::size_t level = source.sizes.size() - 1;
+        source.sizes.push_back(half);
+        source.texels.resize(source.texels.size() + 6);
+        for (int f = 0; f < 6; ++f) {
+            const std::vector<float> &src = source.texels[6 * level + f];
+            std::vector<float> &dst = source.texels[6 * (level + 1) + f];
+            dst.resize(3 * half * half);
+            for (unsigned y = 0; y < half; ++y) {
+                unsigned y0 = std::min(2 * y, size - 1), y1 = std::min(2 * y + 1, size - 1);
+                for (unsigned x = 0; x < half; ++x) {
+                    unsigned x0 = std::min(2 * x, size - 1), x1 = std::min(2 * x + 1, size - 1);
+                    for (int c = 0; c < 3; ++c) {
+                        dst[3 * (y * half + x) + c] =
+                            0.25f * (src[3 * (y0 * size + x0) + c] + src[3 * (y0 * size + x1) + c] +
+                                     src[3 * (y1 * size + x0) + c] + src[3 * (y1 * size + x1) + c]);
+                    }
+                }
+            }
+        }
+    }
+
+    // Importance samples of the lobe of each level, in the frame where
+    // the lobe is centered on +z (the same samples for every texel), with
+    // their weights and source mipmap levels. The samples are Hammersley
+    // points, packed in groups of four for cubemapProjectDirections.
+    struct LobeSamples {
+        std::vector<float> x, y, z, weight, lod;
+    };
+    std::vector<LobeSamples> lobes(numLevels);
+    const float pi = 3.14159265f;
+    float texelSolidAngle = 4.0f * pi / (6.0f * float(width[0]) * float(width[0]));
+    for (unsigned l = 0; l < numLevels; ++l) {
+        float exponent = float(std::atof(CUBEMAP_PREFILTERED_LEVELS[l]));
+        float alpha2 = 2.0f / (exponent + 2.0f);  // GGX roughness^2 of the Phong exponent
+        LobeSamples &samples = lobes[l];
+        for (unsigned i = 0; i < numSamples; ++i) {
+            std::uint32_t bits = i;
+            bits = (bits << 16) | (bits >> 16);
+            bits = ((bits & 0x55555555u) << 1) | ((bits & 0xAAAAAAAAu) >> 1);
+            bits = ((bits & 0x33333333u) << 2) | ((bits & 0xCCCCCCCCu) >> 2);
+            bits = ((bits & 0x0F0F0F0Fu) << 4) | ((bits & 0xF0F0F0F0u) >> 4);
+            bits = ((bits & 0x00FF00FFu) << 8) | ((bits & 0xFF00FF00u) >> 8);
+            float u = (i + 0.5f) / numSamples, phi = 2.0f * pi * float(bits) * 2.3283064365386963e-10f;
+
+            float lx, ly, lz, weight, pdf;
+            if (lobe == PREFILTER_PHONG) {
+                float cosTheta = std::pow(u, 1.0f / (exponent + 1.0f));
+                float sinTheta = std::sqrt(std::max(1.0f - cosTheta * cosTheta, 0.0f));
+                lx = sinTheta * std::cos(phi);
+                ly = sinTheta * std::sin(phi);
+                lz = cosTheta;
+                weight = 1.0f;
+                pdf = (exponent + 1.0f) / (2.0f * pi) * std::pow(cosTheta, exponent);
+            }
+            else {
+                // Samples the half vector, and reflects the view vector
+                // (which is the normal, at the center of the lobe) about it.
+                // The samples are weighted by the cosine of the normal.
+                float cosH2 = (1.0f - u) / (1.0f + (alpha2 - 1.0f) * u);
+                float cosH = std::sqrt(cosH2), sinH = std::sqrt(std::max(1.0f - cosH2, 0.0f));
+                float d = (alpha2 - 1.0f) * cosH2 + 1.0f;
+                lx = 2.0f * cosH * sinH * std::cos(phi);
+                ly = 2.0f * cosH * sinH * std::sin(phi);
+                lz = 2.0f * cosH2 - 1.0f;
+                weight = lz;
+                pdf = alpha2 / (pi * d * d) / 4.0f;
+                if (lz <= 0.0f) {
+                    continue;
+                }
+            }
+            samples.x.push_back(lx);
+            samples.y.push_back(ly);
+            samples.z.push_back(lz);
+            samples.weight.push_back(weight);
+            float sampleSolidAngle = 1.0f / (numSamples * std::max(pdf, 1e-8f));
+            float lod = 0.5f * std::log2(sampleSolidAngle / texelSolidAngle);
+            samples.lod.push_back(std::min(std::max(lod, 0.0f), float(source.sizes.size() - 1)));
+        }
+    }
+
+    // Output levels, split into tasks of a few rows of a face
+    const unsigned rowsPerTask = 8;
+    unsigned outSize = std::min(width[0], maxSize);
+    std::vector<unsigned> outSizes(numLevels);
+    std::vector<std::vector<unsigned char>> out(6 * numLevels);
+    struct Task {
+        unsigned level, face, firstRow;
+    };
+    std::vector<Task> tasks;
+    for (unsigned l = 0; l < numLevels; ++l) {
+        outSizes[l] = std::max(outSize >> l, 1u);
+        for (unsigned f = 0; f < 6; ++f) {
+            out[6 * l + f].resize(4 * outSizes[l] * outSizes[l]);
+            for (unsigned y = 0; y < outSizes[l]; y += rowsPerTask) {
+                tasks.push_back({ l, f, y });
+            }
+        }
+    }
+
+    textureParallelFor(tasks.size(), [&](std::size_t taskIndex) {
+        const Task &task = tasks[taskIndex];
+        const LobeSamples &samples = lobes[task.level];
+        std::size_t n = samples.z.size();
+        unsigned size = outSizes[task.level];
+        std::vector<float> wx(n), wy(n), wz(n), s(n), t(n);
+        std::vector<int> faces(n);
+        for (unsigned y = task.firstRow; y < std::min(task.firstRow + rowsPerTask, size); ++y) {
+            for (unsigned x = 0; x < size; ++x) {
+                // Frame around the direction of the texel
+                float r[3];
+                cubemapDirection(int(task.face), 2.0f * (x + 0.5f) / size - 1.0f,
+                                 2.0f * (y + 0.5f) / size - 1.0f, r);
+                float len = std::sqrt(r[0] * r[0] + r[1] * r[1] + r[2] * r[2]);
+                r[0] /= len; r[1] /= len; r[2] /= len;
+                float up[3] = { 0.0f, 0.0f, 1.0f };
+                if (std::abs(r[2]) > 0.999f) {
+                    up[0] = 1.0f; up[2] = 0.0f;
+                }
+                float tx = up[1] * r[2] - up[2] * r[1], ty = up[2] * r[0] - up[0] * r[2],
+                      tz = up[0] * r[1] - up[1] * r[0];
+                float tlen = std::sqrt(tx * tx + ty * ty + tz * tz);
+                tx /= tlen; ty /= tlen; tz /= tlen;
+                float bx = r[1] * tz - r[2] * ty, by = r[2] * tx - r[0] * tz, bz = r[0] * ty - r[1] * tx;
+
+                // Rotates the samples into the frame
+                std::size_t i = 0;
+#ifdef __SSE2__
+                __m128 t0 = _mm_set1_ps(tx), t1 = _mm_set1_ps(ty), t2 = _mm_set1_ps(tz);
+                __m128 b0 = _mm_set1_ps(bx), b1 = _mm_set1_ps(by), b2 = _mm_set1_ps(bz);
+                __m128 r0 = _mm_set1_ps(r[0]), r1 = _mm_set1_ps(r[1]), r2 = _mm_set1_ps(r[2]);
+                for (; i + 4 <= n; i += 4) {
+                    __m128 lx = _mm_loadu_ps(&samples.x[i]), ly = _mm_loadu_ps(&samples.y[i]),
+                           lz = _mm_loadu_ps(&samples.z[i]);
+                    _mm_storeu_ps(&wx[i], _mm_add_ps(_mm_add_ps(_mm_mul_ps(t0, lx), _mm_mul_ps(b0, ly)),
+                                                     _mm_mul_ps(r0, lz)));
+                    _mm_storeu_ps(&wy[i], _mm_add_ps(_mm_add_ps(_mm_mul_ps(t1, lx), _mm_mul_ps(b1, ly)),
+                                                     _mm_mul_ps(r1, lz)));
+                    _mm_storeu_ps(&wz[i], _mm_add_ps(_mm_add_ps(_mm_mul_ps(t2, lx), _mm_mul_ps(b2, ly)),
+                                                     _mm_mul_ps(r2, lz)));
+                }
+#endif
+                for (; i < n; ++i) {
+                    wx[i] = tx * samples.x[i] + bx * samples.y[i] + r[0] * samples.z[i];
+                    wy[i] = ty * samples.x[i] + by * samples.y[i] + r[1] * samples.z[i];
+                    wz[i] = tz * samples.x[i] + bz * samples.y[i] + r[2] * samples.z[i];
+                }
+                cubemapProjectDirections(wx.data(), wy.data(), wz.data(), n, faces.data(), s.data(), t.data());
+
+                // Accumulates the samples, trilinearly filtered
+                float rgb[3] = { 0.0f, 0.0f, 0.0f };
+                float weightSum = 0.0f;
+                for (i = 0; i < n; ++i) {
+                    float lod = samples.lod[i];
+                    unsigned l0 = unsigned(lod);
+                    unsigned l1 = std::min(l0 + 1, unsigned(source.sizes.size() - 1));
+                    float w1 = (lod - l0) * samples.weight[i];
+                    addFloatCubemapTexel(source, l0, faces[i], s[i], t[i], samples.weight[i] - w1, rgb);
+                    if (w1 > 0.0f) {
+                        addFloatCubemapTexel(source, l1, faces[i], s[i], t[i], w1, rgb);
+                    }
+                    weightSum += samples.weight[i];
+                }
+                unsigned char *texel = &out[6 * task.level + task.face][4 * (y * size + x)];
+                for (int c = 0; c < 3; ++c) {
+                    texel[c] = linearToSrgb(weightSum > 0.0f ? rgb[c] / weightSum : 0.0f);
+                }
+                texel[3] = 255;
+            }
+        }
+    });
+
+    // Writes the levels
+    std::vector<unsigned> writeErrors(6 * numLevels, 0);
+    for (unsigned l = 0; l < numLevels; ++l) {
+        std::error_code ec;
+        std::filesystem::create_directories(outDirname + "/" + CUBEMAP_PREFILTERED_LEVELS[l], ec);
+    }
+    textureParallelFor(6 * numLevels, [&](std::size_t i) {
+        std::string filename = outDirname + "/" + CUBEMAP_PREFILTERED_LEVELS[i / 6] + "/" +
+                               CUBEMAP_FACE_FILENAMES[i % 6];
+        writeErrors[i] = lodepng::encode(filename, out[i], outSizes[i / 6], outSizes[i / 6]);
+    });
+    for (unsigned i = 0; i < 6 * numLevels; ++i) {
+        if (writeErrors[i] != 0) {
+            std::cerr << "Error: Could not write " << outDirname << "/" << CUBEMAP_PREFILTERED_LEVELS[i / 6]
+                      << "/" << CUBEMAP_FACE_FILENAMES[i % 6] << ": " << lodepng_error_text(writeErrors[i])
+                      << std::endl;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Load the prefiltered mipmap chain of the cubemap in dirname (see
+// loadCubemapMipmap). The chain is read from dirname/prefiltered (or
+// dirname/prefiltered_ggx for the GGX lobe) if it exists, and is
+// otherwise prefiltered from the cubemap in dirname and written there
+// first, so that only the first run pays for it. Delete the directory to
+// prefilter again. Returns the prefiltering time in *seconds (0 if the
+// chain was read from the disk).
+GLuint loadPrefilteredCubemap(const std::string &dirname, PrefilterLobe lobe, double *seconds)
+{
+    std::string cacheDirname = dirname + (lobe == PREFILTER_PHONG ? "/prefiltered" : "/prefiltered_ggx");
+    const unsigned numLevels = sizeof(CUBEMAP_PREFILTERED_LEVELS) / sizeof(CUBEMAP_PREFILTERED_LEVELS[0]);
+    *seconds = 0.0;
+    std::error_code ec;
+    if (!std::filesystem::exists(cacheDirname + "/" + CUBEMAP_PREFILTERED_LEVELS[numLevels - 1] + "/" +
+                                 CUBEMAP_FACE_FILENAMES[5], ec)) {
+        auto start = std::chrono::steady_clock::now();
+        if (!prefilterCubemap(dirname, cacheDirname, lobe)) {
+            std::exit(EXIT_FAILURE);
+        }
+        *seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        // Display log message
+        std::cout << "Prefiltered " << dirname << " (" << (lobe == PREFILTER_PHONG ? "Phong" : "GGX")
+                  << " lobe) in " << *seconds << " s" << std::endl;
+    }
+
+    return loadCubemapMipmap(cacheDirname);
+}